@@ -4,69 +4,55 @@
 #include "interrupts.h"
 #include "alarm.h"
 #include "minithread.h"
-#include "queue.h"
+#include "minithread_private.h"
+#include "intrusive_queue.h"
+#include "machineprimitives.h"
 
 
-//Private time reference for the alarms.
-long *current_tick_ptr;
-int clock_period = MINITHREAD_CLOCK_PERIOD; 
-
-//Priority queue for alarms.
+//Priority queue for alarms, sorted by deadline, linked through the alarms themselves.
 //Modification of this queue must be protected by disabling interrupts.
-queue_t alarm_queue;
-
-//Second buffer queue to store thread which are registered to wake up earlier.
-queue_t buffer_queue;
-
+iqueue alarm_queue;
 
-typedef struct alarm {
-	long 			trigger_tick;
-	alarm_handler_t handler;
-	void* 			arg;
-	int 			executed;
-} alarm;
-typedef alarm *alarm_t;
 
-
-/* see alarm.h */
-alarm_id
-register_alarm(int delay, alarm_handler_t alarm, void *arg)
+//Set up new_alarm to go off at deadline and insert it in the alarm queue.
+static alarm_id
+alarm_insert(alarm_t new_alarm, uint64_t deadline, alarm_handler_t alarm, void *arg, int embedded)
 {
-	alarm_t p_alarm;
-	int ticks = (delay / clock_period);
+	iqueue_link_t position;
     interrupt_level_t old_level;
 
-    alarm_t new_alarm = (alarm_t) malloc(sizeof(struct alarm));
-    new_alarm->trigger_tick = *current_tick_ptr + ticks;
-
-    if(delay % clock_period) new_alarm->trigger_tick += 1;
+    iqueue_link_init(&new_alarm->link);
+    new_alarm->deadline = deadline;
 
     new_alarm->handler = alarm;
     new_alarm->arg = arg;
     new_alarm->executed = 0;
+    new_alarm->embedded = embedded;
 
-    //Find rightful position in the priority queue.
-
-    //Remove all the alarms which will trigger earlier.
+    //Find rightful position in the priority queue, after the alarms which will trigger earlier.
+    //Alarms are mostly registered with later deadlines than those already
+    //queued, so look for it from the back.
     //First we disable interrupts as we will be modifying the alarm queue
     old_level = set_interrupt_level(DISABLED);
 
-    while(queue_dequeue(alarm_queue, (void **) &p_alarm) == 0){
-    	queue_prepend(buffer_queue, p_alarm);
-
-    	if(new_alarm->trigger_tick <= p_alarm->trigger_tick){
-            queue_dequeue(buffer_queue, (void **) &p_alarm);
-            queue_prepend(alarm_queue, p_alarm);
-            break;
-        }
+    position = iqueue_last(&alarm_queue);
+    while(position != NULL &&
+            iqueue_entry(position, struct alarm, link)->deadline > new_alarm->deadline){
+        position = iqueue_prev(&alarm_queue, position);
     }
 
-    //Add this new alarm to the queue.
-    queue_prepend(alarm_queue, new_alarm);
+    //Add this new alarm to the queue, right after position.
+    if(position == NULL){
+        iqueue_prepend(&alarm_queue, &new_alarm->link);
+    } else if(iqueue_next(&alarm_queue, position) == NULL){
+        iqueue_append(&alarm_queue, &new_alarm->link);
+    } else {
+        iqueue_insert_before(&alarm_queue, iqueue_next(&alarm_queue, position), &new_alarm->link);
+    }
 
-    //Rebuild the rest of the queue.
-    while(queue_dequeue(buffer_queue, (void **) &p_alarm) == 0){
-    	queue_prepend(alarm_queue, p_alarm);
+    //A tickless clock has to be told about a new earliest alarm.
+    if(iqueue_first(&alarm_queue) == &new_alarm->link){
+        minithread_alarm_clock_request(new_alarm->deadline);
     }
 
     set_interrupt_level(old_level);
@@ -74,6 +60,40 @@ register_alarm(int delay, alarm_handler_t alarm, void *arg)
     return (alarm_id) new_alarm;
 }
 
+/* see alarm.h */
+alarm_id
+register_alarm(int delay, alarm_handler_t alarm, void *arg)
+{
+    alarm_t new_alarm = (alarm_t) malloc(sizeof(struct alarm));
+    if(new_alarm == NULL) return NULL;
+
+    return alarm_insert(new_alarm, currentTimeNanos() + (uint64_t) delay * MILLISECOND, alarm, arg, 0);
+}
+
+/* see alarm.h */
+alarm_id
+register_alarm_us(long delay, alarm_handler_t alarm, void *arg)
+{
+    alarm_t new_alarm = (alarm_t) malloc(sizeof(struct alarm));
+    if(new_alarm == NULL) return NULL;
+
+    return alarm_insert(new_alarm, currentTimeNanos() + (uint64_t) delay * MICROSECOND, alarm, arg, 0);
+}
+
+/* see alarm.h */
+alarm_id
+register_alarm_embedded(alarm_t a, int delay, alarm_handler_t alarm, void *arg)
+{
+    return alarm_insert(a, currentTimeNanos() + (uint64_t) delay * MILLISECOND, alarm, arg, 1);
+}
+
+/* see alarm.h */
+alarm_id
+register_alarm_embedded_at(alarm_t a, uint64_t deadline, alarm_handler_t alarm, void *arg)
+{
+    return alarm_insert(a, deadline, alarm, arg, 1);
+}
+
 /* see alarm.h */
 int
 deregister_alarm(alarm_id alarm)
@@ -81,52 +101,45 @@ deregister_alarm(alarm_id alarm)
     interrupt_level_t old_level;
 
     int found_alarm = 0;
-    alarm_t p_alarm;
 	alarm_t a = (alarm_t) alarm;
 
 	if(a == NULL) return 0;
 
-    //Pop from the queue.
+    //The alarm knows whether it is queued, there is no need to look for it.
     old_level = set_interrupt_level(DISABLED);
 
-    while(queue_dequeue(alarm_queue, (void **) &p_alarm) == 0){
-        queue_prepend(buffer_queue, p_alarm);
-
-        if(p_alarm == a){
-            queue_dequeue(buffer_queue, (void **) &p_alarm);
-            found_alarm = 1;
-            break;
-        }
-    }
-
-    //Rebuild the rest of the queue.
-    while(queue_dequeue(buffer_queue, (void **) &p_alarm) == 0){
-        queue_prepend(alarm_queue, p_alarm);
+    if(iqueue_linked(&a->link)){
+        iqueue_delete(&alarm_queue, &a->link);
+        found_alarm = 1;
     }
 
     set_interrupt_level(old_level);
 
     //If the alarm was actually in the queue, free its memory.
     if(found_alarm){
-        free(a);
+        if(!a->embedded) free(a);
         return 0;
     }
 
-    //this alarm was not in the queue, so it has already fired and was freed.
+    //this alarm was not in the queue, so it has already fired.
     return 1;
 }
 
 alarm_id pop_alarm(){
-	alarm_t best_alarm;
+	iqueue_link_t first;
+	alarm_t best_alarm = NULL;
     interrupt_level_t old_level;
 
     //Disable interrupts to protect the alarm queue.
 	old_level = set_interrupt_level(DISABLED);
 
-	if(queue_dequeue(alarm_queue, (void **) &best_alarm) == 0){
-		if(best_alarm->trigger_tick > *current_tick_ptr){
-			queue_prepend(alarm_queue, best_alarm);
+	first = iqueue_first(&alarm_queue);
+	if(first != NULL){
+		best_alarm = iqueue_entry(first, struct alarm, link);
+		if(best_alarm->deadline > currentTimeNanos()){
 			best_alarm = NULL;
+		} else {
+			iqueue_delete(&alarm_queue, first);
 		}
 	}
 
@@ -142,11 +155,15 @@ void execute_alarm(alarm_id alarm){
 }
 
 
-void initialize_alarm_system(int period, long *tick_pointer){
-	clock_period = period/MILLISECOND;
-	current_tick_ptr = tick_pointer;
-	alarm_queue = queue_new();
-	buffer_queue = queue_new();
+uint64_t alarm_next_deadline(){
+	iqueue_link_t first = iqueue_first(&alarm_queue);
+
+	if(first == NULL) return 0;
+	return iqueue_entry(first, struct alarm, link)->deadline;
+}
+
+void initialize_alarm_system(){
+	iqueue_init(&alarm_queue);
 }
 
 
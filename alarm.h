@@ -1,6 +1,9 @@
 #ifndef __ALARM_H__
 #define __ALARM_H__ 1
 
+#include <stdint.h>
+#include "intrusive_queue.h"
+
 /*
  * This is the alarm interface. You should implement the functions for these
  * prototypes, though you may have to modify some other files to do so.
@@ -16,14 +19,45 @@
 typedef void (*alarm_handler_t)(void*);
 typedef void *alarm_id;
 
+/* An alarm sits on the alarm queue through its embedded link. register_alarm
+ * allocates one, but an alarm can also be embedded in whatever it belongs to
+ * (e.g. a thread control block) and registered with register_alarm_embedded,
+ * so that arming it needs no allocation at all.
+ */
+typedef struct alarm {
+	iqueue_link 	link;
+	uint64_t 		deadline;
+	alarm_handler_t handler;
+	void* 			arg;
+	int 			executed;
+	int 			embedded;
+} alarm;
+typedef alarm *alarm_t;
+
 
 /* register an alarm to go off in "delay" milliseconds.  Returns a handle to
  * the alarm.
  */
 alarm_id register_alarm(int delay, alarm_handler_t func, void *arg);
 
+/* register an alarm to go off in "delay" microseconds. The alarm goes off
+ * on the first clock interrupt after its deadline, so only a tickless clock
+ * gives it better than clock period resolution.
+ */
+alarm_id register_alarm_us(long delay, alarm_handler_t func, void *arg);
+
+/* register the caller-owned alarm a to go off in "delay" milliseconds. The
+ * alarm must not be registered already. Returns a handle to the alarm.
+ */
+alarm_id register_alarm_embedded(alarm_t a, int delay, alarm_handler_t func, void *arg);
+
+/* register the caller-owned alarm a to go off at deadline, in
+ * currentTimeNanos() time. The alarm must not be registered already.
+ */
+alarm_id register_alarm_embedded_at(alarm_t a, uint64_t deadline, alarm_handler_t func, void *arg);
+
 /* unregister an alarm.  Returns 0 if the alarm had not been executed, 1
- * otherwise.
+ * otherwise. Embedded alarms are never freed.
  */
 int deregister_alarm(alarm_id id);
 
@@ -32,12 +66,17 @@ int deregister_alarm(alarm_id id);
  */
 alarm_id pop_alarm();
 
+/* Deadline of the earliest alarm, in currentTimeNanos() time, or 0 if there
+ * is none. Call with interrupts disabled.
+ */
+uint64_t alarm_next_deadline();
+
 /* Executes the alarm's handler.
  */
 void execute_alarm(alarm_id alarm);
 
-/* Allows the alarms implementation to know the clock_period and the current time.
+/* Sets up the alarm queue. Alarms keep time with currentTimeNanos().
  */
-void initialize_alarm_system(int period, long *current_tick_pointer);
+void initialize_alarm_system();
 
 #endif
@@ -0,0 +1,267 @@
+/*
+ * Bounded channels.
+ *
+ */
+#include <stdlib.h>
+
+#include "channel.h"
+#include "defs.h"
+#include "interrupts.h"
+#include "intrusive_queue.h"
+#include "minithread_private.h"
+
+/*
+	A channel is a ring buffer of capacity items, with the threads waiting
+	to send or receive queued on it. Receivers only wait while the buffer
+	is empty, and senders while it is full: an item sent while a receiver
+	waits is put straight into its case, and a receiver taking an item out
+	of a full buffer moves the item of the first waiting sender into the
+	slot it freed. Either way the thread that finds the other one waiting
+	does the whole transfer, in one critical section, and the woken thread
+	has nothing left to do.
+
+	A thread waiting in select puts a waiter on each of the channels, all
+	pointing to a wait shared by them, like the waiters of futures. The
+	first case done for it records its index in the wait; waiters of a wait
+	that is over are skipped, and taken off by their thread when it runs.
+	Everything is protected by disabling interrupts, and a thread blocks
+	with them still disabled, so it cannot miss a transfer.
+*/
+
+#define CHANNEL_WAITERS_INLINE 8
+
+typedef struct channel {
+	void 	**items;
+	int 	capacity;
+	int 	head;
+	int 	count;
+	int 	closed;
+	iqueue 	senders;
+	iqueue 	receivers;
+} channel;
+
+typedef struct channel_wait {
+	minithread_t 	thread;
+	int 			done;		// index of the case done, or -1
+} channel_wait;
+
+typedef struct channel_waiter {
+	iqueue_link 	link;
+	channel_wait 	*wait;
+	channel_case_t 	*c;
+	int 			index;
+} channel_waiter;
+
+#define waiter_of(l) iqueue_entry(l, channel_waiter, link)
+
+channel_t channel_create(int capacity){
+	channel_t ch;
+
+	if(capacity < 0) return NULL;
+
+	ch = (channel_t) malloc(sizeof(channel));
+	if(ch == NULL) return NULL;
+
+	ch->items = NULL;
+	if(capacity > 0){
+		ch->items = (void **) malloc(sizeof(void *) * capacity);
+		if(ch->items == NULL){
+			free(ch);
+			return NULL;
+		}
+	}
+	ch->capacity = capacity;
+	ch->head = 0;
+	ch->count = 0;
+	ch->closed = 0;
+	iqueue_init(&ch->senders);
+	iqueue_init(&ch->receivers);
+	return ch;
+}
+
+void channel_destroy(channel_t ch){
+	free(ch->items);
+	free(ch);
+}
+
+//Take the first waiter of queue whose wait is not over, or return NULL.
+static channel_waiter *channel_next_waiter(iqueue_t queue){
+	iqueue_link_t link;
+
+	while(iqueue_dequeue(queue, &link) == 0){
+		if(waiter_of(link)->wait->done == -1) return waiter_of(link);
+	}
+	return NULL;
+}
+
+//End the wait of w with its case done, and wake up its thread.
+static void channel_finish(channel_waiter *w, int status){
+	w->c->status = status;
+	w->wait->done = w->index;
+	minithread_start(w->wait->thread);
+}
+
+/*
+* Do c if it can be done right away, and return 1, or else 0. Must be
+* called with interrupts disabled.
+*/
+static int channel_try(channel_case_t *c){
+	channel_t ch = c->channel;
+	channel_waiter *w;
+
+	if(c->op == CHANNEL_SEND){
+		if(ch->closed){
+			c->status = -1;
+			return 1;
+		}
+		if((w = channel_next_waiter(&ch->receivers)) != NULL){
+			w->c->item = c->item;
+			channel_finish(w, 0);
+		} else if(ch->count < ch->capacity){
+			ch->items[(ch->head + ch->count) % ch->capacity] = c->item;
+			ch->count++;
+		} else {
+			return 0;
+		}
+	} else {
+		if(ch->count > 0){
+			c->item = ch->items[ch->head];
+			//The buffer is full if a sender waits: its item goes last, in the slot just freed.
+			if((w = channel_next_waiter(&ch->senders)) != NULL){
+				ch->items[ch->head] = w->c->item;
+				channel_finish(w, 0);
+			} else {
+				ch->count--;
+			}
+			ch->head = (ch->head + 1) % ch->capacity;
+		} else if((w = channel_next_waiter(&ch->senders)) != NULL){
+			c->item = w->c->item;
+			channel_finish(w, 0);
+		} else if(ch->closed){
+			c->item = NULL;
+			c->status = -1;
+			return 1;
+		} else {
+			return 0;
+		}
+	}
+
+	c->status = 0;
+	return 1;
+}
+
+int channel_select(channel_case_t *cases, int count, int block){
+	channel_waiter inline_waiters[CHANNEL_WAITERS_INLINE];
+	channel_waiter *waiters = inline_waiters;
+	channel_wait wait;
+	interrupt_level_t old_level;
+	iqueue_t queue;
+	int i;
+
+	if(count <= 0) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	for(i = 0; i < count; i++){
+		if(channel_try(&cases[i])){
+			set_interrupt_level(old_level);
+			return i;
+		}
+	}
+	if(!block){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+
+	if(count > CHANNEL_WAITERS_INLINE){
+		waiters = (channel_waiter *) malloc(sizeof(channel_waiter) * count);
+		AbortOnCondition(waiters == NULL, "channel_select");
+	}
+
+	wait.thread = minithread_self();
+	wait.done = -1;
+	for(i = 0; i < count; i++){
+		queue = cases[i].op == CHANNEL_SEND ? &cases[i].channel->senders : &cases[i].channel->receivers;
+		iqueue_link_init(&waiters[i].link);
+		waiters[i].wait = &wait;
+		waiters[i].c = &cases[i];
+		waiters[i].index = i;
+		iqueue_append(queue, &waiters[i].link);
+	}
+
+	minithread_block(MINITHREAD_BLOCK_CHANNEL);
+
+	//Take the waiters still queued off the channels of the other cases.
+	for(i = 0; i < count; i++){
+		if(!iqueue_linked(&waiters[i].link)) continue;
+		queue = cases[i].op == CHANNEL_SEND ? &cases[i].channel->senders : &cases[i].channel->receivers;
+		iqueue_delete(queue, &waiters[i].link);
+	}
+	if(waiters != inline_waiters) free(waiters);
+
+	set_interrupt_level(old_level);
+	return wait.done;
+}
+
+int channel_send(channel_t ch, void *item){
+	channel_case_t c;
+
+	c.channel = ch;
+	c.op = CHANNEL_SEND;
+	c.item = item;
+	channel_select(&c, 1, 1);
+	return c.status;
+}
+
+int channel_recv(channel_t ch, void **item){
+	channel_case_t c;
+
+	c.channel = ch;
+	c.op = CHANNEL_RECV;
+	channel_select(&c, 1, 1);
+	*item = c.item;
+	return c.status;
+}
+
+int channel_try_send(channel_t ch, void *item){
+	channel_case_t c;
+
+	c.channel = ch;
+	c.op = CHANNEL_SEND;
+	c.item = item;
+	if(channel_select(&c, 1, 0) == -1) return 1;
+	return c.status;
+}
+
+int channel_try_recv(channel_t ch, void **item){
+	channel_case_t c;
+
+	c.channel = ch;
+	c.op = CHANNEL_RECV;
+	if(channel_select(&c, 1, 0) == -1) return 1;
+	*item = c.item;
+	return c.status;
+}
+
+int channel_close(channel_t ch){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	channel_waiter *w;
+
+	if(ch->closed){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+	ch->closed = 1;
+
+	//Senders fail, and receivers wait only while the buffer is empty: they fail too.
+	while((w = channel_next_waiter(&ch->senders)) != NULL){
+		channel_finish(w, -1);
+	}
+	while((w = channel_next_waiter(&ch->receivers)) != NULL){
+		w->c->item = NULL;
+		channel_finish(w, -1);
+	}
+
+	set_interrupt_level(old_level);
+	return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+/*
+ * channel.h:
+ *  Bounded channels. A channel carries pointers from the threads sending
+ *  them to the threads receiving them, in order, holding up to capacity of
+ *  them in between: senders block while it is full, and receivers while it
+ *  is empty. A channel of capacity 0 holds none, and every send waits for
+ *  a receiver to meet it.
+ *
+ *  Only the pointer goes through the channel, not what it points to, and
+ *  an item sent while a receiver is waiting is handed straight to it. A
+ *  thread can also wait on several channels at once with channel_select,
+ *  for the first of a set of sends and receives that can be done.
+ */
+#include "minithread.h"
+
+typedef struct channel *channel_t;
+
+#define CHANNEL_SEND 0
+#define CHANNEL_RECV 1
+
+/*
+ * One of the operations channel_select waits for: op is CHANNEL_SEND, to
+ * send item to channel, or CHANNEL_RECV, to receive an item from channel
+ * into item. Once done, status is 0, or -1 if it failed because channel
+ * is closed.
+ */
+typedef struct channel_case {
+	channel_t 	channel;
+	int 		op;
+	void 		*item;
+	int 		status;
+} channel_case_t;
+
+/*
+ * channel_t channel_create(int capacity)
+ *  Create an open channel holding up to capacity items, which may be 0.
+ *  Returns NULL on failure.
+ */
+extern channel_t channel_create(int capacity);
+
+/*
+ * void channel_destroy(channel_t ch)
+ *  Free a channel no thread is waiting on. The items still in it are
+ *  dropped.
+ */
+extern void channel_destroy(channel_t ch);
+
+/*
+ * int channel_send(channel_t ch, void *item)
+ *  Send item to ch, waiting while ch is full. Returns 0 (success) or -1
+ *  if ch is closed.
+ */
+extern int channel_send(channel_t ch, void *item);
+
+/*
+ * int channel_recv(channel_t ch, void **item)
+ *  Receive the next item from ch into *item, waiting while ch is empty.
+ *  Returns 0 (success) or -1 if ch is closed and empty.
+ */
+extern int channel_recv(channel_t ch, void **item);
+
+/*
+ * int channel_try_send(channel_t ch, void *item)
+ * int channel_try_recv(channel_t ch, void **item)
+ *  Like channel_send and channel_recv, but return 1 instead of waiting.
+ *  May be called from interrupt handlers.
+ */
+extern int channel_try_send(channel_t ch, void *item);
+extern int channel_try_recv(channel_t ch, void **item);
+
+/*
+ * int channel_close(channel_t ch)
+ *  Close ch: sending to it fails from now on, and receiving from it once
+ *  the items left in it are received. The threads waiting on it are woken
+ *  up. Returns 0 (success) or -1 if ch was closed already.
+ */
+extern int channel_close(channel_t ch);
+
+/*
+ * int channel_select(channel_case_t *cases, int count, int block)
+ *  Do one of the count cases, the lowest one of those that can be done
+ *  right away, or else, if block is set, the first one that can be done
+ *  later, and return its index. Returns -1 if count is 0, or if none can
+ *  be done right away and block is not set.
+ */
+extern int channel_select(channel_case_t *cases, int count, int block);
+
+#endif /*__CHANNEL_H__*/
@@ -0,0 +1,191 @@
+/*
+ * Stackless coroutines.
+ *
+ */
+#include <stdlib.h>
+
+#include "alarm.h"
+#include "coroutine.h"
+#include "interrupts.h"
+#include "intrusive_queue.h"
+#include "synch.h"
+
+/*
+	Runnable coroutines wait on run_queue for a dispatcher. A coroutine is
+	on at most one queue, the run queue or the waiters of a signal, through
+	its link, and it is never run by two dispatchers at once: one that is
+	made runnable while it runs (by an interrupt handler, or from another
+	processor) is only marked woken, and queued again when it returns.
+
+	Dispatchers block on ready once the run queue is empty, counted in
+	sleeping. Everything here is protected by disabling interrupts, except
+	the coroutine procedures themselves.
+*/
+
+typedef enum {CO_WAITING, CO_QUEUED, CO_RUNNING} co_state_t;
+
+typedef struct coroutine {
+	coroutine_proc_t 	proc;
+	void 				*arg;
+	int 				resume_point;
+	co_state_t 			state;
+	int 				woken;		// made runnable while running
+	int 				signaled;	// handed a post while waiting
+	iqueue_link 		link;
+	struct alarm 		alarm;
+} coroutine;
+
+typedef struct cosignal {
+	int 	count;
+	iqueue 	waiters;
+} cosignal;
+
+#define coroutine_of(l) iqueue_entry(l, coroutine, link)
+
+static iqueue run_queue;
+static int sleeping = 0;
+static semaphore_t ready = NULL;
+
+//Make co runnable. Must be called with interrupts disabled.
+static void coroutine_wake(coroutine_t co){
+	if(co->state == CO_RUNNING){
+		co->woken = 1;
+		return;
+	}
+	if(co->state == CO_QUEUED) return;
+
+	co->state = CO_QUEUED;
+	iqueue_append(&run_queue, &co->link);
+	if(sleeping > 0){
+		sleeping--;
+		semaphore_V(ready);
+	}
+}
+
+static int dispatcher(arg_t arg){
+	interrupt_level_t old_level;
+	iqueue_link_t link;
+	coroutine_t co;
+	int status;
+
+	while(1){
+		old_level = set_interrupt_level(DISABLED);
+		while(iqueue_dequeue(&run_queue, &link) == -1){
+			sleeping++;
+			set_interrupt_level(old_level);
+			semaphore_P(ready);
+			old_level = set_interrupt_level(DISABLED);
+		}
+		co = coroutine_of(link);
+		co->state = CO_RUNNING;
+		co->woken = 0;
+		set_interrupt_level(old_level);
+
+		status = co->proc(co, co->arg);
+
+		old_level = set_interrupt_level(DISABLED);
+		if(status == COROUTINE_DONE){
+			deregister_alarm(&co->alarm);
+			set_interrupt_level(old_level);
+			free(co);
+			continue;
+		}
+		co->state = CO_WAITING;
+		if(status == COROUTINE_YIELD || co->woken) coroutine_wake(co);
+		set_interrupt_level(old_level);
+	}
+	return 0;
+}
+
+int coroutine_initialize(int dispatchers){
+	int i;
+
+	if(ready != NULL || dispatchers < 1) return -1;
+
+	iqueue_init(&run_queue);
+	ready = semaphore_create();
+	semaphore_initialize(ready, 0);
+
+	for(i = 0; i < dispatchers; i++){
+		if(minithread_fork(dispatcher, NULL) == NULL) return -1;
+	}
+	return 0;
+}
+
+coroutine_t coroutine_spawn(coroutine_proc_t proc, void *arg){
+	interrupt_level_t old_level;
+	coroutine_t co = (coroutine_t) malloc(sizeof(coroutine));
+
+	if(co == NULL) return NULL;
+
+	co->proc = proc;
+	co->arg = arg;
+	co->resume_point = 0;
+	co->state = CO_WAITING;
+	co->woken = 0;
+	co->signaled = 0;
+	iqueue_link_init(&co->link);
+	iqueue_link_init(&co->alarm.link);
+
+	old_level = set_interrupt_level(DISABLED);
+	coroutine_wake(co);
+	set_interrupt_level(old_level);
+	return co;
+}
+
+int *coroutine_resume_point(coroutine_t co){
+	return &co->resume_point;
+}
+
+//Alarm handler ending a CO_SLEEP.
+static void coroutine_alarm(void *arg){
+	coroutine_wake((coroutine_t) arg);
+}
+
+void coroutine_sleep(coroutine_t co, int delay){
+	register_alarm_embedded(&co->alarm, delay, coroutine_alarm, co);
+}
+
+int coroutine_wait_signal(coroutine_t co, cosignal_t sig){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	int taken = 1;
+
+	if(co->signaled){
+		co->signaled = 0;
+	} else if(sig->count > 0){
+		sig->count--;
+	} else {
+		iqueue_append(&sig->waiters, &co->link);
+		taken = 0;
+	}
+
+	set_interrupt_level(old_level);
+	return taken;
+}
+
+cosignal_t cosignal_create(){
+	cosignal_t sig = (cosignal_t) malloc(sizeof(cosignal));
+
+	if(sig == NULL) return NULL;
+	sig->count = 0;
+	iqueue_init(&sig->waiters);
+	return sig;
+}
+
+void cosignal_destroy(cosignal_t sig){
+	free(sig);
+}
+
+void cosignal_post(cosignal_t sig){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	iqueue_link_t link;
+
+	if(iqueue_dequeue(&sig->waiters, &link) == 0){
+		coroutine_of(link)->signaled = 1;
+		coroutine_wake(coroutine_of(link));
+	} else {
+		sig->count++;
+	}
+
+	set_interrupt_level(old_level);
+}
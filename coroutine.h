@@ -0,0 +1,119 @@
+#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+/*
+ * coroutine.h:
+ *  Stackless coroutines. A coroutine is a procedure written as a state
+ *  machine: every time it runs, it picks up where it left off, runs until
+ *  it has to wait, and returns. It has no stack of its own, only a small
+ *  descriptor, so hundreds of thousands of them can be waiting at once.
+ *  They run on the stacks of a few dispatcher threads.
+ *
+ *  A coroutine procedure is written between CO_BEGIN and CO_END, and waits
+ *  with CO_YIELD, CO_SLEEP, CO_WAIT_SIGNAL or CO_WAIT_UNTIL. Its local
+ *  variables do not survive a wait: keep whatever has to in the structure
+ *  arg points to. A wait must not be inside a switch statement of its own,
+ *  and there can only be one on a line.
+ *
+ *  int handler(coroutine_t co, void *arg) {
+ *      request_t *r = (request_t *) arg;
+ *
+ *      CO_BEGIN(co);
+ *      for(r->tries = 0; r->tries < 7; r->tries++){
+ *          send_request(r);
+ *          CO_WAIT_SIGNAL(co, r->reply);
+ *          ...
+ *      }
+ *      CO_END(co);
+ *  }
+ *
+ *  Coroutines wait for one another, for threads or for interrupt handlers
+ *  on signals: a signal counts posts, and every post lets one coroutine
+ *  waiting on it go on, or the next one to wait. Unlike semaphore_P,
+ *  waiting on a signal never blocks the dispatcher.
+ *
+ *  Call coroutine_initialize after minithread_system_initialize.
+ */
+#include "minithread.h"
+
+typedef struct coroutine *coroutine_t;
+typedef struct cosignal *cosignal_t;
+
+/* What a coroutine procedure returns: run again later, wait, or done. */
+#define COROUTINE_YIELD 0
+#define COROUTINE_WAIT 1
+#define COROUTINE_DONE 2
+
+typedef int (*coroutine_proc_t)(coroutine_t co, void *arg);
+
+/*
+ * int coroutine_initialize(int dispatchers)
+ *  Start the given number of dispatcher threads (at least 1), which run
+ *  the coroutines. Returns 0 (success) or -1.
+ */
+extern int coroutine_initialize(int dispatchers);
+
+/*
+ * coroutine_t coroutine_spawn(coroutine_proc_t proc, void *arg)
+ *  Create a coroutine running proc(co, arg), and make it runnable. It is
+ *  freed when proc returns COROUTINE_DONE. Returns NULL on failure.
+ */
+extern coroutine_t coroutine_spawn(coroutine_proc_t proc, void *arg);
+
+/*
+ * cosignal_t cosignal_create()
+ *  Create a signal with no posts.
+ *
+ * void cosignal_destroy(cosignal_t sig)
+ *  Free a signal no coroutine is waiting on.
+ *
+ * void cosignal_post(cosignal_t sig)
+ *  Let the first coroutine waiting on sig go on, or count the post for
+ *  the next one to wait. May be called from threads, coroutines and
+ *  interrupt handlers.
+ */
+extern cosignal_t cosignal_create();
+extern void cosignal_destroy(cosignal_t sig);
+extern void cosignal_post(cosignal_t sig);
+
+/*
+ * For the macros below.
+ *
+ * coroutine_resume_point(co) is where co left off, 0 at the start.
+ *
+ * coroutine_sleep(co, delay) makes co runnable again in delay milliseconds.
+ *
+ * coroutine_wait_signal(co, sig) takes a post of sig for co and returns 1,
+ * or queues co on sig and returns 0 if there is none. co then gets the
+ * next post, and the next call returns 1 right away.
+ */
+extern int *coroutine_resume_point(coroutine_t co);
+extern void coroutine_sleep(coroutine_t co, int delay);
+extern int coroutine_wait_signal(coroutine_t co, cosignal_t sig);
+
+#define CO_BEGIN(co) switch(*coroutine_resume_point(co)) { case 0:
+
+#define CO_END(co) } return COROUTINE_DONE
+
+/* Let the other coroutines run, and go on after them. */
+#define CO_YIELD(co) \
+	do { *coroutine_resume_point(co) = __LINE__; return COROUTINE_YIELD; case __LINE__:; } while(0)
+
+/* Go on in delay milliseconds. */
+#define CO_SLEEP(co, delay) \
+	do { *coroutine_resume_point(co) = __LINE__; coroutine_sleep(co, delay); \
+		return COROUTINE_WAIT; case __LINE__:; } while(0)
+
+/* Go on once sig is posted. */
+#define CO_WAIT_SIGNAL(co, sig) \
+	do { *coroutine_resume_point(co) = __LINE__; case __LINE__: \
+		if(!coroutine_wait_signal(co, sig)) return COROUTINE_WAIT; } while(0)
+
+/* Go on once cond holds, testing it again every time the coroutine gets to run. */
+#define CO_WAIT_UNTIL(co, cond) \
+	do { *coroutine_resume_point(co) = __LINE__; case __LINE__: \
+		if(!(cond)) return COROUTINE_YIELD; } while(0)
+
+/* Finish the coroutine. */
+#define CO_EXIT(co) return COROUTINE_DONE
+
+#endif /*__COROUTINE_H__*/
@@ -0,0 +1,188 @@
+/*
+ * Futures.
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "defs.h"
+#include "future.h"
+#include "interrupts.h"
+#include "intrusive_queue.h"
+#include "minithread_private.h"
+
+/*
+	A thread waiting on futures puts a waiter on each of them, which counts
+	down a wait shared by them all: the thread is woken up when the count
+	gets to 0, that is after one completion for any, or after all of them
+	for all. Waiters and waits live on the stack of the waiting thread, or
+	are allocated for large sets. Everything is protected by disabling
+	interrupts, and a thread blocks with them still disabled, so it cannot
+	miss a completion.
+*/
+
+#define FUTURE_WAITERS_INLINE 8
+
+typedef struct future {
+	int 	complete;
+	void 	*value;
+	iqueue 	waiters;
+} future;
+
+typedef struct future_wait {
+	minithread_t 	thread;
+	int 			pending;
+} future_wait;
+
+typedef struct future_waiter {
+	iqueue_link 	link;
+	future_wait 	*wait;
+} future_waiter;
+
+#define waiter_of(l) iqueue_entry(l, future_waiter, link)
+
+future_t future_create(){
+	future_t f = (future_t) malloc(sizeof(future));
+
+	if(f == NULL) return NULL;
+	f->complete = 0;
+	f->value = NULL;
+	iqueue_init(&f->waiters);
+	return f;
+}
+
+void future_destroy(future_t f){
+	free(f);
+}
+
+typedef struct fork_arg {
+	future_t 	f;
+	proc_t 		proc;
+	arg_t 		arg;
+} fork_arg;
+
+static int future_run(arg_t arg){
+	fork_arg fa = *(fork_arg *) arg;
+	int result;
+
+	free(arg);
+	result = fa.proc(fa.arg);
+	future_complete(fa.f, (void *) (intptr_t) result);
+	return result;
+}
+
+future_t future_fork(proc_t proc, arg_t arg){
+	future_t f = future_create();
+	fork_arg *fa = (fork_arg *) malloc(sizeof(fork_arg));
+
+	if(f == NULL || fa == NULL){
+		free(f);
+		free(fa);
+		return NULL;
+	}
+	fa->f = f;
+	fa->proc = proc;
+	fa->arg = arg;
+
+	if(minithread_fork(future_run, (arg_t) fa) == NULL){
+		free(f);
+		free(fa);
+		return NULL;
+	}
+	return f;
+}
+
+int future_complete(future_t f, void *value){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	iqueue_link_t link;
+
+	if(f->complete){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+	f->complete = 1;
+	f->value = value;
+
+	while(iqueue_dequeue(&f->waiters, &link) == 0){
+		future_wait *wait = waiter_of(link)->wait;
+
+		if(--wait->pending == 0) minithread_start(wait->thread);
+	}
+
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+int future_is_complete(future_t f){
+	return f->complete;
+}
+
+/*
+* Wait until needed of the count futures are complete, or none is left
+* incomplete. Must be called with interrupts disabled.
+*/
+static void future_block(future_t *futures, int count, int needed){
+	future_waiter inline_waiters[FUTURE_WAITERS_INLINE];
+	future_waiter *waiters = inline_waiters;
+	future_wait wait;
+	int incomplete = 0;
+	int i;
+
+	for(i = 0; i < count; i++){
+		if(!futures[i]->complete) incomplete++;
+	}
+	if(incomplete == 0 || count - incomplete >= needed) return;
+
+	if(count > FUTURE_WAITERS_INLINE){
+		waiters = (future_waiter *) malloc(sizeof(future_waiter) * count);
+		AbortOnCondition(waiters == NULL, "future_block");
+	}
+
+	wait.thread = minithread_self();
+	wait.pending = needed - (count - incomplete);
+	for(i = 0; i < count; i++){
+		iqueue_link_init(&waiters[i].link);
+		waiters[i].wait = &wait;
+		if(!futures[i]->complete) iqueue_append(&futures[i]->waiters, &waiters[i].link);
+	}
+
+	minithread_block(MINITHREAD_BLOCK_FUTURE);
+
+	//Take the waiters still queued off the futures that did not complete.
+	for(i = 0; i < count; i++){
+		if(iqueue_linked(&waiters[i].link)) iqueue_delete(&futures[i]->waiters, &waiters[i].link);
+	}
+	if(waiters != inline_waiters) free(waiters);
+}
+
+void *future_get(future_t f){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	future_block(&f, 1, 1);
+
+	set_interrupt_level(old_level);
+	return f->value;
+}
+
+void future_wait_all(future_t *futures, int count){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	future_block(futures, count, count);
+
+	set_interrupt_level(old_level);
+}
+
+int future_wait_any(future_t *futures, int count){
+	interrupt_level_t old_level;
+	int i;
+
+	if(count == 0) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	future_block(futures, count, 1);
+	for(i = 0; !futures[i]->complete; i++);
+
+	set_interrupt_level(old_level);
+	return i;
+}
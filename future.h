@@ -0,0 +1,70 @@
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+/*
+ * future.h:
+ *  Futures. A future holds a value that is not there yet: whoever is to
+ *  produce it completes the future with it, once, and threads that need it
+ *  block until then. A thread can also wait for all, or the first, of a set
+ *  of futures, e.g. for the fastest of several replies.
+ *
+ *  Waiting threads are queued on the futures themselves and woken up by
+ *  the completion, without a semaphore each.
+ */
+#include "minithread.h"
+
+typedef struct future *future_t;
+
+/*
+ * future_t future_create()
+ *  Create a future that is not complete. Returns NULL on failure.
+ */
+extern future_t future_create();
+
+/*
+ * void future_destroy(future_t f)
+ *  Free a future no thread is waiting on.
+ */
+extern void future_destroy(future_t f);
+
+/*
+ * future_t future_fork(proc_t proc, arg_t arg)
+ *  Fork a thread running proc(arg), and return a future completed with
+ *  what proc returns, cast to a pointer: future_get joins the thread.
+ *  Returns NULL on failure.
+ */
+extern future_t future_fork(proc_t proc, arg_t arg);
+
+/*
+ * int future_complete(future_t f, void *value)
+ *  Complete f with value, waking up the threads waiting for it. May be
+ *  called from interrupt handlers. Returns 0 (success) or -1 if f was
+ *  complete already.
+ */
+extern int future_complete(future_t f, void *value);
+
+/*
+ * int future_is_complete(future_t f)
+ *  Whether f is complete, without waiting.
+ */
+extern int future_is_complete(future_t f);
+
+/*
+ * void *future_get(future_t f)
+ *  Wait for f to complete and return its value.
+ */
+extern void *future_get(future_t f);
+
+/*
+ * void future_wait_all(future_t *futures, int count)
+ *  Wait for all of the count futures to complete.
+ */
+extern void future_wait_all(future_t *futures, int count);
+
+/*
+ * int future_wait_any(future_t *futures, int count)
+ *  Wait for one of the count futures to complete, and return its index,
+ *  the lowest one if several are complete. Returns -1 if count is 0.
+ */
+extern int future_wait_any(future_t *futures, int count);
+
+#endif /*__FUTURE_H__*/
@@ -8,6 +8,8 @@
 #include <pthread.h>
 #include <ucontext.h>
 #include <semaphore.h>
+#include <sys/syscall.h>
+#include <cpuid.h>
 #include "defs.h"
 #include "interrupts.h"
 #include "interrupts_private.h"
@@ -24,7 +26,60 @@
 #define ENABLED 1
 #define DISABLED 0
 
-interrupt_level_t interrupt_level;
+/*
+ * The kernel saves the extended (XSAVE) FPU state right after the legacy
+ * 512 byte area and describes it in the software reserved bytes at the end
+ * of that area. sigreturn reads all of it.
+ */
+#define FP_SW_BYTES_OFFSET 464
+#define FP_XSTATE_MAGIC1 0x46505853U
+
+#define ROUND(X,Y)   (((unsigned long)X) & ~(Y-1)) /* Y must be a power of 2 */
+
+/*
+ * The XSAVE header follows the legacy area, and its first word tells which
+ * state components are not in their initial configuration. The trampoline
+ * restores with xrstor the components of fp_xfeatures, the ones enabled in
+ * XCR0 among x87, SSE, AVX and AVX-512 (opmask, ZMM_Hi256, Hi16_ZMM), at the
+ * offsets CPUID gives for the standard format the kernel saves them in.
+ * MXCSR is restored whatever the header says, and xrstor may touch the
+ * whole area even for components it initializes. Other components (MPX,
+ * PKRU, AMX) are left to the kernel.
+ */
+#define FP_MXCSR_OFFSET 24
+#define FP_MXCSR_DEFAULT 0x1f80
+#define FP_XSTATE_HEADER_OFFSET 512
+#define FP_XSTATE_HEADER_END 576
+#define FP_XSTATE_MAX 2688
+#define FP_XFEATURES_USER 0xe7
+#define FP_XFEATURE_COUNT 8
+
+/* Read by the trampoline as the requested-feature mask of xrstor. */
+uint64_t fp_xfeatures = 0;
+/* How much to copy when component i is the highest one in use. */
+static size_t fp_xfeature_end[FP_XFEATURE_COUNT];
+static size_t fp_xstate_size = FP_XSTATE_HEADER_END;
+
+/*
+ * Tells the trampoline to restore the saved FPU state with xrstor rather
+ * than fxrstor, in the low bit of its (64 byte aligned) address.
+ */
+#define FP_XRSTOR 0x1
+
+/*
+ * FPU state in its initial configuration, for the trampoline to restore
+ * when the interrupted thread had not touched it.
+ */
+static struct {
+    unsigned char legacy[FP_MXCSR_OFFSET];
+    uint32_t mxcsr;
+    unsigned char rest[FP_XSTATE_MAX - FP_MXCSR_OFFSET - sizeof(uint32_t)];
+} __attribute__((aligned(64))) fp_init_state = {{0}, FP_MXCSR_DEFAULT, {0}};
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 long ticks;
 extern int start();
 extern int end();
@@ -32,9 +87,31 @@ extern int end();
 /*
  * Virtual processor interrupt level (spl).
  * Are interrupts enabled? A new interrupt will only be taken when interrupts
- * are enabled.
+ * are enabled. Every virtual processor (host thread) has its own level.
  */
-interrupt_level_t interrupt_level;
+__thread interrupt_level_t interrupt_level = DISABLED;
+
+/*
+ * Kernel lock. Disabling interrupts on a virtual processor also takes this
+ * lock, so "interrupts disabled" keeps meaning "nobody else is touching
+ * kernel state" when several virtual processors are running.
+ */
+static tas_lock_t kernel_lock = 0;
+static __thread int kernel_lock_held = 0;
+
+/* Clock state shared by every virtual processor. */
+static int clock_period;
+static int clock_tickless = 0;
+
+/*
+ * Clock of the calling virtual processor. In tickless mode it is a one-shot
+ * timer set to clock_deadline (0 when disarmed). An interrupt can still be
+ * dropped, so it keeps firing every CLOCK_RETRY_PERIOD after the deadline
+ * until the handler runs and sets the next one.
+ */
+#define CLOCK_RETRY_PERIOD (100*MICROSECOND)
+static __thread timer_t clock_timer;
+static __thread uint64_t clock_deadline = 0;
 
 typedef struct interrupt_t interrupt_t;
 struct interrupt_t {
@@ -44,6 +121,16 @@ struct interrupt_t {
 
 static pthread_mutex_t signal_mutex;
 
+/*
+ * Halted virtual processors (see processor_halt) take no interrupts on their
+ * own stack. A clock tick is remembered and a network interrupt is copied,
+ * and both are run once the processor resumes.
+ */
+#define WAKEUP_SIGNAL (SIGRTMAX-3)
+static __thread volatile int processor_halted = 0;
+static __thread volatile int clock_pending = 0;
+static __thread interrupt_t network_pending;
+
 #define R8 0
 #define R9 1
 #define R10 2
@@ -79,9 +166,81 @@ sem_t interrupt_received_sema;
  * interrupt level
  */
 interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
+    interrupt_level_t old_level;
+
+    if (newlevel == DISABLED) {
+        old_level = swap(&interrupt_level, DISABLED);
+        if (old_level == ENABLED)
+            kernel_lock_acquire();
+        return old_level;
+    }
+
+    if (interrupt_level == DISABLED)
+        kernel_lock_release();
     return swap(&interrupt_level, newlevel);
 }
 
+void kernel_lock_acquire() {
+    while (atomic_test_and_set(&kernel_lock)) {
+        while (kernel_lock)
+            __asm__ __volatile__("pause");
+    }
+    kernel_lock_held = 1;
+}
+
+/*
+ * Drop the kernel lock if this virtual processor holds it. Called on the way
+ * out of minithread_switch and minithread_trampoline, right before they
+ * re-enable interrupts.
+ */
+void kernel_lock_release() {
+    if (kernel_lock_held) {
+        kernel_lock_held = 0;
+        atomic_clear(&kernel_lock);
+    }
+}
+
+
+/*
+ * Find the state components the trampoline restores, and how far the
+ * state extends up to each one, from XCR0 and CPUID. Leaves fp_xfeatures
+ * empty without XSAVE, and drops components that would not fit in
+ * FP_XSTATE_MAX.
+ */
+static void
+fp_xfeatures_init()
+{
+    unsigned int eax, ebx, ecx, edx;
+    uint64_t xcr0;
+    size_t end;
+    int i;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+        return;
+    __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    xcr0 = ((uint64_t) edx << 32) | eax;
+
+    for (i = 0; i < FP_XFEATURE_COUNT; i++) {
+        if (!(xcr0 & FP_XFEATURES_USER & (1UL << i)))
+            continue;
+        /* x87 and SSE live in the legacy area */
+        end = FP_XSTATE_HEADER_END;
+        if (i >= 2) {
+            __cpuid_count(0xd, i, eax, ebx, ecx, edx);
+            end = ebx + eax;
+        }
+        if (end > FP_XSTATE_MAX)
+            continue;
+        fp_xfeature_end[i] = end;
+        fp_xfeatures |= 1UL << i;
+    }
+
+    for (i = 0; i < FP_XFEATURE_COUNT; i++) {
+        if (fp_xfeature_end[i] < fp_xstate_size)
+            fp_xfeature_end[i] = fp_xstate_size;
+        fp_xstate_size = fp_xfeature_end[i];
+    }
+}
 
 /*
  * Register the minithread clock handler by making
@@ -92,31 +251,16 @@ interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
  * interrupt the minithreads, or drop the interrupt,
  * depending on safety conditions.
  *
- * The signals are handled on their own stack to reduce
- * chances of an overrun.
+ * Finally start the clock of the calling virtual processor.
  */
 void
 minithread_clock_init(int period, interrupt_handler_t clock_handler){
-    timer_t timerid;
-    struct sigevent sev;
-    struct itimerspec its;
     struct sigaction sa;
-    stack_t ss;
     mini_clock_handler = clock_handler;
+    clock_period = period;
 
     sem_init(&interrupt_received_sema,0,0);
-
-    ss.ss_sp = malloc(SIGSTKSZ);
-    if (ss.ss_sp == NULL){
-        perror("malloc.");
-        abort();
-    }
-    ss.ss_size = SIGSTKSZ;
-    ss.ss_flags = 0;
-    if (sigaltstack(&ss, NULL) == -1){
-        perror("signal stack");
-        abort();
-    }
+    fp_xfeatures_init();
 
     if(DEBUG)
         printf("SIGRTMAX = %d\n",SIGRTMAX);
@@ -131,16 +275,69 @@ minithread_clock_init(int period, interrupt_handler_t clock_handler){
     if (sigaction(SIGRTMAX-1, &sa, NULL) == -1)
         errExit("sigaction");
 
+    /* Wakeups between virtual processors only need to interrupt sigsuspend */
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = (void*)handle_wakeup;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(WAKEUP_SIGNAL, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    minithread_clock_init_cpu();
+}
+
+/*
+ * Like minithread_clock_init, but clocks only interrupt when they are
+ * programmed to, with minithread_clock_request.
+ */
+void
+minithread_clock_init_tickless(interrupt_handler_t clock_handler){
+    clock_tickless = 1;
+    minithread_clock_init(0, clock_handler);
+}
+
+/*
+ * Give the calling virtual processor its own clock: a timer whose signal is
+ * delivered to this host thread only, handled on its own stack to reduce
+ * chances of an overrun.
+ */
+void
+minithread_clock_init_cpu(){
+    timer_t timerid;
+    struct sigevent sev;
+    struct itimerspec its;
+    stack_t ss;
+
+    ss.ss_sp = malloc(SIGSTKSZ);
+    if (ss.ss_sp == NULL){
+        perror("malloc.");
+        abort();
+    }
+    ss.ss_size = SIGSTKSZ;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) == -1){
+        perror("signal stack");
+        abort();
+    }
+
     /* Create the timer */
-    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_notify = SIGEV_THREAD_ID;
     sev.sigev_signo = SIGRTMAX-1;
     sev.sigev_value.sival_ptr = &timerid;
-    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timerid) == -1)
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    /* Wall-clock time, so that a halted processor still gets its ticks */
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timerid) == -1)
         errExit("timer_create");
 
+    clock_timer = timerid;
+    clock_deadline = 0;
+
+    /* A tickless clock stays disarmed until it is given a deadline */
+    if (clock_tickless)
+        return;
+
     /* Start the timer */
-    its.it_value.tv_sec = (period) / 1000000000;
-    its.it_value.tv_nsec = (period) % 1000000000;
+    its.it_value.tv_sec = (clock_period) / 1000000000;
+    its.it_value.tv_nsec = (clock_period) % 1000000000;
     its.it_interval.tv_sec = its.it_value.tv_sec;
     its.it_interval.tv_nsec = its.it_value.tv_nsec;
 
@@ -149,6 +346,96 @@ minithread_clock_init(int period, interrupt_handler_t clock_handler){
 }
 
 
+/*
+ * Arm the clock of the calling virtual processor for deadline, or disarm it
+ * if deadline is 0.
+ */
+static void
+clock_program(uint64_t deadline)
+{
+    struct itimerspec its;
+
+    its.it_value.tv_sec = deadline / SECOND;
+    its.it_value.tv_nsec = deadline % SECOND;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = deadline == 0 ? 0 : CLOCK_RETRY_PERIOD;
+
+    if (timer_settime(clock_timer, TIMER_ABSTIME, &its, NULL) == -1)
+        errExit("timer_settime");
+    clock_deadline = deadline;
+}
+
+/*
+ * Make sure the calling virtual processor's clock interrupts by deadline.
+ * The timer is only reprogrammed when it would fire too late, or has fired
+ * already: an early interrupt costs less than a system call per switch.
+ */
+void
+minithread_clock_request(uint64_t deadline)
+{
+    uint64_t now;
+
+    if (!clock_tickless)
+        return;
+
+    now = currentTimeNanos();
+    if (clock_deadline > now && (deadline == 0 || clock_deadline <= deadline))
+        return;
+    if (deadline == 0 && clock_deadline == 0)
+        return;
+
+    clock_program(deadline);
+}
+
+int
+minithread_clock_is_tickless()
+{
+    return clock_tickless;
+}
+
+/*
+ * Save the FPU state of the interrupted thread below sp for the trampoline,
+ * and return what the trampoline gets: the address of the saved state, with
+ * FP_XRSTOR if it is to be restored with xrstor.
+ *
+ * With XSAVE, only the components the thread has taken out of their initial
+ * configuration are copied, as the header marks the others to be
+ * initialized on restore, and a thread that has not touched its FPU state
+ * at all shares fp_init_state. The header stands in for a per-thread flag
+ * telling whether the thread used the FPU: nothing traps the first FPU
+ * instruction of a thread here, while the processor tracks this for each
+ * component and the kernel hands it over. sigreturn still reads the
+ * kernel's complete copy, on the signal stack.
+ */
+static unsigned long
+fpstate_save(void *fpregs, unsigned long **sp)
+{
+    char *fp = (char *) fpregs;
+    uint32_t *sw_bytes = (uint32_t *) (fp + FP_SW_BYTES_OFFSET);
+    uint64_t xfeatures;
+    size_t size;
+
+    if (sw_bytes[0] != FP_XSTATE_MAGIC1) {
+        *sp = (unsigned long *) ((char *) *sp - sizeof(struct _fpstate));
+        *sp = (unsigned long *) ROUND(*sp, 64);
+        memcpy(*sp, fpregs, sizeof(struct _fpstate));
+        return (unsigned long) *sp;
+    }
+
+    xfeatures = *(uint64_t *) (fp + FP_XSTATE_HEADER_OFFSET) & fp_xfeatures;
+    if (xfeatures == 0 && *(uint32_t *) (fp + FP_MXCSR_OFFSET) == FP_MXCSR_DEFAULT)
+        return (unsigned long) &fp_init_state | FP_XRSTOR;
+
+    size = FP_XSTATE_HEADER_END;
+    if (xfeatures != 0)
+        size = fp_xfeature_end[63 - __builtin_clzll(xfeatures)];
+
+    *sp = (unsigned long *) ((char *) *sp - fp_xstate_size);
+    *sp = (unsigned long *) ROUND(*sp, 64);
+    memcpy(*sp, fpregs, size);
+    return (unsigned long) *sp | FP_XRSTOR;
+}
+
 /*
  * This function handles a signal and invokes the specified interrupt
  * handler, ensuring that signals are unmasked first.
@@ -171,6 +458,7 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
             eip < (uint64_t)end){
 
         unsigned long *newsp;
+        unsigned long fpsave = 0;
         /*
          * push the return address
          */
@@ -180,18 +468,15 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
         /*
          * make room for saved state and align stack.
          */
-#define ROUND(X,Y)   (((unsigned long)X) & ~(Y-1)) /* Y must be a power of 2 */
         newsp = (unsigned long *) ROUND(newsp, 16);
         if(ucontext->uc_mcontext.fpregs!=0){
-            newsp -= sizeof(struct _fpstate)/sizeof(long);
-            memcpy(newsp,ucontext->uc_mcontext.fpregs,sizeof(struct _fpstate));
-            ucontext->uc_mcontext.fpregs = (void *)newsp;
+            fpsave = fpstate_save(ucontext->uc_mcontext.fpregs, &newsp);
         }
 
         *--newsp = (unsigned long)ucontext->uc_mcontext.gregs[RSP] - sizeof(unsigned long); /*address of RIP*/
         newsp -= sizeof(struct sigcontext)/sizeof(long);
         memcpy(newsp,&ucontext->uc_mcontext,sizeof(struct sigcontext));
-        *--newsp = (unsigned long)ucontext->uc_mcontext.fpregs;
+        *--newsp = fpsave;
         *--newsp = (unsigned long)minithread_trampoline; /*return address*/
 
         /*
@@ -220,6 +505,18 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
         if(sig==SIGRTMAX-2)
             signal_handled = 1;
     }
+    else if(processor_halted){
+        /*
+         * The processor is sitting in processor_halt. Keep the interrupt
+         * for it instead of dropping it, so it is not resent forever.
+         */
+        if(sig==SIGRTMAX-2){
+            network_pending = *(interrupt_t*)si->si_value.sival_ptr;
+            signal_handled = 1;
+        }
+        else if(sig==SIGRTMAX-1)
+            clock_pending = 1;
+    }
 
     if(sig==SIGRTMAX-2){
         if(DEBUG)
@@ -228,6 +525,64 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
     }
 }
 
+/*
+ * A wakeup sent by processor_wakeup. Its only job is to end sigsuspend.
+ */
+void
+handle_wakeup(int sig, siginfo_t *si, ucontext_t *ucontext)
+{
+}
+
+/*
+ * Halt the calling virtual processor until an interrupt arrives, unless
+ * check() finds work once interrupt delivery is held off: like sti; hlt,
+ * a wakeup sent after the check is never lost. Interrupts that arrive
+ * while halted are run here, in the caller's context, after it resumes.
+ */
+void
+processor_halt(int (*check)())
+{
+    sigset_t set;
+    sigset_t old_set;
+    interrupt_t network_interrupt;
+
+    sigemptyset(&set);
+    sigaddset(&set,SIGRTMAX-1);
+    sigaddset(&set,SIGRTMAX-2);
+    sigaddset(&set,WAKEUP_SIGNAL);
+    pthread_sigmask(SIG_BLOCK,&set,&old_set);
+
+    clock_pending = 0;
+    network_pending.handler = NULL;
+
+    if (!check()) {
+        processor_halted = 1;
+        sigsuspend(&old_set);
+        processor_halted = 0;
+    }
+
+    network_interrupt = network_pending;
+    network_pending.handler = NULL;
+    pthread_sigmask(SIG_SETMASK,&old_set,NULL);
+
+    if (network_interrupt.handler != NULL) {
+        set_interrupt_level(DISABLED);
+        network_interrupt.handler(network_interrupt.arg);
+        set_interrupt_level(ENABLED);
+    }
+
+    if (clock_pending) {
+        clock_pending = 0;
+        mini_clock_handler(NULL);
+    }
+}
+
+void
+processor_wakeup(pthread_t host_thread)
+{
+    pthread_kill(host_thread, WAKEUP_SIGNAL);
+}
+
 void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg){
 
     interrupt_t interrupt;
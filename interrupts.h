@@ -22,6 +22,8 @@
 #ifndef __INTERRUPTS_H__
 #define __INTERRUPTS_H__ 1
 
+#include <pthread.h>
+#include <stdint.h>
 #include "defs.h"
 
 /* set_interrupt_level(interrupt_level_t level)
@@ -51,13 +53,17 @@
  * to minithread_switch: the minithread switch code resets the interrupt
  * level to ENABLED itself.
  *
+ * Each virtual processor has its own interrupt level. Disabling interrupts
+ * also acquires the kernel lock, so code that runs with interrupts disabled
+ * is protected against the other virtual processors as well.
+ *
  * Interrupts that occur while interrupts are disabled are dropped, so you
  * should minimize the amount of time interrupts are disabled in order to
  * reduce the number of dropped interrupts.
  */
 
 typedef int interrupt_level_t;
-extern interrupt_level_t interrupt_level;
+extern __thread interrupt_level_t interrupt_level;
 
 #define DISABLED 0
 #define ENABLED 1
@@ -80,5 +86,51 @@ extern interrupt_level_t set_interrupt_level(interrupt_level_t newlevel);
 typedef void(*interrupt_handler_t)(void*);
 extern void minithread_clock_init(int period, interrupt_handler_t h);
 
+/*
+ * minithread_clock_init_cpu()
+ *     starts the clock for the calling virtual processor, with the period
+ *     and handler given to minithread_clock_init. Every additional virtual
+ *     processor calls this once from its own host thread.
+ */
+extern void minithread_clock_init_cpu();
+
+/*
+ * minithread_clock_init_tickless(h)
+ *     installs the clock interrupt service routine h like
+ *     minithread_clock_init, but without a period: the clock of a virtual
+ *     processor only interrupts at the deadlines it is given with
+ *     minithread_clock_request, with the resolution of the host's
+ *     CLOCK_MONOTONIC.
+ *
+ * minithread_clock_request(deadline)
+ *     in tickless mode, makes sure the calling virtual processor's clock
+ *     interrupts no later than deadline (in currentTimeNanos() time). The
+ *     interrupt may come earlier, e.g. for a deadline that was requested
+ *     before. A deadline of 0 means nothing is due. Does nothing in
+ *     periodic mode. Call with interrupts disabled.
+ *
+ * minithread_clock_is_tickless()
+ *     returns 1 if the clock was started with minithread_clock_init_tickless.
+ */
+extern void minithread_clock_init_tickless(interrupt_handler_t h);
+extern void minithread_clock_request(uint64_t deadline);
+extern int minithread_clock_is_tickless();
+
+/*
+ * processor_halt(check)
+ *     halts the calling virtual processor until a clock, network or wakeup
+ *     interrupt arrives. check() is called once interrupt delivery has been
+ *     held off; if it returns nonzero the processor does not halt, so work
+ *     that shows up before the halt is never missed. Interrupts taken while
+ *     halted are run before processor_halt returns. Call with interrupts
+ *     enabled.
+ *
+ * processor_wakeup(host_thread)
+ *     ends the halt of the virtual processor running on host_thread, or the
+ *     next one if it is about to halt.
+ */
+extern void processor_halt(int (*check)());
+extern void processor_wakeup(pthread_t host_thread);
+
 #endif /* __INTERRUPTS_H__ */
 
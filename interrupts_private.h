@@ -1,46 +1,60 @@
-/*
- * Interface for interrupt related functions used 
- * by the virtual machine symulator
- *
- * YOU SHOULD NOT [NEED TO] MODIFY THIS FILE.
- */
-#ifndef __INTERRUPTS_PRIVATE_H_
-#define __INTERRUPTS_PRIVATE_H_
-
-#include "interrupts.h"
-
-
-/*
- * Set up the interrupt layer by starting the epoll loop.
- * This is called when the clock handler is installed.
- */
-extern int interrupt_layer_init();
-
-/*
- * Handle the signal on the main thread, check the safety
- * conditions and if satisfied, manipulate the stack
- * and context to cause the student's interupt handler
- * to fire.  We insert a frame underneath which contians
- * the state at the time of the interrupt, and we insert
- * a function to pop all of the state off the stack as
- * the return value to the student's interrupt handler.
- */
-extern void
-handle_interrupt();
-
-extern interrupt_handler_t
-mini_clock_handler;
-
-extern interrupt_handler_t
-mini_network_handler;
-
-extern interrupt_handler_t
-mini_read_handler;
-
-extern interrupt_handler_t
-mini_disk_handler;
-
-void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg);
-
-#endif /* __INTERRUPTS_PRIVATE_H__ */
-
+/*
+ * Interface for interrupt related functions used 
+ * by the virtual machine symulator
+ *
+ * YOU SHOULD NOT [NEED TO] MODIFY THIS FILE.
+ */
+#ifndef __INTERRUPTS_PRIVATE_H_
+#define __INTERRUPTS_PRIVATE_H_
+
+#include "interrupts.h"
+
+
+/*
+ * Set up the interrupt layer by starting the epoll loop.
+ * This is called when the clock handler is installed.
+ */
+extern int interrupt_layer_init();
+
+/*
+ * Handle the signal on the main thread, check the safety
+ * conditions and if satisfied, manipulate the stack
+ * and context to cause the student's interupt handler
+ * to fire.  We insert a frame underneath which contians
+ * the state at the time of the interrupt, and we insert
+ * a function to pop all of the state off the stack as
+ * the return value to the student's interrupt handler.
+ */
+extern void
+handle_interrupt();
+
+/*
+ * Handler for the signal processor_wakeup sends, which does nothing but
+ * end a halt.
+ */
+extern void
+handle_wakeup();
+
+extern interrupt_handler_t
+mini_clock_handler;
+
+extern interrupt_handler_t
+mini_network_handler;
+
+extern interrupt_handler_t
+mini_read_handler;
+
+extern interrupt_handler_t
+mini_disk_handler;
+
+/*
+ * The kernel lock taken and dropped by set_interrupt_level. The release is
+ * a no-op when the calling virtual processor does not hold the lock.
+ */
+extern void kernel_lock_acquire();
+extern void kernel_lock_release();
+
+void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg);
+
+#endif /* __INTERRUPTS_PRIVATE_H__ */
+
@@ -0,0 +1,174 @@
+/*
+ * Intrusive queue implementation.
+ *
+ */
+#include "intrusive_queue.h"
+#include <stdlib.h>
+
+// The queue is a circular doubly-linked list. The head link belongs to the
+// queue itself: its next is the first link and its prev the last one, so an
+// empty queue is a head pointing at itself and no operation needs a special
+// case for the ends. Links that are not on a queue have NULL pointers.
+
+/*
+ * Initialize an empty queue.
+ */
+void
+iqueue_init(iqueue_t queue) {
+	queue->head.prev = &queue->head;
+	queue->head.next = &queue->head;
+	queue->length = 0;
+}
+
+/*
+ * Initialize a link as not being on any queue.
+ */
+void
+iqueue_link_init(iqueue_link_t link) {
+	link->prev = NULL;
+	link->next = NULL;
+}
+
+/*
+ * Return 1 if the link is currently on a queue, 0 otherwise.
+ */
+int
+iqueue_linked(iqueue_link_t link) {
+	return link->next != NULL;
+}
+
+// Link item in between prev and next, which are adjacent.
+static void
+iqueue_link_between(iqueue_link_t item, iqueue_link_t prev, iqueue_link_t next) {
+	item->prev = prev;
+	item->next = next;
+	prev->next = item;
+	next->prev = item;
+}
+
+/*
+ * Prepend a link to a queue. Return 0 (success) or -1 (failure).
+ */
+int
+iqueue_prepend(iqueue_t queue, iqueue_link_t link) {
+	if (queue == NULL || link == NULL) return -1;
+
+	iqueue_link_between(link, &queue->head, queue->head.next);
+	queue->length++;
+	return 0;
+}
+
+/*
+ * Append a link to a queue. Return 0 (success) or -1 (failure).
+ */
+int
+iqueue_append(iqueue_t queue, iqueue_link_t link) {
+	if (queue == NULL || link == NULL) return -1;
+
+	iqueue_link_between(link, queue->head.prev, &queue->head);
+	queue->length++;
+	return 0;
+}
+
+/*
+ * Insert a link right before position. Return 0 (success) or -1 (failure).
+ */
+int
+iqueue_insert_before(iqueue_t queue, iqueue_link_t position, iqueue_link_t link) {
+	if (queue == NULL || position == NULL || link == NULL) return -1;
+
+	iqueue_link_between(link, position->prev, position);
+	queue->length++;
+	return 0;
+}
+
+/*
+ * Dequeue the first link of the queue. Return 0 (success) or -1 (failure).
+ */
+int
+iqueue_dequeue(iqueue_t queue, iqueue_link_t *link) {
+	if (queue == NULL || queue->length <= 0) {
+		*link = NULL;
+		return -1;
+	}
+
+	*link = queue->head.next;
+	return iqueue_delete(queue, *link);
+}
+
+/*
+ * Remove the given link from the queue. Return 0 (success) or -1 (failure).
+ */
+int
+iqueue_delete(iqueue_t queue, iqueue_link_t link) {
+	if (queue == NULL || link == NULL || !iqueue_linked(link)) return -1;
+
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	iqueue_link_init(link);
+	queue->length--;
+	return 0;
+}
+
+/*
+ * Return the first link of the queue, or NULL if it is empty.
+ */
+iqueue_link_t
+iqueue_first(iqueue_t queue) {
+	if (queue->length <= 0) return NULL;
+	return queue->head.next;
+}
+
+/*
+ * Return the link after the given one, or NULL at the end of the queue.
+ */
+iqueue_link_t
+iqueue_next(iqueue_t queue, iqueue_link_t link) {
+	if (link->next == &queue->head) return NULL;
+	return link->next;
+}
+
+/*
+ * Return the last link of the queue, or NULL if it is empty.
+ */
+iqueue_link_t
+iqueue_last(iqueue_t queue) {
+	if (queue->length <= 0) return NULL;
+	return queue->head.prev;
+}
+
+/*
+ * Return the link before the given one, or NULL at the start of the queue.
+ */
+iqueue_link_t
+iqueue_prev(iqueue_t queue, iqueue_link_t link) {
+	if (link->prev == &queue->head) return NULL;
+	return link->prev;
+}
+
+/*
+ * Move every link of source to the end of destination, leaving source empty.
+ */
+int
+iqueue_concat(iqueue_t destination, iqueue_t source) {
+	if (destination == NULL || source == NULL) return -1;
+	if (source->length == 0) return 0;
+
+	source->head.next->prev = destination->head.prev;
+	destination->head.prev->next = source->head.next;
+	source->head.prev->next = &destination->head;
+	destination->head.prev = source->head.prev;
+	destination->length += source->length;
+
+	iqueue_init(source);
+	return 0;
+}
+
+/*
+ * Return the number of links in the queue.
+ */
+int
+iqueue_length(iqueue_t queue) {
+	if (queue == NULL) return -1;
+	return queue->length;
+}
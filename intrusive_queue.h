@@ -0,0 +1,116 @@
+/*
+ * Intrusive queue manipulation functions
+ */
+#ifndef __INTRUSIVE_QUEUE_H__
+#define __INTRUSIVE_QUEUE_H__
+
+#include <stddef.h>
+
+/*
+ * Unlike queue_t, an intrusive queue does not allocate nodes: every object
+ * that can be queued carries an iqueue_link of its own, and the queue only
+ * links those together. Enqueueing and dequeueing never call malloc, so
+ * they are safe to use with interrupts disabled on the scheduling path.
+ *
+ * An object can be on as many queues at once as it has links, and a link
+ * can only be on one queue at a time.
+ */
+typedef struct iqueue_link {
+	struct iqueue_link *prev;
+	struct iqueue_link *next;
+} iqueue_link;
+typedef iqueue_link *iqueue_link_t;
+
+/*
+ * The queue is a circular doubly-linked list around the head link, so the
+ * queue is usually embedded in its owner as well.
+ */
+typedef struct iqueue {
+	iqueue_link head;
+	int length;
+} iqueue;
+typedef iqueue *iqueue_t;
+
+/*
+ * Get back the object a link is embedded in, given its type and the name of
+ * the link field.
+ */
+#define iqueue_entry(link, type, member) \
+	((type *) ((char *) (link) - offsetof(type, member)))
+
+/*
+ * Initialize an empty queue.
+ */
+extern void iqueue_init(iqueue_t queue);
+
+/*
+ * Initialize a link as not being on any queue.
+ */
+extern void iqueue_link_init(iqueue_link_t link);
+
+/*
+ * Return 1 if the link is currently on a queue, 0 otherwise.
+ */
+extern int iqueue_linked(iqueue_link_t link);
+
+/*
+ * Prepend a link to a queue. Return 0 (success) or -1 (failure).
+ */
+extern int iqueue_prepend(iqueue_t queue, iqueue_link_t link);
+
+/*
+ * Append a link to a queue. Return 0 (success) or -1 (failure).
+ */
+extern int iqueue_append(iqueue_t queue, iqueue_link_t link);
+
+/*
+ * Insert a link right before position, which must be on the queue.
+ * Return 0 (success) or -1 (failure).
+ */
+extern int iqueue_insert_before(iqueue_t queue, iqueue_link_t position, iqueue_link_t link);
+
+/*
+ * Dequeue the first link of the queue.
+ * Return 0 (success) and the first link if the queue is nonempty, or -1
+ * (failure) and NULL if the queue is empty.
+ */
+extern int iqueue_dequeue(iqueue_t queue, iqueue_link_t *link);
+
+/*
+ * Remove the given link from the queue it is on. It is not searched for.
+ * Return 0 (success) or -1 if the link was not on the queue.
+ */
+extern int iqueue_delete(iqueue_t queue, iqueue_link_t link);
+
+/*
+ * Return the first link of the queue, or NULL if it is empty.
+ */
+extern iqueue_link_t iqueue_first(iqueue_t queue);
+
+/*
+ * Return the link after the given one, or NULL at the end of the queue.
+ */
+extern iqueue_link_t iqueue_next(iqueue_t queue, iqueue_link_t link);
+
+/*
+ * Return the last link of the queue, or NULL if it is empty.
+ */
+extern iqueue_link_t iqueue_last(iqueue_t queue);
+
+/*
+ * Return the link before the given one, or NULL at the start of the queue.
+ */
+extern iqueue_link_t iqueue_prev(iqueue_t queue, iqueue_link_t link);
+
+/*
+ * Move every link of source to the end of destination, in order, leaving
+ * source empty. Return 0 (success) or -1 (failure).
+ */
+extern int iqueue_concat(iqueue_t destination, iqueue_t source);
+
+/*
+ * Return the number of links in the queue, or -1 if an error occured
+ */
+extern int iqueue_length(iqueue_t queue);
+
+#endif /*__INTRUSIVE_QUEUE_H__*/
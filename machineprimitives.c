@@ -8,6 +8,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "defs.h"
 #include "minithread.h"
 #include "machineprimitives.h"
@@ -21,51 +22,77 @@
 typedef struct initial_stack_state *initial_stack_state_t;
 struct initial_stack_state
 {
-  void *body_proc;            /* v1 or ebx */
-  void *body_arg;             /* v2 or edi */
-  void *finally_proc;         /* v3 or esi */
-  void *finally_arg;          /* v4 or ebp */
-  void *r8;
-  void *r9;
-  void *r10;
-  void *r11;
-  void *r12;
-  void *r13;
+  void *restore_proc;         /* what minithread_switch_fast pushes last */
+  void *body_proc;            /* rbx */
+  void *finally_arg;          /* rbp */
+  void *body_arg;             /* r12 */
+  void *finally_proc;         /* r13 */
   void *r14;
   void *r15;
-  void *rax;
-  void *rcx;
-  void *rdx;
-#ifdef WINCE
-  int   v5;
-  int   v6;
-  int   sl;
-  int   fp;
-#endif
   void *root_proc;            /* left on stack */
 };
 
 #define STACK_GROWS_DOWN        1
-#define STACKSIZE               (256 * 1024)
+#define STACKSIZE               MINITHREAD_STACK_SIZE
 #define STACKALIGN              0xf
 
+/*
+ * Stacks are reserved with mmap and only get physical pages when they are
+ * touched. The page right below the stack is a guard page, so an overflow
+ * faults instead of corrupting whatever is mapped there.
+ */
+static size_t
+stack_page_size()
+{
+    static size_t page_size = 0;
+    if (page_size == 0)
+        page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+static size_t
+stack_round_size(size_t size)
+{
+    size_t page = stack_page_size();
+    return (size + page - 1) & ~(page - 1);
+}
+
 /*
  * Allocate a new stack.
  */
 void
 minithread_allocate_stack(stack_pointer_t *stackbase, stack_pointer_t *stacktop)
 {
-    *stackbase = (stack_pointer_t) malloc(STACKSIZE);
-    if (!*stackbase)  {
+    minithread_allocate_stack_size(stackbase, stacktop, STACKSIZE);
+}
+
+/*
+ * Allocate a new stack of at least size bytes, plus its guard page.
+ */
+void
+minithread_allocate_stack_size(stack_pointer_t *stackbase, stack_pointer_t *stacktop,
+                               size_t size)
+{
+    size_t guard = stack_page_size();
+    char *region;
+
+    size = stack_round_size(size);
+    region = mmap(NULL, size + guard, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (region == MAP_FAILED) {
+        *stackbase = NULL;
         return;
     }
+    mprotect(region, guard, PROT_NONE);
+
+    *stackbase = (stack_pointer_t) (region + guard);
 
     if (STACK_GROWS_DOWN)
-      /* Stacks grow down, but malloc grows up. Compensate and word align
-         (turn off low 2 bits by anding with ~3). */
-      *stacktop = (stack_pointer_t) ((long)((char*)*stackbase + STACKSIZE - 1) & ~STACKALIGN);
+      /* Stacks grow down, but the mapping grows up. Compensate and align
+         (turn off low 4 bits by anding with ~0xf). */
+      *stacktop = (stack_pointer_t) ((long)((char*)*stackbase + size - 1) & ~STACKALIGN);
     else {
-      /* Word align (turn off low 2 bits by anding with ~3) */
+      /* Align (turn off low 4 bits by anding with ~0xf) */
       *stacktop = (stack_pointer_t)(((long)*stackbase + 3)&~STACKALIGN);
     }
 }
@@ -78,13 +105,70 @@ minithread_allocate_stack(stack_pointer_t *stackbase, stack_pointer_t *stacktop)
 void
 minithread_free_stack(stack_pointer_t stackbase)
 {
-    free(stackbase);
+    minithread_free_stack_size(stackbase, STACKSIZE);
+}
+
+void
+minithread_free_stack_size(stack_pointer_t stackbase, size_t size)
+{
+    size_t guard = stack_page_size();
+
+    if (stackbase == NULL)
+        return;
+    munmap((char *) stackbase - guard, stack_round_size(size) + guard);
+}
+
+/*
+ * Bytes of the stack that have been touched, measured from the top. Since
+ * pages are only committed on first touch, the lowest resident page is the
+ * deepest the stack has ever grown (page granularity).
+ */
+size_t
+minithread_measure_stack(stack_pointer_t stackbase, stack_pointer_t stacktop)
+{
+    size_t page = stack_page_size();
+    char *top = (char *) stacktop;
+    size_t pages = stack_round_size(top + 1 - (char *) stackbase) / page;
+    unsigned char *resident;
+    size_t i;
+    size_t usage = 0;
+
+    resident = (unsigned char *) malloc(pages);
+    if (resident == NULL)
+        return 0;
+
+    if (mincore(stackbase, pages * page, resident) == 0) {
+        for (i = 0; i < pages; i++) {
+            if (resident[i] & 1) {
+                usage = top + 1 - ((char *) stackbase + i * page);
+                break;
+            }
+        }
+    }
+
+    free(resident);
+    return usage;
+}
+
+/*
+ * Give the physical pages of a stack back, except for the keep bytes at
+ * the top. The stack stays mapped, and pages are committed again on touch.
+ */
+void
+minithread_stack_discard(stack_pointer_t stackbase, stack_pointer_t stacktop, size_t keep)
+{
+    size_t page = stack_page_size();
+    char *end = (char *) (((unsigned long) stacktop + 1 - keep) & ~(page - 1));
+
+    if (end > (char *) stackbase)
+        madvise(stackbase, end - (char *) stackbase, MADV_DONTNEED);
 }
 
 /*
  * See the architecture assembly file.
  */
 extern int minithread_root();
+extern void minithread_restore_fast();
 
 /*
  * Initialize a stack.
@@ -117,5 +201,6 @@ minithread_initialize_stack(
     ss->finally_proc = (void *) finally_proc;
     ss->finally_arg = (void *) finally_arg;
 
+    ss->restore_proc = (void *) minithread_restore_fast;
     ss->root_proc = (void *) minithread_root;
 }
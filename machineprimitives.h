@@ -11,9 +11,13 @@
 #ifndef __MINITHREAD_PUBLIC_H_
 #define __MINITHREAD_PUBLIC_H_
 
+#include <stddef.h>
 #include "inttypes.h"
 #include "defs.h"
 
+/* Default stack size. Pages are only committed when the stack touches them. */
+#define MINITHREAD_STACK_SIZE (256 * 1024)
+
 typedef void *stack_pointer_t;
 
 typedef int tas_lock_t;       /* test-and-set locks.  */
@@ -38,6 +42,16 @@ typedef int (*proc_t)(arg_t); /* generic function pointer */
 extern void minithread_allocate_stack(stack_pointer_t *stackbase,
                                       stack_pointer_t *stacktop);
 
+/*
+ * Like minithread_allocate_stack, for a stack of at least size bytes.
+ * Stacks are reserved, not committed: physical pages are only used once the
+ * stack grows into them. A guard page below stackbase catches overflows.
+ * *stackbase is NULL if the stack could not be reserved.
+ */
+extern void minithread_allocate_stack_size(stack_pointer_t *stackbase,
+                                           stack_pointer_t *stacktop,
+                                           size_t size);
+
 /*
  * minithread_free_stack(stack_pointer_t stackbase)
  *
@@ -46,6 +60,28 @@ extern void minithread_allocate_stack(stack_pointer_t *stackbase,
  */
 extern void minithread_free_stack(stack_pointer_t stackbase);
 
+/*
+ * minithread_free_stack_size(stack_pointer_t stackbase, size_t size)
+ *
+ * Frees a stack allocated with minithread_allocate_stack_size(size).
+ */
+extern void minithread_free_stack_size(stack_pointer_t stackbase, size_t size);
+
+/*
+ * Returns how many bytes below stacktop the stack has ever been touched,
+ * with page granularity.
+ */
+extern size_t minithread_measure_stack(stack_pointer_t stackbase,
+                                      stack_pointer_t stacktop);
+
+/*
+ * Returns the physical pages of a stack that is not running to the system,
+ * except for the top keep bytes. The stack remains usable.
+ */
+extern void minithread_stack_discard(stack_pointer_t stackbase,
+                                     stack_pointer_t stacktop,
+                                     size_t keep);
+
 /*
  *  Initialize the stackframe pointed to by *stacktop so that
  *  the thread running off of *stacktop will invoke:
@@ -88,6 +124,16 @@ extern void minithread_trampoline(proc_t interrupt, void * arg);
 extern void minithread_switch(stack_pointer_t *old_thread_sp,
                               stack_pointer_t *new_thread_sp);
 
+/*
+ * Context switch primitive for switches the caller asks for, e.g. when it
+ * yields or blocks. Like minithread_switch, but only saves the registers a
+ * function call has to preserve, leaving the others for the caller to
+ * spill as it would around any call. A thread switched out by either one
+ * can be resumed by either one.
+ */
+extern void minithread_switch_fast(stack_pointer_t *old_thread_sp,
+                                   stack_pointer_t *new_thread_sp);
+
 /* SYNCHRONIZATION PRIMITIVES */
 
 /*
@@ -121,6 +167,11 @@ extern int compare_and_swap(int* x, int oldval, int newval);
  */
 uint64_t currentTimeMillis();
 
+/*
+ * Returns a monotonic time in nanoseconds, for measuring intervals.
+ */
+uint64_t currentTimeNanos();
+
 
 #endif /*__MINITHREAD_PUBLIC_H_*/
 
@@ -44,13 +44,15 @@ int current_bound_port_number;
 // If a port number is in bound_ports_table, then
 // it is currently being used.
 // NOTE: access to these tables must be protected from
-// interrupts!
+// interrupts! The network handler reads them on every packet,
+// with interrupts disabled, which also keeps out the threads
+// changing them.
 hashtable_t bound_ports_table;
 hashtable_t unbound_ports_table;
 
 // A helper function to get the next available bound port number.
 // Returns -1 if no bound ports are available. XXX: possibly change
-// TODO: disable interrupts here, right?
+// Must be called with interrupts disabled.
 int get_next_bound_pn() {
     // We count the number of loops to ensure that we don't check for the 
     // same port number twice.
@@ -201,8 +203,6 @@ miniport_create_bound(network_address_t addr, int remote_unbound_port_number)
         return NULL;
     }
   
-    old_level = set_interrupt_level(DISABLED);
-
     // The first thing we do is set up the port's destination data.
     new_destination_data = (destination_data *)malloc(sizeof(destination_data));
     network_address_copy(addr, new_destination_data->destination_address);
@@ -215,9 +215,9 @@ miniport_create_bound(network_address_t addr, int remote_unbound_port_number)
 
     // Before we return, we get a bound port number and put the port in the bound port table.
     // This also makes the port number unavailable to other miniports.
+    old_level = set_interrupt_level(DISABLED);
     bound_port_number = get_next_bound_pn();
     bound_ports_table = hashtable_put(bound_ports_table, bound_port_number, new_miniport);
-
     set_interrupt_level(old_level);
 
     return new_miniport;
@@ -395,3 +395,20 @@ int minimsg_receive(miniport_t local_unbound_port, miniport_t* new_local_bound_p
     return payload_size;
 }
 
+/* Watches an unbound port through its mailbox semaphore, which counts the
+ * waiting messages.
+ */
+int miniport_watch(waitset_t ws, miniport_t local_unbound_port, int mode, void *data)
+{
+    if (local_unbound_port == NULL || local_unbound_port->port_type != UNBOUND) return -1;
+
+    return waitset_add(ws, local_unbound_port->port_data.mailbox->available_messages_sema, mode, data);
+}
+
+/* Stops watching an unbound port. */
+int miniport_unwatch(waitset_t ws, miniport_t local_unbound_port)
+{
+    if (local_unbound_port == NULL || local_unbound_port->port_type != UNBOUND) return -1;
+
+    return waitset_remove(ws, local_unbound_port->port_data.mailbox->available_messages_sema);
+}
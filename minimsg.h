@@ -8,6 +8,7 @@
  *      the exact arguments in the prototypes.
  */
 #include "network.h"
+#include "synch.h"
 
 /* The maximum size of a minimsg.
  * Must be <= MAX_NETWORK_PKT_SIZE - NETWORK_HDR_SIZE
@@ -71,4 +72,15 @@ extern void minimsg_dropoff_message(network_interrupt_arg_t *raw_msg);
  */
 extern int minimsg_receive(miniport_t local_unbound_port, miniport_t* new_local_bound_port, minimsg_t msg, int *len);
 
+/* Watches an unbound port in the wait set ws (see waitset_add): the port is ready
+ * while a message is waiting for minimsg_receive, which then returns at once. Returns
+ * 0 on success, or -1 if the port is bound or the wait set cannot watch it.
+ */
+extern int miniport_watch(waitset_t ws, miniport_t local_unbound_port, int mode, void *data);
+
+/* Stops watching an unbound port, as destroying it does too. Returns 0 on success,
+ * or -1 if the wait set does not watch the port.
+ */
+extern int miniport_unwatch(waitset_t ws, miniport_t local_unbound_port);
+
 #endif /*__MINIMSG_H__*/
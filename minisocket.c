@@ -62,6 +62,8 @@ typedef struct minisocket
 
 static int current_client_port_index;
 
+// Threads claim and release ports with interrupts disabled, which also
+// keeps out the network handler, reading the array on every packet.
 minisocket_t current_sockets[MAX_CLIENT_PORT_NUMBER + 1];
 
 
@@ -132,6 +134,7 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 	network_address_t 	server_address;
 	queue_t 			new_received_messages_q;
 	mailbox_t			new_mailbox;
+	interrupt_level_t 	old_level;
 
 	// Check for null input.
 	if (error == NULL) {
@@ -143,7 +146,9 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 		*error = SOCKET_INVALIDPARAMS;
 		return NULL;
 	}
+	old_level = set_interrupt_level(DISABLED);
 	if (current_sockets[port] != NULL) {
+		set_interrupt_level(old_level);
 		*error = SOCKET_PORTINUSE;
 		return NULL;
 	} 
@@ -181,6 +186,7 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 
 	// Add the socket to the array of sockets.
 	current_sockets[port] = new_server_socket;
+	set_interrupt_level(old_level);
 
 	// Now wait for a client to connect. This function does not return until
 	// handshaking is complete and a connection is established. The server's
@@ -220,15 +226,19 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
 	int 				valid_port;
 
 	mini_header_reliable_t	syn_header;
+	interrupt_level_t 	old_level;
 
 
+	old_level = set_interrupt_level(DISABLED);
 	valid_port = minisocket_utils_client_get_valid_port();
 	if(!valid_port){
+		set_interrupt_level(old_level);
 		*error = SOCKET_NOMOREPORTS;
 		return NULL;
 	}
 
 	if(port < 0 || port > MAX_SERVER_PORT_NUMBER){
+		set_interrupt_level(old_level);
 		*error = SOCKET_INVALIDPARAMS;
 		return NULL;
 	}
@@ -269,6 +279,7 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
     client_socket->mark_for_death_alarm = NULL;
 
     current_sockets[valid_port] = client_socket;
+    set_interrupt_level(old_level);
 
 
     //Send SYN packet to begin connection to server.
@@ -499,7 +510,27 @@ void minisocket_close(minisocket_t socket)
 	// queue_free(socket->mailbox->received_messages);
 
 	//Remove from sockets array.
+	old_level = set_interrupt_level(DISABLED);
 	current_sockets[socket->listening_channel.port_number] = NULL;
+	set_interrupt_level(old_level);
 
 	// free(socket);
 }
+
+/* Watch a socket through its mailbox semaphore, which counts the waiting
+ * messages and gets an extra V when the connection is closing.
+ */
+int minisocket_watch(waitset_t ws, minisocket_t socket, int mode, void *data)
+{
+	if (socket == NULL) return -1;
+
+	return waitset_add(ws, socket->mailbox->available_messages_sema, mode, data);
+}
+
+/* Stop watching a socket. */
+int minisocket_unwatch(waitset_t ws, minisocket_t socket)
+{
+	if (socket == NULL) return -1;
+
+	return waitset_remove(ws, socket->mailbox->available_messages_sema);
+}
@@ -105,6 +105,22 @@ int minisocket_receive(minisocket_t socket, minimsg_t msg, int max_len, minisock
  */
 void minisocket_close(minisocket_t socket); 
 
+/*
+ * Watch a socket in the wait set ws (see waitset_add). The socket is ready
+ * while a message is waiting, or once the connection is closing: either way
+ * minisocket_receive returns at once.
+ *
+ * Return value: 0 on success, -1 if the wait set cannot watch the socket.
+ */
+int minisocket_watch(waitset_t ws, minisocket_t socket, int mode, void *data);
+
+/*
+ * Stop watching a socket, which must be done before it is closed.
+ *
+ * Return value: 0 on success, -1 if the wait set does not watch the socket.
+ */
+int minisocket_unwatch(waitset_t ws, minisocket_t socket);
+
 
 /*
 * Network interrupt handler. Delivers the message and handles most of the special message types.
@@ -1,50 +1,47 @@
 #include "minisocket.h"
 
 
-/* A wrapper function to pass into an alarm. */
-void semaphore_V_ack_wrapper(void *socket_ptr) {
-	minisocket_t socket = (minisocket_t) socket_ptr;
-    
-    socket->ack_timedout = 1;
-
-    //If it actually fires before the ACK is received, we should allow socket to continue.
-    if(!socket->ack_received){
-    	semaphore_V(socket->ack_sema);
-    }
+/* Gets ready for the ACK of a packet about to be sent. The network handler
+ * V's the ACK semaphore for the first ACK only (ack_received), and not at
+ * all once the wait is over (ack_timedout), so that a late or duplicate ACK
+ * cannot let the next wait through.
+ */
+void expect_ack(minisocket_t waiting_socket)
+{
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	waiting_socket->ack_received = 0;
+	waiting_socket->ack_timedout = 0;
+
+	set_interrupt_level(old_level);
 }
 
-/* Waits for the given ACK to come in by calling P on the ACK semaphore. 
- * Returns 1 if the ACK was received and 0 if a timeout occurred.
+/* Waits for the ACK expected with expect_ack to come in by calling P on the
+ * ACK semaphore, for timeout_to_wait milliseconds at most. Returns 1 if the
+ * ACK was received and 0 if a timeout occurred.
  */
 int wait_for_ack(minisocket_t waiting_socket, int timeout_to_wait)
 {
 	interrupt_level_t old_level;
-	alarm_id timeout_alarm;
+	int timed_out;
 
+	old_level = set_interrupt_level(DISABLED);
 
-	// Schedule the timeout alarm. This will wake us up from the P after
-	// timeout_to_wait milliseconds if we have not woken up already.
-	waiting_socket->ack_timedout = 0;
-	timeout_alarm = register_alarm(
-			timeout_to_wait, semaphore_V_ack_wrapper, waiting_socket);
+	timed_out = semaphore_P_timeout(waiting_socket->ack_sema, timeout_to_wait);
 
+	// The ACK may have come in between the timeout and now: take its V.
+	if (timed_out && waiting_socket->ack_received) {
+		semaphore_P(waiting_socket->ack_sema);
+		timed_out = 0;
+	}
 
-	// Check for ACKs by calling P on the ACK semaphore.
+	// The wait is over. ack_received goes back to 0, as the handshake
+	// tells retransmitted SYNACKs by it.
 	waiting_socket->ack_received = 0;
-	semaphore_P(waiting_socket->ack_sema);
-
-	// If an ACK was received, then deregister the alarm and return success.
-	if (waiting_socket->ack_received) {
-		old_level = set_interrupt_level(DISABLED);
-		waiting_socket->ack_received = 0;
-		waiting_socket->ack_timedout = 0;
-		deregister_alarm(timeout_alarm);
-		set_interrupt_level(old_level);
-		return 1;
-	}
+	waiting_socket->ack_timedout = 1;
 
-	waiting_socket->ack_timedout = 0;
-	return 0;
+	set_interrupt_level(old_level);
+	return !timed_out;
 }
 
 mini_header_reliable_t 
@@ -125,6 +122,7 @@ int minisocket_utils_send_packet_and_wait(minisocket_t sending_socket, int hdr_l
 
 	while (num_timeouts < MAX_NUM_TIMEOUTS) {
 		// Send the packet.
+		expect_ack(sending_socket);
 		bytes_sent  = network_send_pkt(sending_socket->destination_channel.address, hdr_len, hdr, data_len, data);
 		
 		// Wait for an ACK. This function will return 0 if the alarm
@@ -217,6 +215,7 @@ void minisocket_utils_server_wait_for_client(minisocket_t server, minisocket_err
 			server->destination_channel.port_number = -1;
 			server->seq_number = 0;
 			server->ack_number = 0;
+			expect_ack(server);
 			server->state = OPEN_SERVER;
 			continue;
 		} else {
@@ -230,7 +229,8 @@ void minisocket_utils_server_wait_for_client(minisocket_t server, minisocket_err
 
 
 /*
-* Grab an open port for a new client, otherwise returns 0.
+* Grab an open port for a new client, otherwise returns 0. Must be called
+* with interrupts disabled.
 */
 int minisocket_utils_client_get_valid_port(){
 	int valid_port = current_client_port_index;
@@ -0,0 +1,411 @@
+/*
+ * Fork-join tasks on work-stealing deques.
+ *
+ */
+#include <stdlib.h>
+
+#include "interrupts.h"
+#include "minithread_private.h"
+#include "minitask.h"
+#include "synch.h"
+
+/*
+	Every worker has a Chase-Lev deque: the owner pushes and pops tasks at
+	the bottom without locking, and thieves take them from the top with a
+	compare and swap, which only contends with the owner over the last task.
+	Workers run on several virtual processors at once, so the deque relies
+	on atomic operations and fences rather than on disabling interrupts.
+
+	A worker that finds nothing to run for MINITASK_IDLE_SPINS rounds counts
+	itself in sleepers, looks once more and blocks on wake. A spawn fences
+	after pushing its task, then wakes one of the sleepers up if it sees
+	any. The sleeper counts itself with a locked add, a full fence too,
+	before it looks, so either the spawner sees the sleeper counted, or the
+	sleeper sees the task.
+
+	Task descriptors are recycled on a free list per worker, by the worker
+	that ran them, so spawning seldom allocates.
+*/
+
+typedef struct task {
+	proc_t 				proc;
+	arg_t 				arg;
+	minitask_scope_t 	*scope;
+	struct task 		*next;
+} task;
+
+typedef struct deque {
+	volatile long 	top;
+	volatile long 	bottom;
+	task 			*volatile buffer[MINITASK_DEQUE_SIZE];
+} deque;
+
+typedef struct minitask_worker {
+	deque 			tasks;
+	task 			*free_tasks;
+	unsigned int 	seed;
+} minitask_worker;
+
+static minitask_worker *workers = NULL;
+static int worker_count = 0;
+static volatile int shutting_down = 0;
+static volatile int sleepers = 0;
+static semaphore_t wake;
+static semaphore_t exited;
+
+//Tasks started by minitask_run from other threads, oldest first, protected by disabling interrupts.
+static task *volatile injected_head = NULL;
+static task *injected_tail = NULL;
+
+#define DEQUE_MASK (MINITASK_DEQUE_SIZE - 1)
+
+//Push t at the bottom. Owner only. Returns 0 (success) or -1 if the deque is full.
+static int deque_push(deque *d, task *t){
+	long b = d->bottom;
+	long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+	if(b - top >= MINITASK_DEQUE_SIZE) return -1;
+
+	d->buffer[b & DEQUE_MASK] = t;
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+//Pop the task at the bottom, the newest. Owner only. Returns NULL if there is none.
+static task *deque_pop(deque *d){
+	long b = d->bottom - 1;
+	long top;
+	task *t;
+
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+	if(top > b){
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	t = d->buffer[b & DEQUE_MASK];
+	if(top == b){
+		//The last task: race the thieves for it.
+		if(!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+			t = NULL;
+		}
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return t;
+}
+
+//Take the task at the top, the oldest. Returns NULL if there is none or another thief won it.
+static task *deque_steal(deque *d){
+	long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	long b;
+	task *t;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if(top >= b) return NULL;
+
+	t = d->buffer[top & DEQUE_MASK];
+	if(!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+		return NULL;
+	}
+	return t;
+}
+
+//The worker the calling thread is, or NULL.
+static minitask_worker *current_worker(){
+	return minithread_self()->task_worker;
+}
+
+static task *task_alloc(minitask_worker *w){
+	task *t = w != NULL ? w->free_tasks : NULL;
+
+	if(t == NULL) return (task *) malloc(sizeof(task));
+	w->free_tasks = t->next;
+	return t;
+}
+
+//Run t and count it out of its scope, recycling it on w.
+static void task_run(minitask_worker *w, task *t){
+	t->proc(t->arg);
+	if(t->scope != NULL) __sync_fetch_and_sub(&t->scope->pending, 1);
+
+	t->next = w->free_tasks;
+	w->free_tasks = t;
+}
+
+//Wake up a sleeping worker, if any.
+static void wake_one(){
+	int s;
+
+	__sync_synchronize();
+	while((s = sleepers) > 0){
+		if(__sync_val_compare_and_swap(&sleepers, s, s - 1) == s){
+			semaphore_V(wake);
+			return;
+		}
+	}
+}
+
+//Find a task for w: its own newest, then one started from outside, then another worker's oldest.
+static task *find_work(minitask_worker *w){
+	interrupt_level_t old_level;
+	task *t;
+	int start, i;
+
+	t = deque_pop(&w->tasks);
+	if(t != NULL) return t;
+
+	if(injected_head != NULL){
+		old_level = set_interrupt_level(DISABLED);
+		t = injected_head;
+		if(t != NULL){
+			injected_head = t->next;
+			if(injected_head == NULL) injected_tail = NULL;
+		}
+		set_interrupt_level(old_level);
+		if(t != NULL) return t;
+	}
+
+	//Start from a random victim, so that thieves spread out.
+	w->seed = w->seed * 1103515245 + 12345;
+	start = (w->seed >> 16) % worker_count;
+	for(i = 0; i < worker_count; i++){
+		minitask_worker *victim = &workers[(start + i) % worker_count];
+
+		if(victim == w) continue;
+		t = deque_steal(&victim->tasks);
+		if(t != NULL) return t;
+	}
+	return NULL;
+}
+
+static int worker_loop(arg_t arg){
+	minitask_worker *w = (minitask_worker *) arg;
+	int idle = 0;
+	task *t;
+	int s;
+
+	minithread_self()->task_worker = w;
+
+	while(1){
+		t = find_work(w);
+		if(t != NULL){
+			task_run(w, t);
+			idle = 0;
+			continue;
+		}
+		if(shutting_down) break;
+
+		if(++idle < MINITASK_IDLE_SPINS){
+			minithread_yield();
+			continue;
+		}
+
+		__sync_fetch_and_add(&sleepers, 1);
+		t = find_work(w);
+		if(t != NULL){
+			//Uncount ourselves, unless a spawner already did and will V wake.
+			while((s = sleepers) > 0 && __sync_val_compare_and_swap(&sleepers, s, s - 1) != s);
+			task_run(w, t);
+		} else if(!shutting_down){
+			semaphore_P(wake);
+		}
+		idle = 0;
+	}
+
+	minithread_self()->task_worker = NULL;
+	semaphore_V(exited);
+	return 0;
+}
+
+int minitask_initialize(int count){
+	int i;
+
+	if(workers != NULL) return -1;
+	if(count <= 0) count = minithread_get_cpu_count();
+
+	workers = (minitask_worker *) malloc(sizeof(minitask_worker) * count);
+	if(workers == NULL) return -1;
+
+	wake = semaphore_create();
+	semaphore_initialize(wake, 0);
+	exited = semaphore_create();
+	semaphore_initialize(exited, 0);
+	shutting_down = 0;
+	sleepers = 0;
+	worker_count = count;
+
+	for(i = 0; i < count; i++){
+		workers[i].tasks.top = 0;
+		workers[i].tasks.bottom = 0;
+		workers[i].free_tasks = NULL;
+		workers[i].seed = i + 1;
+	}
+	for(i = 0; i < count; i++){
+		minithread_fork(worker_loop, (arg_t) &workers[i]);
+	}
+	return 0;
+}
+
+void minitask_shutdown(){
+	task *t;
+	int i;
+
+	if(workers == NULL) return;
+
+	shutting_down = 1;
+	for(i = 0; i < worker_count; i++){
+		semaphore_V(wake);
+	}
+	for(i = 0; i < worker_count; i++){
+		semaphore_P(exited);
+	}
+
+	for(i = 0; i < worker_count; i++){
+		while((t = workers[i].free_tasks) != NULL){
+			workers[i].free_tasks = t->next;
+			free(t);
+		}
+	}
+	semaphore_destroy(wake);
+	semaphore_destroy(exited);
+	free(workers);
+	workers = NULL;
+}
+
+typedef struct root_task {
+	proc_t 		proc;
+	arg_t 		arg;
+	semaphore_t done;
+} root_task;
+
+static int root_run(arg_t arg){
+	root_task *root = (root_task *) arg;
+
+	root->proc(root->arg);
+	semaphore_V(root->done);
+	return 0;
+}
+
+void minitask_run(proc_t proc, arg_t arg){
+	interrupt_level_t old_level;
+	root_task root;
+	task *t;
+
+	if(current_worker() != NULL || workers == NULL){
+		proc(arg);
+		return;
+	}
+
+	root.proc = proc;
+	root.arg = arg;
+	root.done = semaphore_create();
+	semaphore_initialize(root.done, 0);
+
+	t = task_alloc(NULL);
+	t->proc = root_run;
+	t->arg = (arg_t) &root;
+	t->scope = NULL;
+
+	t->next = NULL;
+	old_level = set_interrupt_level(DISABLED);
+	if(injected_tail != NULL) injected_tail->next = t;
+	else injected_head = t;
+	injected_tail = t;
+	set_interrupt_level(old_level);
+
+	wake_one();
+	semaphore_P(root.done);
+	semaphore_destroy(root.done);
+}
+
+void minitask_spawn(minitask_scope_t *scope, proc_t proc, arg_t arg){
+	minitask_worker *w = current_worker();
+	task *t;
+
+	if(w == NULL){
+		proc(arg);
+		return;
+	}
+
+	t = task_alloc(w);
+	if(t == NULL){
+		proc(arg);
+		return;
+	}
+	t->proc = proc;
+	t->arg = arg;
+	t->scope = scope;
+	__sync_fetch_and_add(&scope->pending, 1);
+
+	if(deque_push(&w->tasks, t) == -1){
+		task_run(w, t);
+		return;
+	}
+	//wake_one fences before it reads sleepers, which the push must not pass.
+	wake_one();
+}
+
+void minitask_sync(minitask_scope_t *scope){
+	minitask_worker *w = current_worker();
+	task *t;
+
+	while(scope->pending > 0){
+		t = w != NULL ? find_work(w) : NULL;
+		if(t != NULL){
+			task_run(w, t);
+		} else {
+			//What is left runs on other workers.
+			minithread_yield();
+		}
+	}
+	//Make what the tasks wrote visible to the caller.
+	__sync_synchronize();
+}
+
+typedef struct range {
+	int 	lo;
+	int 	hi;
+	int 	grain;
+	void 	(*body)(int, void *);
+	void 	*arg;
+} range;
+
+//Split the range in halves, spawning the upper one, down to grain iterations.
+static int range_run(arg_t arg){
+	range *r = (range *) arg;
+	minitask_scope_t scope = MINITASK_SCOPE_INIT;
+	range lower, upper;
+	int i;
+
+	if(r->hi - r->lo <= r->grain){
+		for(i = r->lo; i < r->hi; i++){
+			r->body(i, r->arg);
+		}
+		return 0;
+	}
+
+	lower = *r;
+	upper = *r;
+	lower.hi = upper.lo = r->lo + (r->hi - r->lo) / 2;
+	minitask_spawn(&scope, range_run, (arg_t) &upper);
+	range_run((arg_t) &lower);
+	minitask_sync(&scope);
+	return 0;
+}
+
+void minitask_parallel_for(int lo, int hi, int grain, void (*body)(int, void *), void *arg){
+	range r;
+
+	r.lo = lo;
+	r.hi = hi;
+	r.grain = grain > 0 ? grain : 1;
+	r.body = body;
+	r.arg = arg;
+	minitask_run(range_run, (arg_t) &r);
+}
@@ -0,0 +1,83 @@
+#ifndef __MINITASK_H__
+#define __MINITASK_H__
+/*
+ * minitask.h:
+ *  Fork-join task parallelism. A task is a procedure and its argument,
+ *  much cheaper to start than a thread: it runs to completion on one of a
+ *  fixed set of worker threads, on the stack of that worker.
+ *
+ *  Every worker keeps the tasks it spawns on a deque of its own, and runs
+ *  the most recent one first, while workers that run out of tasks steal the
+ *  oldest ones from the others: a tree of tasks is split near its root
+ *  between workers and run depth first on each of them.
+ *
+ *  Tasks are spawned into a scope, which they belong to until they return.
+ *  minitask_sync waits for the tasks of a scope, running tasks meanwhile
+ *  rather than blocking, so a task may spawn and sync tasks of its own. A
+ *  task must sync the scopes it spawned into before it returns.
+ *
+ *  Call minitask_initialize after minithread_system_initialize, and only
+ *  call minitask_spawn and minitask_sync from tasks; other threads start
+ *  tasks with minitask_run.
+ */
+#include "minithread.h"
+
+/* The most tasks a worker holds at once. Spawning more runs the task right away. */
+#define MINITASK_DEQUE_SIZE 1024
+
+/* How many times an idle worker looks for tasks to steal before it blocks. */
+#define MINITASK_IDLE_SPINS 64
+
+/*
+ * A scope, to be set to MINITASK_SCOPE_INIT before use. Usually on the
+ * stack of the task that spawns into it and syncs it before returning.
+ */
+typedef struct minitask_scope {
+	volatile int pending;
+} minitask_scope_t;
+
+#define MINITASK_SCOPE_INIT {0}
+
+/*
+ * int minitask_initialize(int workers)
+ *  Start the task runtime with the given number of workers, or one per
+ *  virtual processor if 0. Returns 0 (success) or -1.
+ */
+extern int minitask_initialize(int workers);
+
+/*
+ * void minitask_shutdown()
+ *  Stop the workers, once the tasks they hold have run.
+ */
+extern void minitask_shutdown();
+
+/*
+ * void minitask_run(proc_t proc, arg_t arg)
+ *  Run proc(arg) as a task, and the tasks it spawns, and wait for it to
+ *  return. From a task, this is just a call. Trees started from other
+ *  threads are picked up by the workers in the order they were started.
+ */
+extern void minitask_run(proc_t proc, arg_t arg);
+
+/*
+ * void minitask_spawn(minitask_scope_t *scope, proc_t proc, arg_t arg)
+ *  Make proc(arg) a task of scope, to be run by this worker or stolen by
+ *  another one. The return value of proc is ignored.
+ */
+extern void minitask_spawn(minitask_scope_t *scope, proc_t proc, arg_t arg);
+
+/*
+ * void minitask_sync(minitask_scope_t *scope)
+ *  Return once all the tasks of scope have returned.
+ */
+extern void minitask_sync(minitask_scope_t *scope);
+
+/*
+ * void minitask_parallel_for(int lo, int hi, int grain, void (*body)(int, void *), void *arg)
+ *  Call body(i, arg) for every i from lo to hi - 1, in parallel, splitting
+ *  the range in halves down to grain iterations per task. Returns once all
+ *  the calls have.
+ */
+extern void minitask_parallel_for(int lo, int hi, int grain, void (*body)(int, void *), void *arg);
+
+#endif /*__MINITASK_H__*/
@@ -9,180 +9,764 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "interrupts.h"
 #include "minithread.h"
-#include "queue.h"
+#include "minithread_private.h"
+#include "intrusive_queue.h"
 #include "multilevel_queue.h"
+#include "scheduler_policy.h"
 #include "synch.h"
 #include "alarm.h"
 #include "network.h"
 #include "minimsg.h"
 #include "minisocket.h"
+#include "minithread_trace.h"
 
 #include <assert.h>
 
-static long current_tick = 0;
+/*
+	Clock. The default periodic clock interrupts every virtual processor each
+	MINITHREAD_CLOCK_PERIOD, and a quantum is one period. A tickless clock only
+	interrupts when the current quantum ends or the next alarm is due, so
+	quanta and alarms can be much shorter than a period.
+
+	Every busy processor goes off for the next alarm, but of the idle ones
+	only alarm_cpu does: the last one to register a new earliest alarm.
+*/
+static int clock_tickless = 0;
+static uint64_t quantum_length = MINITHREAD_CLOCK_PERIOD;
+static int alarm_cpu = 0;
 
 
 /*
-* A minithread should be defined either in this file or in a private
-* header file.  Minithreads have a stack pointer with to make procedure
-* calls, a stackbase which points to the bottom of the procedure
-* call stack, the ability to be enqueueed and dequeued, and any other state
-* that you feel they must have.
+* A minithread is defined in minithread_private.h.  Minithreads have a stack
+* pointer with to make procedure calls, a stackbase which points to the bottom
+* of the procedure call stack, the ability to be enqueueed and dequeued, and any
+* other state that you feel they must have.
 */
 
-typedef enum {READY, WAITING, RUNNING, FINISHED} state_t;
+//Queue of finished threads waiting for the vaccum_cleaner.
+iqueue finished_queue;
+
+//Semaphore for cleaning up only when needed. It is V'd once per batch of zombies.
+semaphore_t cleanup_sema = NULL;
 
+/*
+	Thread cache. Finished threads keep their stack and go on the free list of
+	their stack size class, so that minithread_create can reuse both without
+	calling malloc. Once a class grows past the high watermark, the
+	vaccum_cleaner trims it back down to the low watermark.
 
-typedef struct minithread {
-	int pid;
-	stack_pointer_t sp;
-	stack_pointer_t stackbase;
-	stack_pointer_t stacktop;
-	state_t state;
-	int idling;
-} minithread;
+	Size classes are powers of two from 16KB up. Larger stacks are not cached.
+	Cached stacks only keep the pages at their top resident.
+*/
 
-//Current running thread.
-minithread_t current_thread = NULL;
+#define THREAD_CACHE_HIGH_WATERMARK 64
+#define THREAD_CACHE_LOW_WATERMARK 16
 
-//Semaphore for cleaning up only when needed.
-semaphore_t cleanup_sema = NULL;
+#define STACK_CLASS_MIN_SHIFT 14
+#define STACK_CLASSES 12
+#define STACK_CACHE_KEEP (16 * 1024)
+
+typedef struct thread_cache_class {
+	minithread_t 		free_list;
+	int 				cached;
+} thread_cache_class;
+
+typedef struct thread_cache {
+	thread_cache_class 	classes[STACK_CLASSES];
+	int 				cached;
+	unsigned long 		hits;
+	unsigned long 		misses;
+	unsigned long 		frees;
+	size_t 				stack_high_water;
+	seqlock_t 			lock;		//writers change the cache, readers only copy the statistics
+} thread_cache;
+
+static thread_cache cache;
+
+//Size class of a stack of the given size, or -1 if stacks that big are not cached.
+int stack_class(size_t size){
+	int k;
+
+	for(k = 0; k < STACK_CLASSES; k++){
+		if(((size_t) 1 << (STACK_CLASS_MIN_SHIFT + k)) >= size) return k;
+	}
+	return -1;
+}
 
 /*
-	Scheduler definition. (Multivel additions for p2)
+	Scheduler definition. Every virtual processor has its own ready queue:
+	one level per priority above MINITHREAD_PRIORITY_NORMAL, run first and
+	round robin, the highest priority at level 0, and under it the thread
+	groups, every one with a run queue of the scheduling policy for its own
+	threads of normal priority.
+
+	quanta_count is the number of quanta the running thread has used of its
+	time slice, and a tickless clock ends the slice at quantum_end (0 when it
+	has no end). resched is set when a thread woke up that should preempt it.
 */
 
-int number_of_levels = 4;
-int maxval = 100;
-static int quanta_durations[4] = {1, 2, 4, 8};
-static int quanta_proportions[4] = {0,50, 75, 90};
+#define RT_LEVELS MINITHREAD_PRIORITY_MAX
+
+static const scheduler_ops *policy = &scheduler_mlfq;
+
+static const scheduler_ops *policies[] = {
+	&scheduler_mlfq,
+	&scheduler_stride,
+	&scheduler_lottery,
+	&scheduler_fifo,
+	&scheduler_cfs,
+	NULL
+};
 
 typedef struct scheduler {
-	multilevel_queue_t 	ready_queue;
-	queue_t 			finished_queue;
-	unsigned int 		level;
-	unsigned int 		quanta_count;
-	unsigned int 		freq_count;
+	int 				id;
+	multilevel_queue_t 	rt_queue;
+	volatile int 		ready_count;
+	int 				quanta_count;
+	uint64_t 			slice_start;
+	uint64_t 			quantum_end;
+	int 				resched;
 } scheduler;
 typedef struct scheduler *scheduler_t;
 
-scheduler_t thread_scheduler;
+/*
+	Thread groups. On every virtual processor, a group is a node of a tree
+	of run queues: its children are its subgroups with threads queued there,
+	and its own threads, which count as one more child of the default weight.
+	The scheduler walks down from the root group, each time to the child with
+	the smallest virtual time, which advances as the child's threads run, the
+	more slowly the more weight it has.
+
+	count is the number of queued threads that can be reached from a group on
+	a processor: a group that used up its quota for the period is throttled,
+	which takes it off its parent's children until the period is over, and
+	takes its threads out of its ancestors' counts and out of the processor's
+	ready_count.
+*/
+
+typedef struct group_cpu {
+	struct minithread_group *group;
+	void 				*run_queue;
+	int 				own_count;
+	int 				count;
+	iqueue 				children;
+	iqueue_link 		link;
+	uint64_t 			vtime;
+	uint64_t 			own_vtime;
+	uint64_t 			min_vtime;
+} group_cpu;
+
+typedef struct minithread_group {
+	struct minithread_group *parent;
+	int 				weight;
+	int 				subgroups;
+	uint64_t 			quota;
+	uint64_t 			period;
+	uint64_t 			period_start;
+	uint64_t 			used;
+	int 				throttled;
+	uint64_t 			throttled_since;
+	struct alarm 		refill_alarm;
+	minithread_group_stats_t stats;
+	group_cpu 			*cpus;
+} minithread_group;
+
+static minithread_group root_group;
+
+/*
+	Virtual processors (p5). Each one is a host thread with its own ready
+	queue, running thread and idle context. The idle context runs on the host
+	thread's own stack and is never put on a ready queue.
+*/
+
+typedef struct cpu {
+	int 				id;
+	pthread_t 			host_thread;
+	scheduler_t 		scheduler;
+	minithread_t 		current_thread;
+	minithread_t 		idle_thread;
+	volatile int 		halted;
+	uint64_t 			spin_window;
+	uint64_t 			idle_time;
+	unsigned long 		clock_interrupts;
+} cpu;
+typedef struct cpu *cpu_t;
+
+static cpu cpus[MINITHREAD_MAX_CPUS];
+static int cpu_count = 1;
+
+//Virtual processor the calling host thread is running. Only read it with
+//interrupts disabled, as a minithread may migrate as soon as they are enabled.
+//A switch can resume a thread on another host thread, so the address of
+//cpu_self must not be kept from before: it is always read through
+//current_cpu, which the compiler cannot inline and cache.
+static __thread cpu_t cpu_self = NULL;
+
+static cpu_t __attribute__((noinline)) current_cpu(){
+	return *(cpu_t volatile *) &cpu_self;
+}
+
+#define this_cpu (current_cpu())
 
 /*
 	Scheduler API.
 
 */
 
-void scheduler_init(scheduler_t *scheduler_ptr){
+void scheduler_init(scheduler_t *scheduler_ptr, int id){
 	
 	scheduler_t s;
 
 	*scheduler_ptr = (scheduler_t) malloc(sizeof(struct scheduler));
 	s = *scheduler_ptr;
-	s->ready_queue = multilevel_queue_new(number_of_levels);
-	s->finished_queue = queue_new();
-	s->level = 0;
+	s->id = id;
+	s->rt_queue = multilevel_queue_new(RT_LEVELS);
+	AbortOnCondition(s->rt_queue == NULL, "scheduler_init");
+	s->ready_count = 0;
 	s->quanta_count = 0;
-	s->freq_count = 0;
+	s->slice_start = 0;
+	s->quantum_end = 0;
+	s->resched = 0;
+}
 
-	cleanup_sema 		= semaphore_create();
-	semaphore_initialize(cleanup_sema, 0);
+//Wake up to count halted virtual processors so they can come and steal work.
+void scheduler_kick(int count){
+	int i;
+
+	//Pairs with the swap in minithread_idle: either we see it halted, or it sees our work.
+	__sync_synchronize();
+
+	for(i = 1; i < cpu_count && count > 0; i++){
+		cpu_t c = &cpus[(this_cpu->id + i) % cpu_count];
+		if(c->halted){
+			processor_wakeup(c->host_thread);
+			count--;
+		}
+	}
+}
+
+//Set up the run queue of group g on virtual processor id. Returns 0 (success) or -1 (failure).
+int group_cpu_init(minithread_group_t g, int id){
+	group_cpu *gc = &g->cpus[id];
+
+	gc->group = g;
+	gc->run_queue = policy->create();
+	if(gc->run_queue == NULL) return -1;
+	gc->own_count = 0;
+	gc->count = 0;
+	iqueue_init(&gc->children);
+	iqueue_link_init(&gc->link);
+	gc->vtime = 0;
+	gc->own_vtime = 0;
+	gc->min_vtime = 0;
+	return 0;
+}
+
+//Put g on its parent's children on processor id if it has threads to run there, take it off otherwise.
+void group_link(int id, minithread_group_t g){
+	group_cpu *gc = &g->cpus[id];
+	group_cpu *pc = &g->parent->cpus[id];
+
+	if(gc->count > 0 && !g->throttled && !iqueue_linked(&gc->link)){
+		//It does not get to catch up on the time it had nothing to run.
+		if((int64_t) (gc->vtime - pc->min_vtime) < 0) gc->vtime = pc->min_vtime;
+		iqueue_append(&pc->children, &gc->link);
+	} else if((gc->count == 0 || g->throttled) && iqueue_linked(&gc->link)){
+		iqueue_delete(&pc->children, &gc->link);
+	}
+}
+
+//Add delta queued threads to g on processor id, and to its ancestors up to the first throttled one.
+void group_count(int id, minithread_group_t g, int delta){
+	for(; g != NULL; g = g->parent){
+		g->cpus[id].count += delta;
+		if(g->throttled) return;
+
+		if(g->parent == NULL){
+			cpus[id].scheduler->ready_count += delta;
+		} else {
+			group_link(id, g);
+		}
+	}
+}
+
+//Whether t belongs to a group that is out of quota. Threads with a priority are not held back.
+int group_throttled(minithread_t t){
+	minithread_group_t g;
+
+	if(t->effective_priority > MINITHREAD_PRIORITY_NORMAL) return 0;
+
+	for(g = t->group; g != NULL; g = g->parent){
+		if(g->throttled) return 1;
+	}
+	return 0;
+}
+
+void group_refill(void *arg);
+
+//Hold back the threads of g until its next period.
+void group_throttle(minithread_group_t g){
+	int id;
+
+	g->throttled = 1;
+	g->throttled_since = currentTimeNanos();
+	g->stats.throttles++;
+
+	for(id = 0; id < cpu_count; id++){
+		group_link(id, g);
+		if(g->cpus[id].count > 0) group_count(id, g->parent, -g->cpus[id].count);
+	}
+
+	register_alarm_embedded_at(&g->refill_alarm, g->period_start + g->period, group_refill, g);
+}
+
+//Let the threads of g run again, waking up the processors they are queued on.
+void group_unthrottle(minithread_group_t g){
+	int id;
+
+	g->throttled = 0;
+	g->stats.throttled_time += currentTimeNanos() - g->throttled_since;
+
+	for(id = 0; id < cpu_count; id++){
+		if(g->cpus[id].count == 0) continue;
+
+		group_link(id, g);
+		group_count(id, g->parent, g->cpus[id].count);
+		if(cpus[id].halted) processor_wakeup(cpus[id].host_thread);
+	}
+}
+
+//Alarm handler at the end of the period of a throttled group. Overuse carries over.
+void group_refill(void *arg){
+	minithread_group_t g = (minithread_group_t) arg;
+
+	g->period_start = currentTimeNanos();
+	g->used = g->used > g->quota ? g->used - g->quota : 0;
+
+	if(g->used >= g->quota){
+		register_alarm_embedded_at(&g->refill_alarm, g->period_start + g->period, group_refill, g);
+	} else {
+		group_unthrottle(g);
+	}
+}
+
+//Charge the groups of t for ran nanoseconds it ran on processor id, throttling those out of quota.
+void group_charge(int id, minithread_t t, uint64_t ran){
+	minithread_group_t g = t->group;
+	uint64_t now = currentTimeNanos();
+
+	g->cpus[id].own_vtime += ran;
+
+	for(; g != NULL; g = g->parent){
+		g->stats.run_time += ran;
+		if(g->parent == NULL) break;
+
+		g->cpus[id].vtime += ran * MINITHREAD_GROUP_WEIGHT_DEFAULT / g->weight;
+
+		if(g->quota == 0) continue;
+		if(!g->throttled && now - g->period_start >= g->period){
+			g->period_start = now;
+			g->used = 0;
+		}
+		g->used += ran;
+		if(!g->throttled && g->used >= g->quota) group_throttle(g);
+	}
+}
+
+/*
+* Pick the thread to run next among the groups on the given scheduler, walking
+* down from the root to the child with the smallest virtual time every time.
+*/
+minithread_t group_dequeue(scheduler_t scheduler){
+	int id = scheduler->id;
+	minithread_group_t g = &root_group;
+	minithread_t t;
+
+	if(root_group.cpus[id].count == 0) return NULL;
+
+	while(1){
+		group_cpu *gc = &g->cpus[id];
+		minithread_group_t next = NULL;
+		uint64_t vtime = gc->own_vtime;
+		iqueue_link_t link;
+
+		for(link = iqueue_first(&gc->children); link != NULL; link = iqueue_next(&gc->children, link)){
+			group_cpu *child = iqueue_entry(link, group_cpu, link);
+
+			if((next == NULL && gc->own_count == 0) || (int64_t) (child->vtime - vtime) < 0){
+				next = child->group;
+				vtime = child->vtime;
+			}
+		}
+
+		gc->min_vtime = vtime;
+		if(next == NULL) break;
+		g = next;
+	}
+
+	t = policy->dequeue(g->cpus[id].run_queue);
+	g->cpus[id].own_count--;
+	group_count(id, g, -1);
+	return t;
+}
+
+//Put t on the ready queue of the given scheduler. A thread of normal priority goes to its group.
+void scheduler_insert(scheduler_t scheduler, minithread_t t, int was_running){
+	if(t->effective_priority > MINITHREAD_PRIORITY_NORMAL){
+		multilevel_queue_enqueue(scheduler->rt_queue,
+			MINITHREAD_PRIORITY_MAX - t->effective_priority, &t->queue_link);
+		scheduler->ready_count++;
+	} else {
+		group_cpu *gc = &t->group->cpus[scheduler->id];
+
+		if(gc->own_count == 0 && (int64_t) (gc->own_vtime - gc->min_vtime) < 0){
+			gc->own_vtime = gc->min_vtime;
+		}
+		if(was_running){
+			policy->enqueue(gc->run_queue, t);
+		} else {
+			policy->wake(gc->run_queue, t);
+		}
+		gc->own_count++;
+		group_count(scheduler->id, t->group, 1);
+	}
+	t->queued_on = scheduler;
+}
+
+//Take t off the ready queue it is on. Must be called with interrupts disabled.
+void scheduler_remove(minithread_t t){
+	scheduler_t scheduler = t->queued_on;
+
+	if(t->effective_priority > MINITHREAD_PRIORITY_NORMAL){
+		multilevel_queue_delete(scheduler->rt_queue,
+			MINITHREAD_PRIORITY_MAX - t->effective_priority, &t->queue_link);
+		scheduler->ready_count--;
+	} else {
+		group_cpu *gc = &t->group->cpus[scheduler->id];
+
+		policy->remove(gc->run_queue, t);
+		gc->own_count--;
+		group_count(scheduler->id, t->group, -1);
+	}
+	t->queued_on = NULL;
+}
+
+//Whether a thread of higher priority than t is waiting on the given scheduler.
+int scheduler_preempts(scheduler_t scheduler, minithread_t t){
+	int level;
+
+	if(multilevel_queue_length(scheduler->rt_queue) == 0) return 0;
+
+	for(level = 0; level < MINITHREAD_PRIORITY_MAX - t->effective_priority; level++){
+		if(multilevel_queue_level_length(scheduler->rt_queue, level) > 0) return 1;
+	}
+	return 0;
+}
+
+//Whether t, just woken up, should preempt the thread running on this processor.
+int scheduler_wakeup_preempts(scheduler_t scheduler, minithread_t t){
+	minithread_t current = this_cpu->current_thread;
+
+	if(current == this_cpu->idle_thread) return 0;
+	if(t->effective_priority != current->effective_priority){
+		return t->effective_priority > current->effective_priority;
+	}
+	return t->effective_priority == MINITHREAD_PRIORITY_NORMAL && policy->preempt != NULL &&
+		t->group == current->group &&
+		policy->preempt(t->group->cpus[scheduler->id].run_queue, current, t);
+}
+
+//Insert t into the ready queue of the given scheduler at time now, accounting for its wait.
+void scheduler_ready(scheduler_t scheduler, minithread_t t, int was_running, uint64_t now){
+	if(t->blocked_since != 0){
+		t->stats.blocked_time += now - t->blocked_since;
+		t->blocked_since = 0;
+	}
+	t->ready_since = now;
+
+	scheduler_insert(scheduler, t, was_running);
+}
 
+/*
+* Make t runnable on the given scheduler, was_running telling whether it was
+* switched out rather than woken up. Must be called with interrupts disabled.
+*/
+void scheduler_enqueue(scheduler_t scheduler, minithread_t t, int was_running){
+	uint64_t now = currentTimeNanos();
+
+	scheduler_ready(scheduler, t, was_running, now);
+	scheduler_kick(1);
+
+	//A tickless clock would only preempt the running thread at the end of its quantum.
+	if(scheduler == this_cpu->scheduler && !was_running && scheduler_wakeup_preempts(scheduler, t)){
+		scheduler->resched = 1;
+		minithread_clock_request(now);
+	}
+}
+
+/*
+* Dequeue the thread to run next from the given scheduler: the first one of the
+* highest priority, or the pick of the groups and the policy. Returns NULL if
+* there is none. Must be called with interrupts disabled.
+*/
+minithread_t scheduler_dequeue(scheduler_t scheduler){
+	iqueue_link_t link;
+	minithread_t t;
+
+	if(multilevel_queue_dequeue(scheduler->rt_queue, 0, &link) != -1){
+		t = minithread_of(link);
+		scheduler->ready_count--;
+	} else {
+		t = group_dequeue(scheduler);
+		if(t == NULL) return NULL;
+	}
+
+	t->queued_on = NULL;
+	return t;
+}
+
+/*
+ * Change the effective priority of t, moving it to the matching ready queue
+ * level if it is runnable. Must be called with interrupts disabled.
+ */
+void minithread_set_effective_priority(minithread_t t, int priority){
+	scheduler_t scheduler = t->queued_on;
+
+	if(priority == t->effective_priority) return;
+
+	if(scheduler != NULL){
+		scheduler_remove(t);
+		t->effective_priority = priority;
+		scheduler_insert(scheduler, t, 0);
+	} else {
+		t->effective_priority = priority;
+	}
 }
 
-//Pick the level to peek on the multilevel_queue based on the frequency counter.
-int scheduler_pick_level(scheduler_t scheduler){
+/*
+* How many more quanta t gets, having used quanta of its time slice: 0 to preempt
+* it, -1 for no limit. Threads with a priority get one quantum at a time.
+*/
+int scheduler_slice(scheduler_t scheduler, minithread_t t, int quanta){
+	if(t->effective_priority > MINITHREAD_PRIORITY_NORMAL){
+		return quanta >= 1 ? 0 : 1;
+	}
+	return policy->tick(t->group->cpus[scheduler->id].run_queue, t, quanta);
+}
 
-	if(scheduler->freq_count++ < quanta_proportions[1]) return 0;
+/*
+* Steal a thread from another virtual processor's ready queue, trying the ones
+* after the given one first. Returns NULL if they are all empty.
+*/
+minithread_t scheduler_steal(cpu_t thief){
+	int i;
+	minithread_t t;
+
+	for(i = 1; i < cpu_count; i++){
+		cpu_t victim = &cpus[(thief->id + i) % cpu_count];
 
-	if(scheduler->freq_count   < quanta_proportions[2]) return 1;
+		if(victim->scheduler->ready_count == 0) continue;
 
-	if(scheduler->freq_count   < quanta_proportions[3]) return 2;
+		t = scheduler_dequeue(victim->scheduler);
+		if(t != NULL) return t;
+	}
 
-	if(scheduler->freq_count == maxval) scheduler->freq_count = 0;
+	return NULL;
+}
 
-	return 3;
+//Whether any virtual processor has a thread waiting to run. Read without the kernel lock.
+int scheduler_has_work(){
+	int i;
+
+	for(i = 0; i < cpu_count; i++){
+		if(cpus[i].scheduler->ready_count > 0) return 1;
+	}
+	return 0;
 }
 
 
+/*
+* A tickless clock has to interrupt the processor when its quantum ends, unless
+* it is idle, and when the next alarm is due, unless it is idle and another
+* processor keeps the alarms. Called with interrupts disabled.
+*/
+void scheduler_program_clock(cpu_t cpu){
+	uint64_t deadline;
+
+	if(!clock_tickless) return;
+
+	deadline = 0;
+	if(cpu->current_thread != cpu->idle_thread || cpu->id == alarm_cpu){
+		deadline = alarm_next_deadline();
+	}
+	if(cpu->current_thread != cpu->idle_thread && cpu->scheduler->quantum_end != 0 &&
+		(deadline == 0 || cpu->scheduler->quantum_end < deadline)){
+		deadline = cpu->scheduler->quantum_end;
+	}
+	minithread_clock_request(deadline);
+}
+
+void minithread_alarm_clock_request(uint64_t deadline){
+	alarm_cpu = this_cpu->id;
+	minithread_clock_request(deadline);
+}
+
+//Start a new time slice for the thread running on the processor.
+void scheduler_start_quantum(cpu_t cpu){
+	scheduler_t scheduler = cpu->scheduler;
+	int quanta;
+
+	scheduler->quanta_count = 0;
+	scheduler->slice_start = currentTimeNanos();
+	scheduler->resched = 0;
+
+	if(!clock_tickless) return;
+
+	quanta = scheduler_slice(scheduler, cpu->current_thread, 0);
+	if(quanta == 0) quanta = 1;
+	scheduler->quantum_end = quanta > 0 ? scheduler->slice_start + quanta * quantum_length : 0;
+	scheduler_program_clock(cpu);
+}
+
+//Charge the thread running on the processor for the time it has run so far.
+void scheduler_account_run(cpu_t cpu){
+	minithread_t t = cpu->current_thread;
+	uint64_t now;
+
+	if(t == cpu->idle_thread) return;
+
+	now = currentTimeNanos();
+	t->stats.run_time += now - t->running_since;
+	if(t->effective_priority == MINITHREAD_PRIORITY_NORMAL){
+		group_charge(cpu->id, t, now - t->running_since);
+	}
+	t->running_since = now;
+}
+
+//Account a context switch in the statistics of both threads, and trace it.
+void scheduler_account_switch(cpu_t cpu, minithread_t from, minithread_t to, int preempted){
+	uint64_t now = currentTimeNanos();
+	int level = to->queued_level;
+	trace_reason_t reason;
+
+	if(from->state == FINISHED) reason = TRACE_EXIT;
+	else if(from->state == WAITING) reason = TRACE_BLOCK;
+	else if(preempted) reason = TRACE_PREEMPT;
+	else reason = TRACE_YIELD;
+
+	//scheduler_account_run has charged from for its run already.
+	if(from != cpu->idle_thread){
+		if(reason == TRACE_PREEMPT) from->stats.involuntary_switches++;
+		else from->stats.voluntary_switches++;
+		if(reason == TRACE_BLOCK) from->blocked_since = now;
+	}
+
+	if(to != cpu->idle_thread){
+		to->stats.ready_time += now - to->ready_since;
+		to->running_since = now;
+		to->stats.level = level;
+		to->stats.level_runs[level < MINITHREAD_STATS_LEVELS ? level : MINITHREAD_STATS_LEVELS - 1]++;
+	}
+
+	trace_switch(cpu->id, from->pid, to->pid, level, reason, now);
+}
+
 /*
 * Try to context switch only once, return 1 (success) if it found a valid TCB to switch to, otherwise 0 (failure).
+* A thread that cannot continue is always switched away from, to the idle context if nothing else is runnable.
+* preempted tells whether the switch comes from the clock rather than the thread itself, yielded
+* whether the thread asked to give the processor up.
 */
-int scheduler_switch_dequeue(scheduler_t scheduler){
+int scheduler_switch_dequeue(int preempted, int yielded){
 	minithread_t thread_to_run;	
+	minithread_t current_thread;
+	scheduler_t scheduler;
+	cpu_t cpu;
 
 	interrupt_level_t old_level;
-	int deq_level;
+	int quanta;
+	int slice;
+	int must_switch;
+	int requeued;
+	int throttled;
 
 	//Scheduler cannot be interrupted while it's trying to dequeue.
 	old_level = set_interrupt_level(DISABLED);
 
-	scheduler->quanta_count++;
+	cpu = this_cpu;
+	scheduler = cpu->scheduler;
+	current_thread = cpu->current_thread;
 
-	/* 
-		We have to context switch only if either the max number of quanta for the current level has expired or
-	   	the current thread has finished or put to wait before it expires. 
-	   	We also need to switch if we're scheduling for the first time.
-	*/
-	if(scheduler->quanta_count >= quanta_durations[scheduler->level] || 
-		current_thread == NULL || current_thread->state == FINISHED || current_thread->state == WAITING){
-		
-		unsigned int old_queue_level;
-		if(scheduler->level == number_of_levels - 1){
-			old_queue_level = scheduler->level - 1;
-		} else {
-			old_queue_level = scheduler->level;
-		} 
+	//Charge the current thread so far, which may use up the quota of its group.
+	scheduler_account_run(cpu);
+	throttled = current_thread != cpu->idle_thread && group_throttled(current_thread);
 
-		scheduler->quanta_count = 0;
-		scheduler->level = scheduler_pick_level(scheduler);
+	//A tickless clock counts the quanta that went by, as it does not interrupt every one.
+	quanta = ++scheduler->quanta_count;
+	if(clock_tickless && (currentTimeNanos() - scheduler->slice_start) / quantum_length > quanta){
+		quanta = (currentTimeNanos() - scheduler->slice_start) / quantum_length;
+	}
 
-		deq_level = multilevel_queue_dequeue(scheduler->ready_queue, scheduler->level, (void **) &thread_to_run);
+	must_switch = current_thread->state == FINISHED || current_thread->state == WAITING;
 
-		if(deq_level == -1){
-			//No threads found for the new level, return to 0.
-			scheduler->level = 0;
-			scheduler->freq_count = quanta_proportions[scheduler->level];
-			deq_level = multilevel_queue_dequeue(scheduler->ready_queue, scheduler->level, (void **) &thread_to_run);
+	/* 
+		We have to context switch only if either the time slice the policy gave the current thread is over or
+	   	the current thread has finished or put to wait before it is, or its group is out of quota.
+	   	The idle context gives the processor away as soon as anything is runnable. A yield counts
+	   	as a quantum, and ends a time slice the policy did not bound.
+	*/
+	if(must_switch || throttled || current_thread == cpu->idle_thread ||
+		(preempted && (scheduler->resched || scheduler_preempts(scheduler, current_thread))) ||
+		(slice = scheduler_slice(scheduler, current_thread, quanta)) == 0 || (yielded && slice < 0)){
+
+		//The current thread goes back on the ready queue first, so the policy can choose it again.
+		//Halted processors are only kicked below, if it is left there for them to steal.
+		requeued = !must_switch && current_thread != cpu->idle_thread;
+		if(requeued){
+			current_thread->state = READY;
+			scheduler_ready(scheduler, current_thread, 1, currentTimeNanos());
 		}
 
-		if(deq_level != -1){
-			stack_pointer_t *oldsp_ptr; 
+		thread_to_run = scheduler_dequeue(scheduler);
+		if(requeued && thread_to_run != current_thread) scheduler_kick(1);
 
-			if(deq_level != scheduler->level){
-				scheduler->level = deq_level;
-				scheduler->freq_count = quanta_proportions[scheduler->level];
-			}
+		//Nothing local: an idle or blocking processor steals from the busy ones.
+		if(thread_to_run == NULL && (must_switch || throttled || current_thread == cpu->idle_thread)){
+			thread_to_run = scheduler_steal(cpu);
+		}
 
-			//Check if we're scheduling for the first time.
-			if(current_thread == NULL){
-				//Assign a dummy stack_pointer_t for the first context switch.
-				oldsp_ptr = (stack_pointer_t) malloc(sizeof(stack_pointer_t));
-			} else {
-				oldsp_ptr = &(current_thread->sp);
+		//Still nothing, so a blocking or held back thread hands the processor to the idle context.
+		if(thread_to_run == NULL && (must_switch || throttled)){
+			thread_to_run = cpu->idle_thread;
+		}
 
-				if(current_thread->state == FINISHED){
-					queue_append(scheduler->finished_queue, current_thread);
-				} else if(current_thread->state == RUNNING || current_thread->state == READY){
+		if(thread_to_run != NULL && thread_to_run != current_thread){
+			scheduler_account_switch(cpu, current_thread, thread_to_run, preempted);
 
-					//if previously idling, I shouldn't re-enqueue myself.
-					if(current_thread != thread_to_run && !current_thread->idling){
-						current_thread->state = READY;
-						multilevel_queue_enqueue(scheduler->ready_queue, old_queue_level + 1, current_thread);
-					}
-				}
-
-				current_thread->idling = 0;
+			if(current_thread->state == FINISHED){
+				iqueue_append(&finished_queue, &current_thread->queue_link);
 			}
 
 			thread_to_run->state = RUNNING;
-			current_thread = thread_to_run;
+			cpu->current_thread = thread_to_run;
+			scheduler_start_quantum(cpu);
 
-			minithread_switch(oldsp_ptr, &(current_thread->sp));
+			//A switch out of a clock interrupt saves every register, the others are plain calls.
+			if(preempted){
+				minithread_switch(&(current_thread->sp), &(thread_to_run->sp));
+			} else {
+				minithread_switch_fast(&(current_thread->sp), &(thread_to_run->sp));
+			}
 			return 1;
 		}
+
+		//Nothing else to run, so the current thread starts over.
+		current_thread->state = RUNNING;
+		scheduler_start_quantum(cpu);
 	}
 
 	set_interrupt_level(old_level);
@@ -192,34 +776,49 @@ int scheduler_switch_dequeue(scheduler_t scheduler){
 
 /*
 * Scheduler method that makes the context switch. It adds the current TCB to the appropriate queue,
-* depending on its state and then dequeues the next TCB, switching to it. It also busy waits for new threads
-* to become ready, releasing them from the blocked queue if necessary.
+* depending on its state and then dequeues the next TCB, switching to it. If the current thread
+* cannot continue and nothing else is runnable, the processor goes to its idle context.
 */
-void scheduler_switch(scheduler_t scheduler){
+void scheduler_switch(){
 
 	interrupt_level_t old_level;
-	int switch_result;
 
 	//Scheduler cannot be interrupted while it's trying to decide.
 	old_level = set_interrupt_level(DISABLED);
 
-	switch_result = scheduler_switch_dequeue(scheduler);
-	if(switch_result){
-		set_interrupt_level(old_level);
-		return;
-	}
+	//Either we switched and came back, or the current thread can simply proceed.
+	scheduler_switch_dequeue(0, 0);
 
-	//If the current thread isn't finished yet and has yielded, allow it to proceed.
-	if(current_thread->state == RUNNING){
-			set_interrupt_level(old_level);
-			return;
+	set_interrupt_level(old_level);
+}
+
+/*
+* Switch straight to t, which must be on a ready queue, putting the current thread back on its own.
+* t runs on what is left of the current time slice. Returns 0 once the current thread runs again,
+* or -1 if t cannot be switched to. Must be called with interrupts disabled.
+*/
+int scheduler_switch_to(minithread_t t){
+	cpu_t cpu = this_cpu;
+	minithread_t current_thread = cpu->current_thread;
+
+	if(t == current_thread || current_thread == cpu->idle_thread ||
+		t->state != READY || t->queued_on == NULL || group_throttled(t)){
+		return -1;
 	}
 
-	//There are no threads to be run and the current_thread cannot continue. Reenable interrupts and busy wait.
-	current_thread->idling = 1;
-	set_interrupt_level(old_level);
-	while(current_thread->state != RUNNING);
-	
+	//The current thread gave its time away rather than used it up, so it is queued as if woken up.
+	scheduler_account_run(cpu);
+	current_thread->state = READY;
+	scheduler_enqueue(cpu->scheduler, current_thread, 0);
+
+	scheduler_remove(t);
+	scheduler_account_switch(cpu, current_thread, t, 0);
+	t->state = RUNNING;
+	cpu->current_thread = t;
+	cpu->scheduler->resched = 0;
+
+	minithread_switch_fast(&(current_thread->sp), &(t->sp));
+	return 0;
 }
 
 /*
@@ -228,21 +827,106 @@ void scheduler_switch(scheduler_t scheduler){
  */
 void minithread_free(minithread_t t);
 
+//Take a TCB, with its stack, from the cache. Returns NULL on a miss.
+minithread_t thread_cache_get(int class){
+	minithread_t t = NULL;
+
+	seqlock_write_lock(cache.lock);
+
+	if(class != -1) t = cache.classes[class].free_list;
+	if(t != NULL){
+		cache.classes[class].free_list = t->cache_next;
+		cache.classes[class].cached--;
+		cache.cached--;
+		cache.hits++;
+	} else {
+		cache.misses++;
+	}
+
+	seqlock_write_unlock(cache.lock);
+	return t;
+}
 
-//Thread responsible for freeing up the zombie threads.
+//Thread responsible for freeing up the zombie threads, a whole batch at a time.
 int vaccum_cleaner(int *arg){
 	while(1){
 		interrupt_level_t old_level;
 		minithread_t zombie_thread;
+		iqueue_link_t link;
+		iqueue zombies;
+		minithread_t batch = NULL;
+		minithread_t to_free = NULL;
+		size_t high_water = 0;
 
 		semaphore_P(cleanup_sema);
 
+		//Take the whole batch at once.
+		iqueue_init(&zombies);
 		old_level = set_interrupt_level(DISABLED);
+		iqueue_concat(&zombies, &finished_queue);
+		set_interrupt_level(old_level);
+
+		while(iqueue_dequeue(&zombies, &link) == 0){
+			zombie_thread = minithread_of(link);
+			zombie_thread->cache_next = batch;
+			batch = zombie_thread;
+		}
+
+		//Measure how deep the stacks went and give back all but their top pages.
+		for(zombie_thread = batch; zombie_thread != NULL; zombie_thread = zombie_thread->cache_next){
+			size_t usage = minithread_measure_stack(zombie_thread->stackbase, zombie_thread->stacktop);
+
+			if(usage > high_water) high_water = usage;
+			if(usage > STACK_CACHE_KEEP){
+				minithread_stack_discard(zombie_thread->stackbase, zombie_thread->stacktop, STACK_CACHE_KEEP);
+			}
+		}
 
-		if(queue_dequeue(thread_scheduler->finished_queue, (void **) &zombie_thread) == 0){
+		seqlock_write_lock(cache.lock);
+
+		if(high_water > cache.stack_high_water) cache.stack_high_water = high_water;
+
+		//Recycle every zombie, then trim the classes that grew past the high watermark.
+		while(batch != NULL){
+			int class;
+
+			zombie_thread = batch;
+			batch = batch->cache_next;
+
+			class = stack_class(zombie_thread->stacksize);
+			if(class == -1){
+				cache.frees++;
+				zombie_thread->cache_next = to_free;
+				to_free = zombie_thread;
+				continue;
+			}
+
+			zombie_thread->cache_next = cache.classes[class].free_list;
+			cache.classes[class].free_list = zombie_thread;
+			cache.classes[class].cached++;
+			cache.cached++;
+
+			if(cache.classes[class].cached > THREAD_CACHE_HIGH_WATERMARK){
+				while(cache.classes[class].cached > THREAD_CACHE_LOW_WATERMARK){
+					zombie_thread = cache.classes[class].free_list;
+					cache.classes[class].free_list = zombie_thread->cache_next;
+					cache.classes[class].cached--;
+					cache.cached--;
+					cache.frees++;
+
+					zombie_thread->cache_next = to_free;
+					to_free = zombie_thread;
+				}
+			}
+		}
+		seqlock_write_unlock(cache.lock);
+
+		//The trimmed threads are ours alone now, free them without holding up the others.
+		while(to_free != NULL){
+			zombie_thread = to_free;
+			to_free = to_free->cache_next;
 			minithread_free(zombie_thread);
 		}
-		set_interrupt_level(old_level);
 	}
 
 }
@@ -250,15 +934,18 @@ int vaccum_cleaner(int *arg){
 
 /* Cleanup function pointer. */
 int cleanup_proc(arg_t arg){
-	interrupt_level_t old_level = set_interrupt_level(DISABLED);	
-	current_thread->state = FINISHED;
-
-	//Tell the vaccum_cleaner there is a thread ready to be cleaned up.
-	semaphore_V(cleanup_sema);
-
-	set_interrupt_level(old_level);
+	set_interrupt_level(DISABLED);	
+	this_cpu->current_thread->state = FINISHED;
+	this_cpu->current_thread->group->stats.threads--;
+
+	//Tell the vaccum_cleaner there are threads ready to be cleaned up, once per batch.
+	//We are appended to finished_queue when we switch away, before interrupts come back on.
+	if(iqueue_length(&finished_queue) == 0){
+		semaphore_V(cleanup_sema);
+	}
 
-	scheduler_switch(thread_scheduler);
+	//Interrupts stay disabled until we are off this stack for good.
+	scheduler_switch();
 
 	//Shouldn't happen.
 	return -1;
@@ -267,16 +954,122 @@ int cleanup_proc(arg_t arg){
 //Static id counter to number threads.
 static int id_counter = 0;
 
+//Poll for work for up to window nanoseconds. Returns 1 if some showed up.
+int minithread_idle_poll(uint64_t window){
+	uint64_t start = currentTimeNanos();
+
+	while(currentTimeNanos() - start < window){
+		if(scheduler_has_work()) return 1;
+	}
+	return 0;
+}
+
+/*
+ * Idle context of a virtual processor. It polls the ready queues without the
+ * kernel lock for a while, then halts until an interrupt or another processor
+ * wakes it up. The polling window grows when halts turn out to be shorter than
+ * MINITHREAD_IDLE_SPIN (polling would have caught the work) and shrinks when
+ * they are longer.
+ */
+int minithread_idle(arg_t arg){
+	//The idle context never migrates, so this stays valid.
+	cpu_t cpu = this_cpu;
+
+	while(1){
+		uint64_t idle_start = currentTimeNanos();
+
+		if(!minithread_idle_poll(cpu->spin_window)){
+			uint64_t halt_start = currentTimeNanos();
+			uint64_t halt_time;
+
+			swap((int *) &cpu->halted, 1);
+			processor_halt(scheduler_has_work);
+			cpu->halted = 0;
+
+			halt_time = currentTimeNanos() - halt_start;
+			if(halt_time < MINITHREAD_IDLE_SPIN){
+				cpu->spin_window = cpu->spin_window * 2 + MICROSECOND;
+				if(cpu->spin_window > MINITHREAD_IDLE_SPIN) cpu->spin_window = MINITHREAD_IDLE_SPIN;
+			} else {
+				cpu->spin_window /= 2;
+			}
+		}
+
+		cpu->idle_time += currentTimeNanos() - idle_start;
+
+		if(scheduler_has_work()){
+			scheduler_switch();
+		}
+	}
+
+	//Shouldn't happen.
+	return -1;
+}
+
+uint64_t minithread_cpu_idle_time(int cpu_id){
+	if(cpu_id < 0 || cpu_id >= cpu_count) return 0;
+	return cpus[cpu_id].idle_time;
+}
+
+unsigned long minithread_cpu_clock_interrupts(int cpu_id){
+	if(cpu_id < 0 || cpu_id >= cpu_count) return 0;
+	return cpus[cpu_id].clock_interrupts;
+}
+
+void minithread_reset_stats(minithread_t t){
+	memset(&t->stats, 0, sizeof(t->stats));
+	t->ready_since = 0;
+	t->running_since = 0;
+	t->blocked_since = 0;
+}
+
+void minithread_reset_priority(minithread_t t){
+	t->priority = MINITHREAD_PRIORITY_NORMAL;
+	t->effective_priority = MINITHREAD_PRIORITY_NORMAL;
+	iqueue_init(&t->owned_semaphores);
+	t->blocked_on = NULL;
+	t->queued_on = NULL;
+	t->queued_level = 0;
+	t->tickets = MINITHREAD_TICKETS_DEFAULT;
+	t->vtime = 0;
+	t->vtime_charged = 0;
+	rbtree_node_init(&t->run_node);
+}
+
+//TCB for the idle context of a virtual processor, which runs on the host thread's stack.
+minithread_t minithread_create_idle(){
+	minithread_t thread = (minithread_t) malloc(sizeof(minithread));
+	AbortOnCondition(thread == NULL, "minithread_create_idle");
+	thread->pid = -1;
+	thread->state = RUNNING;
+	thread->stackbase = NULL;
+	thread->stacktop = NULL;
+	thread->stacksize = 0;
+	thread->sp = NULL;
+	thread->cache_next = NULL;
+	thread->task_worker = NULL;
+	thread->group = &root_group;
+	iqueue_link_init(&thread->queue_link);
+	minithread_reset_stats(thread);
+	minithread_reset_priority(thread);
+	return thread;
+}
+
 /* minithread functions */
 
 minithread_t minithread_fork(proc_t proc, arg_t arg) {
+	return minithread_fork_with_stack(proc, arg, 0);
+}
+
+minithread_t minithread_fork_with_stack(proc_t proc, arg_t arg, size_t stack_size) {
 	interrupt_level_t old_level;
 
 	minithread_t forked_thread; 
-	forked_thread = minithread_create(proc, arg);
+	forked_thread = minithread_create_with_stack(proc, arg, stack_size);
+	if(forked_thread == NULL) return NULL;
 
 	old_level = set_interrupt_level(DISABLED);
-	multilevel_queue_enqueue(thread_scheduler->ready_queue, 0, forked_thread);
+	scheduler_enqueue(this_cpu->scheduler, forked_thread, 0);
 	set_interrupt_level(old_level);
 
 
@@ -284,27 +1077,62 @@ minithread_t minithread_fork(proc_t proc, arg_t arg) {
 }
 
 minithread_t minithread_create(proc_t proc, arg_t arg) {
+	return minithread_create_with_stack(proc, arg, 0);
+}
 
-	minithread_t thread = (minithread_t) malloc(sizeof(minithread));
+minithread_t minithread_create_with_stack(proc_t proc, arg_t arg, size_t stack_size) {
+	interrupt_level_t old_level;
+	minithread_t thread;
+	int class;
+
+	//Round the size up to its class, so that cached stacks are interchangeable.
+	if(stack_size == 0) stack_size = MINITHREAD_STACK_SIZE;
+	class = stack_class(stack_size);
+	if(class != -1) stack_size = (size_t) 1 << (STACK_CLASS_MIN_SHIFT + class);
+
+	thread = thread_cache_get(class);
+
+	if(thread == NULL){
+		thread = (minithread_t) malloc(sizeof(minithread));
+		if(thread == NULL) return NULL;
+
+		minithread_allocate_stack_size(&(thread->stackbase), &(thread->stacktop), stack_size);
+		if(thread->stackbase == NULL){
+			free(thread);
+			return NULL;
+		}
+		thread->stacksize = stack_size;
+	}
+
+	old_level = set_interrupt_level(DISABLED);
 	thread->pid = id_counter++;
+	//A new thread starts in the group of the thread that created it.
+	thread->group = this_cpu->current_thread->group;
+	thread->group->stats.threads++;
+	set_interrupt_level(old_level);
+
 	thread->state = READY;
+	thread->cache_next = NULL;
+	thread->task_worker = NULL;
+	iqueue_link_init(&thread->queue_link);
+	minithread_reset_stats(thread);
+	minithread_reset_priority(thread);
 
-	minithread_allocate_stack(&(thread->stackbase), &(thread->stacktop));
-	minithread_initialize_stack(&(thread->stacktop), 
+	//stacktop stays the top of the stack, so a cached thread can be set up again.
+	thread->sp = thread->stacktop;
+	minithread_initialize_stack(&(thread->sp), 
 								proc,
 								arg,
 								&cleanup_proc,
 								NULL);
 
-	thread->sp = thread->stacktop;
-
     return thread;
 }
 
 minithread_t minithread_self() {
     minithread_t self;
     interrupt_level_t old_level = set_interrupt_level(DISABLED);
-    self = current_thread;
+    self = this_cpu->current_thread;
     set_interrupt_level(old_level);
     return self;
 }
@@ -312,17 +1140,39 @@ minithread_t minithread_self() {
 int minithread_id() {
     int pid;
     interrupt_level_t old_level = set_interrupt_level(DISABLED);
-    pid = current_thread->pid;
+    pid = this_cpu->current_thread->pid;
     set_interrupt_level(old_level);
     return pid;
 }
 
+int minithread_cpu_id() {
+    int id;
+    interrupt_level_t old_level = set_interrupt_level(DISABLED);
+    id = this_cpu->id;
+    set_interrupt_level(old_level);
+    return id;
+}
+
+/*
+ * Blocks the caller. It can be called with interrupts already disabled, in
+ * which case the thread is put to wait atomically with whatever the caller
+ * did before (e.g. appending itself to a semaphore queue).
+ */
 void minithread_stop() {
+	minithread_block(MINITHREAD_BLOCK_OTHER);
+}
+
+void minithread_block(minithread_block_reason_t reason) {
 	interrupt_level_t old_level = set_interrupt_level(DISABLED);
-	current_thread->state = WAITING;
-	set_interrupt_level(old_level);
+	minithread_t self = this_cpu->current_thread;
 
-	scheduler_switch(thread_scheduler);
+	self->state = WAITING;
+	self->stats.last_block_reason = reason;
+	self->stats.blocks[reason]++;
+
+	scheduler_switch();
+
+	set_interrupt_level(old_level);
 }
 
 void minithread_start(minithread_t t) {
@@ -334,38 +1184,384 @@ void minithread_start(minithread_t t) {
     }
 	t->state = READY;
 
-	multilevel_queue_enqueue(thread_scheduler->ready_queue, 0, t);
+	scheduler_enqueue(this_cpu->scheduler, t, 0);
+	set_interrupt_level(old_level);
+}
+
+/*
+ * Starts all the threads of the queue, like minithread_start, but reads the
+ * clock, wakes up halted processors and checks for preemption once for the
+ * whole batch.
+ */
+void minithread_start_all(iqueue_t threads) {
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	scheduler_t scheduler = this_cpu->scheduler;
+	uint64_t now = currentTimeNanos();
+	iqueue_link_t link;
+	minithread_t t;
+	int started = 0;
+	int preempts = 0;
+
+	while(iqueue_dequeue(threads, &link) == 0){
+		t = minithread_of(link);
+		if(t->state == READY || t->state == RUNNING) continue;
+		t->state = READY;
+
+		scheduler_ready(scheduler, t, 0, now);
+		started++;
+		if(!preempts) preempts = scheduler_wakeup_preempts(scheduler, t);
+	}
+
+	if(started > 0) scheduler_kick(started);
+	if(preempts){
+		scheduler->resched = 1;
+		minithread_clock_request(now);
+	}
 	set_interrupt_level(old_level);
 }
 
 void minithread_yield() {
-	scheduler_switch(thread_scheduler);
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	scheduler_switch_dequeue(0, 1);
+
+	set_interrupt_level(old_level);
+}
+
+int minithread_yield_to(minithread_t t) {
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	int switched = scheduler_switch_to(t);
+
+	set_interrupt_level(old_level);
+	return switched;
+}
+
+int minithread_set_priority(minithread_t t, int priority) {
+	interrupt_level_t old_level;
+	int inherited;
+
+	if(priority < MINITHREAD_PRIORITY_NORMAL || priority > MINITHREAD_PRIORITY_MAX) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	t->priority = priority;
+	inherited = semaphore_donated_priority(t);
+	minithread_set_effective_priority(t, priority > inherited ? priority : inherited);
+	semaphore_priority_changed(t);
+
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+int minithread_get_priority(minithread_t t) {
+	return t->priority;
+}
+
+int minithread_set_tickets(minithread_t t, int tickets) {
+	interrupt_level_t old_level;
+	scheduler_t scheduler;
+
+	if(tickets < 1 || tickets > MINITHREAD_TICKETS_MAX) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	//The policy may account for the tickets of the threads it has queued.
+	scheduler = t->queued_on;
+	if(scheduler != NULL) scheduler_remove(t);
+	t->tickets = tickets;
+	if(scheduler != NULL) scheduler_insert(scheduler, t, 0);
+
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+int minithread_get_tickets(minithread_t t) {
+	return t->tickets;
+}
+
+minithread_group_t minithread_group_root() {
+	return &root_group;
+}
+
+minithread_group_t minithread_group_create(minithread_group_t parent, int weight) {
+	interrupt_level_t old_level;
+	minithread_group_t g;
+	int id;
+
+	if(weight < 1 || weight > MINITHREAD_GROUP_WEIGHT_MAX) return NULL;
+	if(parent == NULL) parent = &root_group;
+
+	g = (minithread_group_t) malloc(sizeof(minithread_group));
+	if(g == NULL) return NULL;
+	memset(g, 0, sizeof(minithread_group));
+
+	g->cpus = (group_cpu *) malloc(sizeof(group_cpu) * cpu_count);
+	if(g->cpus == NULL){
+		free(g);
+		return NULL;
+	}
+
+	for(id = 0; id < cpu_count; id++){
+		if(group_cpu_init(g, id) == -1){
+			while(--id >= 0) policy->destroy(g->cpus[id].run_queue);
+			free(g->cpus);
+			free(g);
+			return NULL;
+		}
+	}
+
+	g->parent = parent;
+	g->weight = weight;
+	iqueue_link_init(&g->refill_alarm.link);
+
+	old_level = set_interrupt_level(DISABLED);
+	parent->subgroups++;
+	set_interrupt_level(old_level);
+
+	return g;
+}
+
+int minithread_group_destroy(minithread_group_t group) {
+	interrupt_level_t old_level;
+	int id;
+
+	if(group == NULL || group == &root_group) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+	if(group->stats.threads > 0 || group->subgroups > 0){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+	deregister_alarm(&group->refill_alarm);
+	group->parent->subgroups--;
+	set_interrupt_level(old_level);
+
+	for(id = 0; id < cpu_count; id++){
+		policy->destroy(group->cpus[id].run_queue);
+	}
+	free(group->cpus);
+	free(group);
+	return 0;
+}
+
+int minithread_group_set_weight(minithread_group_t group, int weight) {
+	interrupt_level_t old_level;
+
+	if(group == NULL || weight < 1 || weight > MINITHREAD_GROUP_WEIGHT_MAX) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+	group->weight = weight;
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+int minithread_group_set_cap(minithread_group_t group, uint64_t quota, uint64_t period) {
+	interrupt_level_t old_level;
+
+	if(group == NULL || group == &root_group || (quota != 0 && period == 0)) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	deregister_alarm(&group->refill_alarm);
+	group->quota = quota;
+	group->period = period;
+	group->period_start = currentTimeNanos();
+	group->used = 0;
+	if(group->throttled) group_unthrottle(group);
+
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+int minithread_group_join(minithread_group_t group, minithread_t t) {
+	interrupt_level_t old_level;
+	scheduler_t scheduler;
+
+	if(group == NULL) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	if(t->state == FINISHED){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+
+	//What it ran so far goes to the group it leaves.
+	if(t == this_cpu->current_thread) scheduler_account_run(this_cpu);
+
+	scheduler = t->queued_on;
+	if(scheduler != NULL) scheduler_remove(t);
+	t->group->stats.threads--;
+	t->group = group;
+	group->stats.threads++;
+	if(scheduler != NULL) scheduler_insert(scheduler, t, 0);
+
+	set_interrupt_level(old_level);
+	return 0;
+}
+
+minithread_group_t minithread_group_of(minithread_t t) {
+	return t->group;
+}
+
+void minithread_group_get_stats(minithread_group_t group, minithread_group_stats_t *stats) {
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	*stats = group->stats;
+	if(group->throttled) stats->throttled_time += currentTimeNanos() - group->throttled_since;
+
+	set_interrupt_level(old_level);
 }
 
 void minithread_free(minithread_t t){
-	minithread_free_stack(t->stackbase);
+	minithread_free_stack_size(t->stackbase, t->stacksize);
 	free(t);
 }
 
+size_t minithread_stack_usage(minithread_t t){
+	if(t->stackbase == NULL) return 0;
+	return minithread_measure_stack(t->stackbase, t->stacktop);
+}
+
+void minithread_get_stats(minithread_t t, minithread_stats_t *stats){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	*stats = t->stats;
+	set_interrupt_level(old_level);
+}
+
+//Read without the kernel lock: copy again if the cache changed meanwhile.
+void minithread_get_cache_stats(minithread_cache_stats_t *stats){
+	unsigned int seq;
+
+	do {
+		seq = seqlock_read_begin(cache.lock);
+		stats->hits = cache.hits;
+		stats->misses = cache.misses;
+		stats->frees = cache.frees;
+		stats->cached = cache.cached;
+		stats->stack_high_water = cache.stack_high_water;
+	} while(seqlock_read_retry(cache.lock, seq));
+}
+
 /*
  * This is the clock interrupt handling routine.
  * You have to call minithread_clock_init with this
  * function as parameter in minithread_system_initialize
+ *
+ * Every virtual processor takes its own clock interrupts. With a periodic
+ * clock only the first one fires alarms. A tickless clock interrupts a
+ * processor for the alarms it asked for, so every processor fires them, and
+ * the interrupt may come before the quantum is over.
  */
 void 
 clock_handler(void* arg)
 {
+	int expired = 1;
 	interrupt_level_t old_level = set_interrupt_level(DISABLED);
-	alarm_id alarm = pop_alarm();
-	while(alarm != NULL){
-		execute_alarm(alarm);
-		deregister_alarm(alarm);
-		alarm = pop_alarm();
+	this_cpu->clock_interrupts++;
+	if(clock_tickless || this_cpu->id == 0){
+		//pop_alarm takes the alarm off the queue, so its handler may register it again.
+		alarm_id alarm = pop_alarm();
+		while(alarm != NULL){
+			execute_alarm(alarm);
+			alarm = pop_alarm();
+		}
+	}
+
+	if(clock_tickless){
+		expired = this_cpu->current_thread == this_cpu->idle_thread ||
+			(this_cpu->scheduler->quantum_end != 0 &&
+				currentTimeNanos() >= this_cpu->scheduler->quantum_end) ||
+			this_cpu->scheduler->resched ||
+			scheduler_preempts(this_cpu->scheduler, this_cpu->current_thread);
+		if(!expired) scheduler_program_clock(this_cpu);
 	}
-	current_tick++;
 	set_interrupt_level(old_level);
 
-	scheduler_switch_dequeue(thread_scheduler);
+	if(expired) scheduler_switch_dequeue(1, 0);
+}
+
+/*
+ * Body of the host thread behind every virtual processor but the first.
+ */
+void *cpu_boot(void *arg){
+	cpu_self = (cpu_t) arg;
+
+	minithread_clock_init_cpu();
+
+	set_interrupt_level(ENABLED);
+	minithread_idle(NULL);
+
+	return NULL;
+}
+
+void cpu_init(cpu_t c, int id){
+	c->id = id;
+	c->halted = 0;
+	c->spin_window = MINITHREAD_IDLE_SPIN;
+	c->idle_time = 0;
+	c->clock_interrupts = 0;
+	scheduler_init(&c->scheduler, id);
+	c->idle_thread = minithread_create_idle();
+	c->current_thread = c->idle_thread;
+}
+
+//Set up the root group, with a run queue on every virtual processor.
+void group_init_root(){
+	int id;
+
+	memset(&root_group, 0, sizeof(root_group));
+	root_group.weight = MINITHREAD_GROUP_WEIGHT_DEFAULT;
+	iqueue_link_init(&root_group.refill_alarm.link);
+	root_group.cpus = (group_cpu *) malloc(sizeof(group_cpu) * cpu_count);
+	AbortOnCondition(root_group.cpus == NULL, "group_init_root");
+
+	for(id = 0; id < cpu_count; id++){
+		AbortOnCondition(group_cpu_init(&root_group, id) == -1, "group_init_root");
+	}
+}
+
+/*
+ * minithread_set_cpu_count(int count)
+ *  Number of virtual processors to start, overridden by MINITHREAD_CPUS.
+ */
+void minithread_set_cpu_count(int count){
+	if(count < 1) count = 1;
+	if(count > MINITHREAD_MAX_CPUS) count = MINITHREAD_MAX_CPUS;
+	cpu_count = count;
+}
+
+int minithread_get_cpu_count(){
+	return cpu_count;
+}
+
+/*
+ * minithread_set_tickless(uint64_t quantum)
+ *  Use a tickless clock with the given quantum, overridden by MINITHREAD_TICKLESS.
+ */
+void minithread_set_tickless(uint64_t quantum){
+	clock_tickless = quantum != 0;
+	quantum_length = quantum != 0 ? quantum : MINITHREAD_CLOCK_PERIOD;
+}
+
+/*
+ * minithread_set_scheduler(const char *name)
+ *  Pick the scheduling policy by name, overridden by MINITHREAD_SCHEDULER.
+ */
+int minithread_set_scheduler(const char *name){
+	int i;
+
+	for(i = 0; policies[i] != NULL; i++){
+		if(strcmp(policies[i]->name, name) == 0){
+			policy = policies[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *minithread_scheduler_name(){
+	return policy->name;
 }
 
 /*
@@ -381,11 +1577,41 @@ clock_handler(void* arg)
  *       Fork the thread which should call mainproc(mainarg)
  *       Start scheduling.
  *
+ *       The calling host thread becomes virtual processor 0, and one more
+ *       host thread is started for every other virtual processor.
+ *
  */
 void minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
+	int i;
+	char *cpus_env;
+	char *tickless_env;
+	char *scheduler_env;
+
+	cpus_env = getenv("MINITHREAD_CPUS");
+	if(cpus_env != NULL) minithread_set_cpu_count(atoi(cpus_env));
 
-	//Allocate the scheduler's queues.
-	scheduler_init(&thread_scheduler);
+	tickless_env = getenv("MINITHREAD_TICKLESS");
+	if(tickless_env != NULL) minithread_set_tickless(strtoull(tickless_env, NULL, 10) * MICROSECOND);
+
+	scheduler_env = getenv("MINITHREAD_SCHEDULER");
+	if(scheduler_env != NULL && minithread_set_scheduler(scheduler_env) == -1){
+		fprintf(stderr, "minithread: unknown scheduler %s, using %s\n", scheduler_env, policy->name);
+	}
+
+	cache.lock = seqlock_create();
+	AbortOnCondition(cache.lock == NULL, "minithread_system_initialize");
+
+	//Allocate the virtual processors and their schedulers' queues.
+	for(i = 0; i < cpu_count; i++){
+		cpu_init(&cpus[i], i);
+	}
+	cpu_self = &cpus[0];
+	cpus[0].host_thread = pthread_self();
+	group_init_root();
+
+	iqueue_init(&finished_queue);
+	cleanup_sema = semaphore_create();
+	semaphore_initialize(cleanup_sema, 0);
 
 	//Fork the thread containing the main function.
 	minithread_fork(mainproc, mainarg);
@@ -394,19 +1620,29 @@ void minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
 	minithread_fork(&vaccum_cleaner, NULL);
 
 	//Initialize alarm system for allowing threads to sleep.
-	initialize_alarm_system(MINITHREAD_CLOCK_PERIOD, &current_tick);
+	initialize_alarm_system();
 
 	//Initialize clock system for preemption.
-	minithread_clock_init(MINITHREAD_CLOCK_PERIOD, clock_handler);
+	if(clock_tickless){
+		minithread_clock_init_tickless(clock_handler);
+	} else {
+		minithread_clock_init(MINITHREAD_CLOCK_PERIOD, clock_handler);
+	}
 
 	//Initialize network system for remote communication.
 	minisocket_initialize();
 	network_initialize(minisocket_dropoff_packet);
 
+	//Bring up the other virtual processors, which start out idle.
+	for(i = 1; i < cpu_count; i++){
+		AbortOnCondition(pthread_create(&cpus[i].host_thread, NULL, cpu_boot, &cpus[i]),
+			"pthread_create");
+	}
+
 	set_interrupt_level(ENABLED);
 
-	//Start concurrency.
-	scheduler_switch(thread_scheduler);
+	//Start concurrency. This host thread becomes the idle context of processor 0.
+	minithread_idle(NULL);
 }
 
 /*
@@ -424,17 +1660,21 @@ void semaphore_V_wrapper(void *semaphore_ptr) {
         semaphore_V(semaphore);
 }
 
+/*
+ * The sleeping thread arms the alarm embedded in its own TCB and blocks with
+ * interrupts still disabled, so the alarm cannot fire before it has stopped
+ * and no allocation is needed.
+ */
 void 
 minithread_sleep_with_timeout(int delay)
 {
-	semaphore_t sleep_sema = semaphore_create();
-
-    semaphore_initialize(sleep_sema, 0);
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	minithread_t self = this_cpu->current_thread;
 
-	register_alarm(delay, semaphore_V_wrapper, sleep_sema);
-	semaphore_P(sleep_sema);
+	register_alarm_embedded(&self->sleep_alarm, delay, wrapper_minithread_start, self);
+	minithread_block(MINITHREAD_BLOCK_SLEEP);
 
-	semaphore_destroy(sleep_sema);
+	set_interrupt_level(old_level);
 }
 
 
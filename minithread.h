@@ -15,6 +15,15 @@
 
 #define MINITHREAD_CLOCK_PERIOD 100*MILLISECOND
 
+/* Upper bound on the number of virtual processors (host threads). */
+#define MINITHREAD_MAX_CPUS 64
+
+/*
+ * Longest time an idle virtual processor polls for work before it halts.
+ * The actual window adapts between 0 and this; 0 disables polling.
+ */
+#define MINITHREAD_IDLE_SPIN 50*MICROSECOND
+
 
 /*
  * struct minithread:
@@ -43,6 +52,19 @@ extern minithread_t minithread_fork(proc_t proc, arg_t arg);
 extern minithread_t minithread_create(proc_t proc, arg_t arg);
 
 
+/*
+ * minithread_t
+ * minithread_fork_with_stack(proc_t proc, arg_t arg, size_t stack_size)
+ * minithread_create_with_stack(proc_t proc, arg_t arg, size_t stack_size)
+ *  Like minithread_fork and minithread_create, with a hint for the size of
+ *  the thread's stack (0 for MINITHREAD_STACK_SIZE). Stack memory is only
+ *  committed as the thread touches it, so the size is a bound rather than a
+ *  cost. Returns NULL if the stack cannot be reserved.
+ */
+extern minithread_t minithread_fork_with_stack(proc_t proc, arg_t arg, size_t stack_size);
+extern minithread_t minithread_create_with_stack(proc_t proc, arg_t arg, size_t stack_size);
+
+
 
 /*
  * minithread_t minithread_self():
@@ -59,9 +81,18 @@ extern minithread_t minithread_self();
 extern int minithread_id();
 
 
+/*
+ * int minithread_cpu_id():
+ *      Return the virtual processor the caller is running on, for debugging.
+ */
+extern int minithread_cpu_id();
+
+
 /*
  * minithread_stop()
- *  Block the calling thread.
+ *  Block the calling thread. May be called with interrupts disabled, in
+ *  which case blocking is atomic with respect to the caller's critical
+ *  section; the caller's interrupt level is restored when it resumes.
  */
 extern void minithread_stop();
 
@@ -78,6 +109,105 @@ extern void minithread_start(minithread_t t);
  */
 extern void minithread_yield();
 
+/*
+ * int minithread_yield_to(minithread_t t)
+ *  Switch directly to t, which must be runnable, handing it the rest of
+ *  the caller's time slice, and put the caller back on the ready queue.
+ *  Returns 0 once the caller runs again, or -1 if t was not runnable (it
+ *  is running, blocked or its group is out of quota), without yielding.
+ */
+extern int minithread_yield_to(minithread_t t);
+
+/*
+ * Thread priorities. Threads start at MINITHREAD_PRIORITY_NORMAL and are
+ * scheduled by the multilevel feedback queue. A thread with a priority
+ * above that, up to MINITHREAD_PRIORITY_MAX, is always run before the
+ * threads of lower priority (round robin among equals), and preempts them
+ * at the next clock interrupt.
+ *
+ * int minithread_set_priority(minithread_t t, int priority)
+ *  Set the priority of t. A thread owning a semaphore (see
+ *  semaphore_initialize_mutex) can run at a higher priority than its own
+ *  while higher priority threads wait on it. Returns 0 (success) or -1 if
+ *  the priority is out of range.
+ *
+ * int minithread_get_priority(minithread_t t)
+ *  Return the priority of t, not counting what it inherited.
+ */
+#define MINITHREAD_PRIORITY_NORMAL 0
+#define MINITHREAD_PRIORITY_MAX 8
+
+extern int minithread_set_priority(minithread_t t, int priority);
+extern int minithread_get_priority(minithread_t t);
+
+/*
+ * Thread groups. Groups form a tree under the root group, and every thread
+ * belongs to one; a thread created by minithread_fork or minithread_create
+ * starts in the group of the thread that created it. The processors are
+ * shared between the subgroups of a group, and its own threads taken
+ * together, in proportion to their weights, whatever the number of threads
+ * in each; the scheduling policy then picks among the threads of a group.
+ * Threads with a priority above MINITHREAD_PRIORITY_NORMAL run regardless
+ * of their group.
+ *
+ * A group can be capped to a quota of processor time, for itself and its
+ * subgroups, per period: once its threads have run for quota nanoseconds
+ * in a period, across all processors, they are held back until the next
+ * one. A quota larger than the period allows for more than one processor.
+ * Time is charged at every context switch and clock interrupt, so a group
+ * can overrun its quota by up to a quantum; the overrun is taken off the
+ * next period.
+ *
+ * minithread_group_t minithread_group_root()
+ *  The root group, which cannot be capped or destroyed.
+ *
+ * minithread_group_t minithread_group_create(minithread_group_t parent, int weight)
+ *  Create an empty group under parent (the root group if NULL), with a
+ *  weight from 1 to MINITHREAD_GROUP_WEIGHT_MAX. Returns NULL on failure.
+ *  Only call after minithread_system_initialize.
+ *
+ * int minithread_group_destroy(minithread_group_t group)
+ *  Free a group without threads or subgroups. Returns 0 (success) or -1.
+ *
+ * int minithread_group_set_weight(minithread_group_t group, int weight)
+ *  Change the weight of a group. Returns 0 (success) or -1.
+ *
+ * int minithread_group_set_cap(minithread_group_t group, uint64_t quota, uint64_t period)
+ *  Cap a group to quota nanoseconds per period nanoseconds, starting a new
+ *  period now. A quota of 0 lifts the cap. Returns 0 (success) or -1.
+ *
+ * int minithread_group_join(minithread_group_t group, minithread_t t)
+ *  Move t to group. Returns 0 (success) or -1.
+ *
+ * minithread_group_t minithread_group_of(minithread_t t)
+ *  The group t belongs to.
+ *
+ * void minithread_group_get_stats(minithread_group_t group, minithread_group_stats_t *stats)
+ *  Copy the statistics of a group: the processor time used by its threads
+ *  and those of its subgroups, how long and how many times it was held
+ *  back by its cap, and the number of its own threads.
+ */
+#define MINITHREAD_GROUP_WEIGHT_DEFAULT 100
+#define MINITHREAD_GROUP_WEIGHT_MAX 10000
+
+typedef struct minithread_group *minithread_group_t;
+
+typedef struct minithread_group_stats {
+	uint64_t run_time;
+	uint64_t throttled_time;
+	unsigned long throttles;
+	int threads;
+} minithread_group_stats_t;
+
+extern minithread_group_t minithread_group_root();
+extern minithread_group_t minithread_group_create(minithread_group_t parent, int weight);
+extern int minithread_group_destroy(minithread_group_t group);
+extern int minithread_group_set_weight(minithread_group_t group, int weight);
+extern int minithread_group_set_cap(minithread_group_t group, uint64_t quota, uint64_t period);
+extern int minithread_group_join(minithread_group_t group, minithread_t t);
+extern minithread_group_t minithread_group_of(minithread_t t);
+extern void minithread_group_get_stats(minithread_group_t group, minithread_group_stats_t *stats);
+
 /*
  * minithread_system_initialize(proc_t mainproc, arg_t mainarg)
  *  Initialize the system to run the first minithread at
@@ -87,6 +217,165 @@ extern void minithread_yield();
  */
 extern void minithread_system_initialize(proc_t mainproc, arg_t mainarg);
 
+/*
+ * minithread_set_cpu_count(int count)
+ *  Set the number of virtual processors (host threads running minithreads)
+ *  that minithread_system_initialize starts. Defaults to 1. Must be called
+ *  before minithread_system_initialize; the MINITHREAD_CPUS environment
+ *  variable takes precedence. Idle processors steal work from busy ones.
+ *
+ *  More than one processor is experimental, and slower for most programs.
+ *  Kernel state (run queues, scheduler, semaphores, alarms, network
+ *  handlers) is all protected by one lock, taken with interrupts disabled,
+ *  so processors never run kernel code in parallel, and they contend for
+ *  that lock on every switch. Only threads that spend most of their time
+ *  outside the kernel can go faster. Several processors are meant for
+ *  testing preemption and migration, not for throughput: programs that
+ *  synchronize a lot, like sieve, get slower with every processor added.
+ *  Keep the default of 1 unless that is what you want.
+ */
+extern void minithread_set_cpu_count(int count);
+
+/*
+ * int minithread_get_cpu_count()
+ *  The number of virtual processors.
+ */
+extern int minithread_get_cpu_count();
+
+/*
+ * minithread_set_tickless(uint64_t quantum)
+ *  Run with a tickless clock and a quantum of the given length, in
+ *  nanoseconds (0 goes back to the periodic clock). A tickless clock
+ *  only interrupts a virtual processor when its quantum ends or an alarm is
+ *  due, so sleeps and alarms get microsecond resolution and idle processors
+ *  take no interrupts. Call before minithread_system_initialize; the
+ *  MINITHREAD_TICKLESS environment variable, a quantum in microseconds,
+ *  takes precedence.
+ */
+extern void minithread_set_tickless(uint64_t quantum);
+
+/*
+ * int minithread_set_scheduler(const char *name)
+ *  Choose the policy that schedules the threads of normal priority:
+ *  "mlfq", a multilevel feedback queue (the default), "stride" or
+ *  "lottery", which share the processors in proportion to the threads'
+ *  tickets, deterministically or at random, "fifo", first come first
+ *  served without time slices, or "cfs", which charges threads the
+ *  processor time they actually use, in nanoseconds, weighted by their
+ *  tickets, and runs the one charged the least. With a tickless clock, a
+ *  thread that wakes up under "cfs" preempts the running one right away if
+ *  that one has had more than its share. Call before minithread_system_initialize;
+ *  the MINITHREAD_SCHEDULER environment variable takes precedence.
+ *  Returns 0 (success) or -1 if there is no such policy.
+ *
+ * const char *minithread_scheduler_name()
+ *  The name of the policy in use.
+ */
+extern int minithread_set_scheduler(const char *name);
+extern const char *minithread_scheduler_name();
+
+/*
+ * int minithread_set_tickets(minithread_t t, int tickets)
+ *  Set the share of processor time t gets under the proportional share
+ *  policies and "cfs", from 1 to MINITHREAD_TICKETS_MAX. Threads start with
+ *  MINITHREAD_TICKETS_DEFAULT. Returns 0 (success) or -1 if the number is
+ *  out of range.
+ *
+ * int minithread_get_tickets(minithread_t t)
+ *  Return the tickets of t.
+ */
+#define MINITHREAD_TICKETS_DEFAULT 100
+#define MINITHREAD_TICKETS_MAX 10000
+
+extern int minithread_set_tickets(minithread_t t, int tickets);
+extern int minithread_get_tickets(minithread_t t);
+
+/*
+ * uint64_t minithread_cpu_idle_time(int cpu)
+ *  Nanoseconds virtual processor cpu has spent idle, polling or halted,
+ *  since it started. Returns 0 for a processor that does not exist.
+ */
+extern uint64_t minithread_cpu_idle_time(int cpu);
+
+/*
+ * unsigned long minithread_cpu_clock_interrupts(int cpu)
+ *  How many clock interrupts virtual processor cpu has taken since it
+ *  started. With a tickless clock, an idle processor takes none. Returns 0
+ *  for a processor that does not exist.
+ */
+extern unsigned long minithread_cpu_clock_interrupts(int cpu);
+
+
+/*
+ * Thread cache statistics. Finished threads are kept, stack included, and
+ * reused by minithread_create: a hit needs no allocation at all. Threads
+ * trimmed from the cache are counted in frees. stack_high_water is the most
+ * stack any finished thread has used, in bytes (page granularity), to help
+ * pick stack sizes.
+ */
+typedef struct minithread_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long frees;
+	int cached;
+	size_t stack_high_water;
+} minithread_cache_stats_t;
+
+/*
+ * minithread_get_cache_stats(minithread_cache_stats_t *stats)
+ *  Copy the current thread cache statistics into stats.
+ */
+extern void minithread_get_cache_stats(minithread_cache_stats_t *stats);
+
+/*
+ * Per-thread scheduling statistics, kept by the scheduler at every context
+ * switch. Times are in nanoseconds. A switch is voluntary when the thread
+ * yields or blocks, and involuntary when its quantum expires. level_runs
+ * counts how many times the thread was run at each ready queue level.
+ */
+#define MINITHREAD_STATS_LEVELS 8
+
+typedef enum {
+	MINITHREAD_BLOCK_NONE,
+	MINITHREAD_BLOCK_SEMAPHORE,
+	MINITHREAD_BLOCK_SLEEP,
+	MINITHREAD_BLOCK_FUTURE,
+	MINITHREAD_BLOCK_MUTEX,
+	MINITHREAD_BLOCK_COND,
+	MINITHREAD_BLOCK_RWLOCK,
+	MINITHREAD_BLOCK_CHANNEL,
+	MINITHREAD_BLOCK_BARRIER,
+	MINITHREAD_BLOCK_LATCH,
+	MINITHREAD_BLOCK_WAITSET,
+	MINITHREAD_BLOCK_OTHER,
+	MINITHREAD_BLOCK_REASONS
+} minithread_block_reason_t;
+
+typedef struct minithread_stats {
+	uint64_t run_time;
+	uint64_t ready_time;
+	uint64_t blocked_time;
+	unsigned long voluntary_switches;
+	unsigned long involuntary_switches;
+	unsigned long level_runs[MINITHREAD_STATS_LEVELS];
+	unsigned long blocks[MINITHREAD_BLOCK_REASONS];
+	minithread_block_reason_t last_block_reason;
+	int level;
+} minithread_stats_t;
+
+/*
+ * minithread_get_stats(minithread_t t, minithread_stats_t *stats)
+ *  Copy the scheduling statistics of t into stats. The run time of a
+ *  running thread is counted up to its last context switch.
+ */
+extern void minithread_get_stats(minithread_t t, minithread_stats_t *stats);
+
+/*
+ * size_t minithread_stack_usage(minithread_t t)
+ *  Bytes of stack t has touched so far (page granularity).
+ */
+extern size_t minithread_stack_usage(minithread_t t);
+
 
 /*
  * minithread_sleep_with_timeout(int delay)
@@ -0,0 +1,335 @@
+/*
+ * Worker pools.
+ *
+ */
+#include <stdlib.h>
+
+#include "alarm.h"
+#include "interrupts.h"
+#include "machineprimitives.h"
+#include "minithread_pool.h"
+#include "synch.h"
+
+/*
+	The state of a pool is protected by disabling interrupts. Workers block
+	on the work semaphore, which gets a V for every task queued and for
+	every worker to let go: a worker that finds the queue empty after its P
+	returns. retiring counts the V's of the second kind not taken yet.
+
+	idle_low is the fewest workers found idle, with nothing for them to
+	take, since the trim alarm last went off. If it is still above zero when
+	the alarm goes off again, that many workers have had nothing to do for
+	the whole time, and as many as the minimum allows are let go.
+*/
+
+typedef struct pool_task {
+	proc_t 		proc;
+	arg_t 		arg;
+	uint64_t 	submitted;
+} pool_task;
+
+typedef struct minithread_pool {
+	pool_task 	*tasks;			// ring buffer of capacity tasks
+	int 		capacity;
+	int 		head;
+	int 		length;
+
+	int 		min_workers;
+	int 		max_workers;
+	int 		workers;
+	int 		idle;
+	int 		idle_low;
+	int 		retiring;
+	int 		submitters;		// blocked on space
+	int 		shutdown;
+
+	semaphore_t work;
+	semaphore_t space;
+	semaphore_t exited;
+	struct alarm trim_alarm;
+
+	minithread_pool_stats_t stats;
+} minithread_pool;
+
+static int pool_worker(arg_t arg);
+
+//Idle workers with nothing queued for them.
+static int pool_spare(minithread_pool_t pool){
+	return pool->idle - pool->length - pool->retiring;
+}
+
+//Let up to count workers go. Must be called with interrupts disabled.
+static void pool_retire(minithread_pool_t pool, int count){
+	while(count-- > 0){
+		pool->retiring++;
+		semaphore_V(pool->work);
+	}
+}
+
+//Alarm handler letting go the workers that had nothing to do since the last time.
+static void pool_trim(void *arg){
+	minithread_pool_t pool = (minithread_pool_t) arg;
+	int excess = pool->workers - pool->retiring - pool->min_workers;
+
+	if(pool->idle_low < excess) excess = pool->idle_low;
+	if(pool_spare(pool) < excess) excess = pool_spare(pool);
+	pool_retire(pool, excess);
+
+	pool->idle_low = pool_spare(pool);
+	if(pool->workers - pool->retiring > pool->min_workers){
+		register_alarm_embedded(&pool->trim_alarm, MINITHREAD_POOL_IDLE_TIMEOUT, pool_trim, pool);
+	}
+}
+
+/*
+* Count count more workers, to be forked with pool_fork, and start watching
+* for idle ones. Must be called with interrupts disabled.
+*/
+static void pool_add_workers(minithread_pool_t pool, int count){
+	pool->workers += count;
+	if(pool->workers > pool->min_workers && !iqueue_linked(&pool->trim_alarm.link)){
+		pool->idle_low = pool_spare(pool);
+		register_alarm_embedded(&pool->trim_alarm, MINITHREAD_POOL_IDLE_TIMEOUT, pool_trim, pool);
+	}
+}
+
+//Fork count workers already counted by pool_add_workers.
+static void pool_fork(minithread_pool_t pool, int count){
+	interrupt_level_t old_level;
+
+	while(count-- > 0){
+		if(minithread_fork(pool_worker, (arg_t) pool) == NULL){
+			old_level = set_interrupt_level(DISABLED);
+			pool->workers--;
+			set_interrupt_level(old_level);
+		}
+	}
+}
+
+static int pool_worker(arg_t arg){
+	minithread_pool_t pool = (minithread_pool_t) arg;
+	interrupt_level_t old_level;
+	pool_task task;
+	uint64_t start, wait;
+
+	while(1){
+		old_level = set_interrupt_level(DISABLED);
+		pool->idle++;
+		set_interrupt_level(old_level);
+
+		semaphore_P(pool->work);
+
+		old_level = set_interrupt_level(DISABLED);
+		pool->idle--;
+
+		if(pool->length == 0){
+			if(pool->retiring > 0) pool->retiring--;
+			pool->workers--;
+			if(pool->shutdown) semaphore_V(pool->exited);
+			set_interrupt_level(old_level);
+			return 0;
+		}
+
+		task = pool->tasks[pool->head];
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->length--;
+		if(pool_spare(pool) < pool->idle_low) pool->idle_low = pool_spare(pool);
+		if(pool->submitters > 0){
+			pool->submitters--;
+			semaphore_V(pool->space);
+		}
+
+		start = currentTimeNanos();
+		wait = start - task.submitted;
+		pool->stats.wait_time += wait;
+		if(wait > pool->stats.max_wait_time) pool->stats.max_wait_time = wait;
+		set_interrupt_level(old_level);
+
+		task.proc(task.arg);
+
+		old_level = set_interrupt_level(DISABLED);
+		pool->stats.completed++;
+		pool->stats.run_time += currentTimeNanos() - start;
+		set_interrupt_level(old_level);
+	}
+}
+
+/*
+* Queue a task, blocking for room if block is set. Returns 0 (success) or -1
+* if the queue is full and block is not set, or the pool is being destroyed.
+*/
+static int pool_submit(minithread_pool_t pool, proc_t proc, arg_t arg, int block){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	pool_task *task;
+	int fork = 0;
+
+	while(pool->length == pool->capacity && !pool->shutdown){
+		if(!block){
+			pool->stats.rejected++;
+			set_interrupt_level(old_level);
+			return -1;
+		}
+		pool->submitters++;
+		set_interrupt_level(old_level);
+		semaphore_P(pool->space);
+		old_level = set_interrupt_level(DISABLED);
+	}
+
+	if(pool->shutdown){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+
+	task = &pool->tasks[(pool->head + pool->length) % pool->capacity];
+	task->proc = proc;
+	task->arg = arg;
+	task->submitted = currentTimeNanos();
+	pool->length++;
+	pool->stats.submitted++;
+	if(pool->length > pool->stats.max_queued) pool->stats.max_queued = pool->length;
+
+	//No worker free to take it: fork one if the maximum allows.
+	if(pool_spare(pool) < 0 && pool->workers - pool->retiring < pool->max_workers){
+		pool_add_workers(pool, 1);
+		fork = 1;
+	}
+	semaphore_V(pool->work);
+
+	set_interrupt_level(old_level);
+
+	pool_fork(pool, fork);
+	return 0;
+}
+
+minithread_pool_t minithread_pool_create(int min_workers, int max_workers, int capacity){
+	minithread_pool_t pool;
+	interrupt_level_t old_level;
+
+	if(min_workers < 0 || max_workers < 1 || min_workers > max_workers || capacity < 1) return NULL;
+
+	pool = (minithread_pool_t) malloc(sizeof(minithread_pool));
+	if(pool == NULL) return NULL;
+
+	pool->tasks = (pool_task *) malloc(sizeof(pool_task) * capacity);
+	if(pool->tasks == NULL){
+		free(pool);
+		return NULL;
+	}
+	pool->capacity = capacity;
+	pool->head = 0;
+	pool->length = 0;
+
+	pool->min_workers = min_workers;
+	pool->max_workers = max_workers;
+	pool->workers = 0;
+	pool->idle = 0;
+	pool->idle_low = 0;
+	pool->retiring = 0;
+	pool->submitters = 0;
+	pool->shutdown = 0;
+
+	pool->work = semaphore_create();
+	semaphore_initialize(pool->work, 0);
+	pool->space = semaphore_create();
+	semaphore_initialize(pool->space, 0);
+	pool->exited = semaphore_create();
+	semaphore_initialize(pool->exited, 0);
+	iqueue_link_init(&pool->trim_alarm.link);
+
+	pool->stats.max_queued = 0;
+	pool->stats.submitted = 0;
+	pool->stats.completed = 0;
+	pool->stats.rejected = 0;
+	pool->stats.wait_time = 0;
+	pool->stats.max_wait_time = 0;
+	pool->stats.run_time = 0;
+
+	old_level = set_interrupt_level(DISABLED);
+	pool_add_workers(pool, min_workers);
+	set_interrupt_level(old_level);
+	pool_fork(pool, min_workers);
+
+	return pool;
+}
+
+void minithread_pool_destroy(minithread_pool_t pool){
+	interrupt_level_t old_level;
+	int workers;
+
+	if(pool == NULL) return;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	pool->shutdown = 1;
+	deregister_alarm(&pool->trim_alarm);
+	while(pool->submitters > 0){
+		pool->submitters--;
+		semaphore_V(pool->space);
+	}
+
+	//Every worker takes one V after the queue is drained.
+	workers = pool->workers;
+	pool_retire(pool, pool->workers - pool->retiring);
+
+	set_interrupt_level(old_level);
+
+	while(workers-- > 0){
+		semaphore_P(pool->exited);
+	}
+
+	semaphore_destroy(pool->work);
+	semaphore_destroy(pool->space);
+	semaphore_destroy(pool->exited);
+	free(pool->tasks);
+	free(pool);
+}
+
+int minithread_pool_submit(minithread_pool_t pool, proc_t proc, arg_t arg){
+	return pool_submit(pool, proc, arg, 1);
+}
+
+int minithread_pool_try_submit(minithread_pool_t pool, proc_t proc, arg_t arg){
+	return pool_submit(pool, proc, arg, 0);
+}
+
+int minithread_pool_resize(minithread_pool_t pool, int min_workers, int max_workers){
+	interrupt_level_t old_level;
+	int workers;
+	int fork = 0;
+
+	if(min_workers < 0 || max_workers < 1 || min_workers > max_workers) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+
+	if(pool->shutdown){
+		set_interrupt_level(old_level);
+		return -1;
+	}
+
+	pool->min_workers = min_workers;
+	pool->max_workers = max_workers;
+
+	workers = pool->workers - pool->retiring;
+	if(workers > max_workers){
+		pool_retire(pool, workers - max_workers);
+	} else if(workers < min_workers){
+		fork = min_workers - workers;
+		pool_add_workers(pool, fork);
+	}
+
+	set_interrupt_level(old_level);
+
+	pool_fork(pool, fork);
+	return 0;
+}
+
+void minithread_pool_get_stats(minithread_pool_t pool, minithread_pool_stats_t *stats){
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+
+	*stats = pool->stats;
+	stats->workers = pool->workers;
+	stats->idle = pool->idle;
+	stats->queued = pool->length;
+
+	set_interrupt_level(old_level);
+}
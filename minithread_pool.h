@@ -0,0 +1,88 @@
+#ifndef __MINITHREAD_POOL_H__
+#define __MINITHREAD_POOL_H__
+/*
+ * minithread_pool.h:
+ *  Worker pools. A pool runs tasks, a procedure and its argument, on a set
+ *  of long-lived worker threads instead of a thread each: submitting a task
+ *  only queues it, and a worker that is done with one task takes the next.
+ *
+ *  Tasks wait in a queue of bounded capacity, in submission order. The pool
+ *  keeps between min_workers and max_workers threads: it forks another one
+ *  when a task is queued and no worker is free to take it, and lets workers
+ *  go when some have been idle for a whole MINITHREAD_POOL_IDLE_TIMEOUT.
+ *  Workers are created in the group of the thread that forks them (see
+ *  minithread_group_join).
+ *
+ *  Call these after minithread_system_initialize.
+ */
+#include <stdint.h>
+
+#include "minithread.h"
+
+/* How long, in milliseconds, workers beyond the minimum may stay idle. */
+#define MINITHREAD_POOL_IDLE_TIMEOUT 1000
+
+typedef struct minithread_pool *minithread_pool_t;
+
+/*
+ * Statistics of a pool. Times are in nanoseconds; the wait time of a task
+ * is the time from its submission to a worker starting it.
+ */
+typedef struct minithread_pool_stats {
+	int workers;			/* worker threads */
+	int idle;				/* workers waiting for a task */
+	int queued;				/* tasks waiting for a worker */
+	int max_queued;			/* the most tasks ever waiting */
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long rejected;	/* by minithread_pool_try_submit, queue full */
+	uint64_t wait_time;		/* of all the tasks started */
+	uint64_t max_wait_time;
+	uint64_t run_time;		/* of all the tasks completed */
+} minithread_pool_stats_t;
+
+/*
+ * minithread_pool_t minithread_pool_create(int min_workers, int max_workers, int capacity)
+ *  Create a pool of min_workers to max_workers threads, forking min_workers
+ *  of them now, with room for capacity queued tasks. Returns NULL on
+ *  failure.
+ */
+extern minithread_pool_t minithread_pool_create(int min_workers, int max_workers, int capacity);
+
+/*
+ * void minithread_pool_destroy(minithread_pool_t pool)
+ *  Run the tasks still queued, wait for the workers to finish and free the
+ *  pool. Submissions blocked on a full queue fail.
+ */
+extern void minithread_pool_destroy(minithread_pool_t pool);
+
+/*
+ * int minithread_pool_submit(minithread_pool_t pool, proc_t proc, arg_t arg)
+ *  Queue proc(arg) to run on one of the workers, blocking while the queue
+ *  is full. The return value of proc is ignored. Returns 0 (success) or -1
+ *  if the pool is being destroyed.
+ */
+extern int minithread_pool_submit(minithread_pool_t pool, proc_t proc, arg_t arg);
+
+/*
+ * int minithread_pool_try_submit(minithread_pool_t pool, proc_t proc, arg_t arg)
+ *  Like minithread_pool_submit, but fail with -1 rather than block when
+ *  the queue is full.
+ */
+extern int minithread_pool_try_submit(minithread_pool_t pool, proc_t proc, arg_t arg);
+
+/*
+ * int minithread_pool_resize(minithread_pool_t pool, int min_workers, int max_workers)
+ *  Change the bounds on the number of workers, forking or letting workers
+ *  go right away to bring it within them. Workers busy with a task finish
+ *  it first. Returns 0 (success) or -1.
+ */
+extern int minithread_pool_resize(minithread_pool_t pool, int min_workers, int max_workers);
+
+/*
+ * void minithread_pool_get_stats(minithread_pool_t pool, minithread_pool_stats_t *stats)
+ *  Copy the statistics of the pool into stats.
+ */
+extern void minithread_pool_get_stats(minithread_pool_t pool, minithread_pool_stats_t *stats);
+
+#endif /*__MINITHREAD_POOL_H__*/
@@ -0,0 +1,118 @@
+/*
+ * minithread_private.h:
+ *  The thread control block, shared by the parts of the kernel that queue
+ *  threads (the scheduler, semaphores). Clients of the thread package only
+ *  see minithread_t.
+ */
+#ifndef __MINITHREAD_PRIVATE_H__
+#define __MINITHREAD_PRIVATE_H__
+
+#include "minithread.h"
+#include "intrusive_queue.h"
+#include "rbtree.h"
+#include "alarm.h"
+
+typedef enum {READY, WAITING, RUNNING, FINISHED} state_t;
+
+struct scheduler;
+struct semaphore;
+
+/*
+ * A thread is on at most one queue at a time (a ready queue, a semaphore's
+ * waiting queue or the finished queue), through queue_link. Blocking and
+ * waking up a thread never allocates.
+ *
+ * effective_priority is the thread's own priority, raised to that of the
+ * threads waiting on the semaphores it owns (owned_semaphores). blocked_on
+ * is the semaphore it waits on, and queued_on the scheduler whose ready
+ * queue it is on.
+ *
+ * The rest is for the scheduling policies: queued_level is the MLFQ level,
+ * tickets the share of the proportional share policies, and vtime the
+ * virtual time they keep, which was last advanced when run_time was
+ * vtime_charged. A policy that keeps its threads in a tree links them
+ * through run_node instead of queue_link. group is the thread group whose
+ * run queues it goes on.
+ *
+ * task_worker is set on the threads of the task runtime (minitask.c) to the
+ * worker they are.
+ */
+typedef struct minithread {
+	int pid;
+	stack_pointer_t sp;
+	stack_pointer_t stackbase;
+	stack_pointer_t stacktop;
+	size_t stacksize;
+	state_t state;
+	iqueue_link queue_link;
+	struct alarm sleep_alarm;
+	struct minithread *cache_next;
+	minithread_stats_t stats;
+	uint64_t ready_since;
+	uint64_t running_since;
+	uint64_t blocked_since;
+	int priority;
+	int effective_priority;
+	iqueue owned_semaphores;
+	struct semaphore *blocked_on;
+	struct scheduler *queued_on;
+	int queued_level;
+	int tickets;
+	uint64_t vtime;
+	uint64_t vtime_charged;
+	rbtree_node run_node;
+	struct minithread_group *group;
+	struct minitask_worker *task_worker;
+} minithread;
+
+/*
+ * The thread a queue_link belongs to.
+ */
+#define minithread_of(link) iqueue_entry(link, minithread, queue_link)
+
+/*
+ * minithread_block(minithread_block_reason_t reason)
+ *  minithread_stop, recording why the thread blocked in its statistics.
+ */
+extern void minithread_block(minithread_block_reason_t reason);
+
+/*
+ * minithread_start_all(iqueue_t threads)
+ *  minithread_start every thread queued on threads through its queue_link,
+ *  in order, emptying the queue, as one batch: waking up all the waiters
+ *  of a barrier, say, costs one critical section rather than one each.
+ */
+extern void minithread_start_all(iqueue_t threads);
+
+/*
+ * minithread_set_effective_priority(minithread_t t, int priority)
+ *  Change the priority t runs at, without changing its own, and move it
+ *  to the matching ready queue level if it is runnable. Call with
+ *  interrupts disabled.
+ */
+extern void minithread_set_effective_priority(minithread_t t, int priority);
+
+/*
+ * minithread_alarm_clock_request(uint64_t deadline)
+ *  minithread_clock_request for a new earliest alarm, due at deadline. The
+ *  calling processor's clock goes off for it, and that processor goes on
+ *  keeping its clock for the next alarm when it is idle, so that the other
+ *  idle processors need not. Call with interrupts disabled.
+ */
+extern void minithread_alarm_clock_request(uint64_t deadline);
+
+/*
+ * Priority inheritance, implemented in synch.c. Call with interrupts
+ * disabled.
+ *
+ * semaphore_donated_priority(t) is the highest effective priority of the
+ * threads waiting on the semaphores t owns.
+ *
+ * semaphore_priority_changed(t) moves t, whose effective priority changed,
+ * to its new place in the waiting queue of the semaphore it is blocked on,
+ * and lends its priority on to the owner.
+ */
+extern int semaphore_donated_priority(minithread_t t);
+extern void semaphore_priority_changed(minithread_t t);
+
+#endif /*__MINITHREAD_PRIVATE_H__*/
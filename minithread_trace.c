@@ -0,0 +1,136 @@
+/*
+ * Context switch tracing.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "interrupts.h"
+#include "minithread.h"
+#include "minithread_trace.h"
+
+// The ring buffer is shared by all virtual processors. It is only written
+// by the scheduler, which holds the kernel lock, so it needs no locking of
+// its own and events come out in the order the switches happened.
+typedef struct trace_ring {
+	trace_event *events;
+	int capacity;
+	int next;			// where the next event goes
+	int count;			// number of valid events, up to capacity
+	volatile int enabled;
+} trace_ring;
+
+static trace_ring ring;
+
+static const char *reason_names[] = {"preempt", "yield", "block", "exit"};
+
+void
+trace_switch(int cpu, int from, int to, int level, trace_reason_t reason, uint64_t ts) {
+	trace_event *e;
+
+	if (!ring.enabled) return;
+
+	e = &ring.events[ring.next];
+	e->ts = ts;
+	e->cpu = cpu;
+	e->from = from;
+	e->to = to;
+	e->level = level;
+	e->reason = reason;
+
+	if (++ring.next == ring.capacity) ring.next = 0;
+	if (ring.count < ring.capacity) ring.count++;
+}
+
+int
+minithread_trace_start(int capacity) {
+	trace_event *events;
+	trace_event *old_events;
+	interrupt_level_t old_level;
+
+	if (capacity < 1) return -1;
+
+	events = (trace_event *) malloc(sizeof(trace_event) * capacity);
+	if (events == NULL) return -1;
+
+	old_level = set_interrupt_level(DISABLED);
+	old_events = ring.events;
+	ring.events = events;
+	ring.capacity = capacity;
+	ring.next = 0;
+	ring.count = 0;
+	ring.enabled = 1;
+	set_interrupt_level(old_level);
+
+	free(old_events);
+	return 0;
+}
+
+void
+minithread_trace_stop() {
+	interrupt_level_t old_level = set_interrupt_level(DISABLED);
+	ring.enabled = 0;
+	set_interrupt_level(old_level);
+}
+
+/*
+ * Every event ends the slice the previous event on the same processor
+ * started, so a slice is written out when the event that ends it is seen.
+ * Slices of the idle context are left out, which shows up as a gap.
+ */
+int
+minithread_trace_dump(const char *path) {
+	FILE *out;
+	int was_enabled;
+	int i;
+	int first = 1;
+	uint64_t origin;
+	int last[MINITHREAD_MAX_CPUS];
+	interrupt_level_t old_level;
+
+	out = fopen(path, "w");
+	if (out == NULL) return -1;
+
+	// Nothing is recorded while the buffer is written out.
+	old_level = set_interrupt_level(DISABLED);
+	was_enabled = ring.enabled;
+	ring.enabled = 0;
+	set_interrupt_level(old_level);
+
+	for (i = 0; i < MINITHREAD_MAX_CPUS; i++) last[i] = -1;
+
+	fprintf(out, "{\"traceEvents\":[\n");
+
+	origin = ring.count > 0 ?
+		ring.events[(ring.next - ring.count + ring.capacity) % ring.capacity].ts : 0;
+
+	for (i = 0; i < ring.count; i++) {
+		int index = (ring.next - ring.count + i + ring.capacity) % ring.capacity;
+		trace_event *e = &ring.events[index];
+		trace_event *start;
+
+		if (last[e->cpu] == -1) {
+			fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+				"\"args\":{\"name\":\"cpu %d\"}}", first ? "" : ",\n", e->cpu, e->cpu);
+			first = 0;
+		} else {
+			start = &ring.events[last[e->cpu]];
+			if (start->to != -1) {
+				fprintf(out, ",\n{\"name\":\"thread %d\",\"cat\":\"run\",\"ph\":\"X\","
+					"\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+					"\"args\":{\"level\":%d,\"end\":\"%s\"}}",
+					start->to, (start->ts - origin) / 1000.0, (e->ts - start->ts) / 1000.0,
+					e->cpu, start->level, reason_names[e->reason]);
+			}
+		}
+		last[e->cpu] = index;
+	}
+
+	fprintf(out, "\n]}\n");
+
+	old_level = set_interrupt_level(DISABLED);
+	if (was_enabled && ring.events != NULL) ring.enabled = 1;
+	set_interrupt_level(old_level);
+
+	return fclose(out) == 0 ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+/*
+ * minithread_trace.h:
+ *  Context switch tracing. While tracing is on, every context switch is
+ *  recorded in a ring buffer, which can be written out in the Chrome trace
+ *  event format (chrome://tracing, Perfetto) to look at a workload as a
+ *  timeline: one row per virtual processor, one slice per thread run.
+ */
+#ifndef __MINITHREAD_TRACE_H__
+#define __MINITHREAD_TRACE_H__
+
+#include <stdint.h>
+
+/* Why a thread stopped running. */
+typedef enum {
+	TRACE_PREEMPT,		/* its quantum expired */
+	TRACE_YIELD,		/* it yielded */
+	TRACE_BLOCK,		/* it blocked */
+	TRACE_EXIT			/* it finished */
+} trace_reason_t;
+
+/*
+ * A context switch on virtual processor cpu, from thread from to thread to
+ * (thread ids, -1 for the idle context), at time ts (currentTimeNanos()).
+ * level is the ready queue level to runs at.
+ */
+typedef struct trace_event {
+	uint64_t ts;
+	int cpu;
+	int from;
+	int to;
+	short level;
+	short reason;
+} trace_event;
+
+/*
+ * int minithread_trace_start(int capacity)
+ *  Start recording context switches into a ring buffer of capacity
+ *  events, dropping the oldest ones once it is full. Any previous trace is
+ *  discarded. Returns 0 (success) or -1 (failure).
+ *
+ * void minithread_trace_stop()
+ *  Stop recording. The recorded events are kept until the next start.
+ */
+extern int minithread_trace_start(int capacity);
+extern void minithread_trace_stop();
+
+/*
+ * int minithread_trace_dump(const char *path)
+ *  Write the recorded events to path as Chrome trace JSON. Tracing is
+ *  paused while the buffer is written out. Returns 0 (success) or -1
+ *  (failure).
+ */
+extern int minithread_trace_dump(const char *path);
+
+/*
+ * void trace_switch(int cpu, int from, int to, int level, trace_reason_t reason, uint64_t ts)
+ *  Record a context switch, if tracing is on. Called by the scheduler with
+ *  interrupts disabled.
+ */
+extern void trace_switch(int cpu, int from, int to, int level, trace_reason_t reason, uint64_t ts);
+
+#endif /*__MINITHREAD_TRACE_H__*/
@@ -5,11 +5,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
 typedef struct multilevel_queue {
-	// Each element of queue_array is a queue. The ith-element
-	// is the queue at level i. When the array is full,  
-	queue_t *queue_array;
+	// Each element of queue_array is an intrusive queue. The ith-element
+	// is the queue at level i. The levels are allocated along with the
+	// multilevel queue, so nothing is allocated after multilevel_queue_new.
+	iqueue *queue_array;
 	int number_of_levels;
+	// Bit i of the bitmap is set when level i is non-empty, so the next
+	// non-empty level is found with a find-first-set per word instead of
+	// probing every level.
+	unsigned long *nonempty;
+	int number_of_words;
+	int length;
 } multilevel_queue;
 
 /*
@@ -19,82 +28,150 @@ typedef struct multilevel_queue {
 multilevel_queue_t multilevel_queue_new(int number_of_levels)
 {
 	multilevel_queue_t new_multilevel_queue;
-	queue_t *new_queue_array;
+	iqueue *new_queue_array;
+	unsigned long *new_nonempty;
+	int number_of_words;
         int i;
 
 	if (number_of_levels < 1) return NULL;
+
+	number_of_words = (number_of_levels + BITS_PER_WORD - 1) / BITS_PER_WORD;
 	
 	new_multilevel_queue = (multilevel_queue_t) malloc(sizeof(multilevel_queue));
-	new_queue_array = (queue_t *)malloc(sizeof(queue_t) * number_of_levels);
+	new_queue_array = (iqueue *)malloc(sizeof(iqueue) * number_of_levels);
+	new_nonempty = (unsigned long *)calloc(number_of_words, sizeof(unsigned long));
+	if (new_multilevel_queue == NULL || new_queue_array == NULL || new_nonempty == NULL) {
+		free(new_multilevel_queue);
+		free(new_queue_array);
+		free(new_nonempty);
+		return NULL;
+	}
         for (i = 0; i < number_of_levels; i++) {
-            new_queue_array[i] = queue_new();
+            iqueue_init(&new_queue_array[i]);
         }
 	new_multilevel_queue->queue_array = new_queue_array;
 	new_multilevel_queue->number_of_levels = number_of_levels;
+	new_multilevel_queue->nonempty = new_nonempty;
+	new_multilevel_queue->number_of_words = number_of_words;
+	new_multilevel_queue->length = 0;
 	return new_multilevel_queue;
 }
 
 /*
- * Appends an void* to the multilevel queue at the specified level. Return 0 (success) or -1 (failure).
+ * Appends a link to the multilevel queue at the specified level. Return 0 (success) or -1 (failure).
  */
-int multilevel_queue_enqueue(multilevel_queue_t queue, int level, void* item)
+int multilevel_queue_enqueue(multilevel_queue_t queue, int level, iqueue_link_t item)
 {
 	if (queue == NULL || level < 0 || level > queue->number_of_levels - 1) return -1;
 
-	return queue_append(queue->queue_array[level], item);
+	if (iqueue_append(&queue->queue_array[level], item) == -1) return -1;
+
+	queue->nonempty[level / BITS_PER_WORD] |= 1UL << (level % BITS_PER_WORD);
+	queue->length++;
+	return 0;
+}
+
+/*
+ * Return the first non-empty level at or after level, or -1 if there is none.
+ */
+static int multilevel_queue_next_level(multilevel_queue_t queue, int level)
+{
+	int word = level / BITS_PER_WORD;
+	// Ignore the levels before level in its word.
+	unsigned long bits = queue->nonempty[word] & (~0UL << (level % BITS_PER_WORD));
+
+	while (bits == 0) {
+		if (++word == queue->number_of_words) return -1;
+		bits = queue->nonempty[word];
+	}
+
+	return word * BITS_PER_WORD + __builtin_ctzl(bits);
 }
 
 /*
- * Dequeue and return the first void* from the multilevel queue starting at the specified level. 
+ * Dequeue and return the first link from the multilevel queue starting at the specified level. 
  * Levels wrap around so as long as there is something in the multilevel queue an item should be returned.
  * Return the level that the item was located on and that item if the multilevel queue is nonempty,
  * or -1 (failure) and NULL if queue is empty.
  */
-int multilevel_queue_dequeue(multilevel_queue_t queue, int level, void** item)
+int multilevel_queue_dequeue(multilevel_queue_t queue, int level, iqueue_link_t *item)
 {
-	int found_item;
 	int current_level;
 
+	*item = NULL;
 	if (queue == NULL || level < 0 || level > queue->number_of_levels - 1) return -1;
 
-	found_item = 0;
-	current_level = level;
-	*item = NULL;
-	while (!found_item && current_level < queue->number_of_levels) {
-		// queue_dequeue returns -1 on error and 0 on success. So found_item
-		// will be 0 (false) if the item was not found and 1 (true) if it was.
-		found_item = 1 + queue_dequeue(queue->queue_array[current_level], item);
-		if (!found_item) {current_level++;}
+	current_level = multilevel_queue_next_level(queue, level);
+	if (current_level == -1) return -1;
+
+	iqueue_dequeue(&queue->queue_array[current_level], item);
+	if (iqueue_length(&queue->queue_array[current_level]) == 0) {
+		queue->nonempty[current_level / BITS_PER_WORD] &= ~(1UL << (current_level % BITS_PER_WORD));
 	}
+	queue->length--;
+
+	return current_level;
+}
+
+/*
+ * Remove a link from the specified level, where it must be queued. Return 0 (success) or -1 (failure).
+ */
+int multilevel_queue_delete(multilevel_queue_t queue, int level, iqueue_link_t item)
+{
+	if (queue == NULL || level < 0 || level > queue->number_of_levels - 1) return -1;
+
+	if (iqueue_delete(&queue->queue_array[level], item) == -1) return -1;
 
-        if (found_item) {return current_level;}
-        else {return -1;}
+	if (iqueue_length(&queue->queue_array[level]) == 0) {
+		queue->nonempty[level / BITS_PER_WORD] &= ~(1UL << (level % BITS_PER_WORD));
+	}
+	queue->length--;
+	return 0;
+}
+
+/*
+ * Return the number of items at the specified level, or -1 if an error occured.
+ */
+int multilevel_queue_level_length(multilevel_queue_t queue, int level)
+{
+	if (queue == NULL || level < 0 || level > queue->number_of_levels - 1) return -1;
+
+	return iqueue_length(&queue->queue_array[level]);
+}
+
+/*
+ * Return the number of items at all levels, or -1 if an error occured.
+ */
+int multilevel_queue_length(multilevel_queue_t queue)
+{
+	if (queue == NULL) return -1;
+
+	return queue->length;
+}
+
+/*
+ * Return the number of levels, or -1 if an error occured.
+ */
+int multilevel_queue_levels(multilevel_queue_t queue)
+{
+	if (queue == NULL) return -1;
+
+	return queue->number_of_levels;
 }
 
 /* 
- * Free the queue and return 0 (success) or -1 (failure). Do not free the queue nodes; this is
+ * Free the queue and return 0 (success) or -1 (failure). The queued objects are not freed; this is
  * the responsibility of the programmer.
  */
 int multilevel_queue_free(multilevel_queue_t queue)
 {
-	int i;
-	int error_occurred;
-	int exit_code;
-
 	if (queue == NULL) return -1;
 
-	error_occurred = 0;
-	for (i = 0; i < queue->number_of_levels; i++) {
-		exit_code = queue_free(queue->queue_array[i]);
-		if (exit_code == -1) error_occurred = 1;
-	}
         free(queue->queue_array);
+	free(queue->nonempty);
 	free(queue);
 
-	// error_occurred is a boolean, so 1 indicates an error and 0 indicates a
-	// clean execution. error_occurred * -1 will thus return -1 on error and 0
-	// on success
-	return error_occurred * -1;		
+	return 0;
 }
 
 
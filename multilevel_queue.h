@@ -4,12 +4,17 @@
 #ifndef __MULTILEVEL_QUEUE_H__
 #define __MULTILEVEL_QUEUE_H__
 
-#include "queue.h"
+#include "intrusive_queue.h"
 
 /*
  * multilevel_queue_t is a pointer to an internally maintained data structure.
  * Clients of this package do not need to know how the queues are
  * represented. They see and manipulate only multilevel_queue_t's. 
+ *
+ * Every level is an intrusive queue: items are the links embedded in the
+ * queued objects, so enqueueing and dequeueing never allocate. Non-empty
+ * levels are tracked in a bitmap, so both take the same time whatever the
+ * number of levels.
  */
 typedef struct multilevel_queue* multilevel_queue_t;
 
@@ -19,20 +24,40 @@ typedef struct multilevel_queue* multilevel_queue_t;
 extern multilevel_queue_t multilevel_queue_new(int number_of_levels);
 
 /*
- * Appends an void* to the multilevel queue at the specified level. Return 0 (success) or -1 (failure).
+ * Appends a link to the multilevel queue at the specified level. Return 0 (success) or -1 (failure).
  */
-extern int multilevel_queue_enqueue(multilevel_queue_t queue, int level, void* item);
+extern int multilevel_queue_enqueue(multilevel_queue_t queue, int level, iqueue_link_t item);
 
 /*
- * Dequeue and return the first void* from the multilevel queue starting at the specified level. 
+ * Dequeue and return the first link from the multilevel queue starting at the specified level. 
  * Levels wrap around so as long as there is something in the multilevel queue an item should be returned.
  * Return the level that the item was located on and that item if the multilevel queue is nonempty,
  * or -1 (failure) and NULL if queue is empty.
  */
-extern int multilevel_queue_dequeue(multilevel_queue_t queue, int level, void** item);
+extern int multilevel_queue_dequeue(multilevel_queue_t queue, int level, iqueue_link_t *item);
+
+/*
+ * Remove a link from the specified level, where it must be queued. Return 0 (success) or -1 (failure).
+ */
+extern int multilevel_queue_delete(multilevel_queue_t queue, int level, iqueue_link_t item);
+
+/*
+ * Return the number of items at the specified level, or -1 if an error occured.
+ */
+extern int multilevel_queue_level_length(multilevel_queue_t queue, int level);
+
+/*
+ * Return the number of items at all levels, or -1 if an error occured.
+ */
+extern int multilevel_queue_length(multilevel_queue_t queue);
+
+/*
+ * Return the number of levels, or -1 if an error occured.
+ */
+extern int multilevel_queue_levels(multilevel_queue_t queue);
 
 /* 
- * Free the queue and return 0 (success) or -1 (failure). Do not free the queue nodes; this is
+ * Free the queue and return 0 (success) or -1 (failure). The queued objects are not freed; this is
  * the responsibility of the programmer.
  */
 extern int multilevel_queue_free(multilevel_queue_t queue);
@@ -0,0 +1,199 @@
+/* network test program 7
+
+   local loopback test: watches unbound ports and a connected minisocket in
+   wait sets, on the same machine.
+
+   An unbound port watched level-triggered is reported while messages wait
+   on it, one watched edge-triggered once per message, and a destroyed port
+   not at all. The network handler only delivers minisocket packets, so the
+   messages to the ports are handed to minimsg_dropoff_message here, as a
+   handler delivering datagrams would. Then a client connects to a server
+   in the same process: the server's socket is reported once the client
+   sends, and again once the client closes the connection.
+
+   USAGE: ./network7 <port>
+
+   where <port> is the UDP port to use
+*/
+
+#include "minithread.h"
+#include "minimsg.h"
+#include "miniheader.h"
+#include "minisocket.h"
+#include "synch.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define BUFFER_SIZE 256
+#define SOCKET_PORT 80
+#define PATIENCE 5000   /* ms to wait for a message to come back */
+
+
+char text[] = "Hello, world!\n";
+int textlen;
+
+network_address_t my_address;
+semaphore_t server_ready;
+minisocket_t server_socket;
+
+
+void
+check(int ok, char* what) {
+    if (!ok) {
+        printf("network7: FAILED: %s\n", what);
+        exit(1);
+    }
+}
+
+/* Wait for ws to report exactly the port or socket of data. */
+void
+expect_ready(waitset_t ws, void* data, char* what) {
+    void* ready[2];
+
+    check(waitset_wait(ws, ready, 2, PATIENCE) == 1 && ready[0] == data, what);
+}
+
+void
+expect_idle(waitset_t ws, char* what) {
+    void* ready[2];
+
+    check(waitset_wait(ws, ready, 2, 0) == 0, what);
+}
+
+/* Deliver text to the unbound port port_number, from the same one. */
+void
+send_to(int port_number) {
+    network_interrupt_arg_t* packet = malloc(sizeof(network_interrupt_arg_t));
+    mini_header_t header = (mini_header_t) packet->buffer;
+
+    header->protocol = PROTOCOL_MINIDATAGRAM;
+    pack_address(header->source_address, my_address);
+    pack_unsigned_short(header->source_port, port_number);
+    pack_address(header->destination_address, my_address);
+    pack_unsigned_short(header->destination_port, port_number);
+    memcpy(packet->buffer + sizeof(struct mini_header), text, textlen);
+    packet->size = sizeof(struct mini_header) + textlen;
+    network_address_copy(my_address, packet->sender);
+
+    minimsg_dropoff_message(packet);
+}
+
+void
+receive_from(miniport_t port) {
+    char buffer[BUFFER_SIZE];
+    int length = BUFFER_SIZE;
+    miniport_t from;
+
+    minimsg_receive(port, &from, buffer, &length);
+    check(length == textlen && strcmp(buffer, text) == 0, "ports: message");
+    miniport_destroy(from);
+}
+
+void
+test_ports() {
+    waitset_t ws = waitset_create();
+    miniport_t level_port = miniport_create_unbound(1);
+    miniport_t edge_port = miniport_create_unbound(2);
+    miniport_t gone_port = miniport_create_unbound(3);
+
+    check(miniport_watch(ws, level_port, WAITSET_LEVEL, level_port) == 0, "ports: watch");
+    check(miniport_watch(ws, edge_port, WAITSET_EDGE, edge_port) == 0, "ports: watch");
+    check(miniport_watch(ws, gone_port, WAITSET_LEVEL, gone_port) == 0, "ports: watch");
+    expect_idle(ws, "ports: ready before any message");
+
+    /* Level: reported until both messages are received. */
+    send_to(1);
+    send_to(1);
+    expect_ready(ws, level_port, "ports: level port after a message");
+    receive_from(level_port);
+    expect_ready(ws, level_port, "ports: level port with a message left");
+    receive_from(level_port);
+    expect_idle(ws, "ports: level port drained");
+
+    /* Edge: reported once per message, received or not. */
+    send_to(2);
+    expect_ready(ws, edge_port, "ports: edge port after a message");
+    expect_idle(ws, "ports: edge port reported twice");
+    send_to(2);
+    expect_ready(ws, edge_port, "ports: edge port after another message");
+    receive_from(edge_port);
+    receive_from(edge_port);
+
+    /* Destroyed with a message waiting: no longer reported. */
+    send_to(3);
+    expect_ready(ws, gone_port, "ports: port to destroy");
+    miniport_destroy(gone_port);
+    expect_idle(ws, "ports: destroyed port reported");
+
+    check(miniport_unwatch(ws, level_port) == 0, "ports: unwatch");
+    check(miniport_unwatch(ws, level_port) == -1, "ports: unwatched twice");
+    waitset_destroy(ws);
+    miniport_destroy(level_port);
+    miniport_destroy(edge_port);
+}
+
+int
+server(int* arg) {
+    minisocket_error error;
+
+    server_socket = minisocket_server_create(SOCKET_PORT, &error);
+    check(server_socket != NULL, "socket: server");
+    semaphore_V(server_ready);
+
+    return 0;
+}
+
+void
+test_socket() {
+    waitset_t ws = waitset_create();
+    minisocket_t client;
+    minisocket_error error;
+    char buffer[BUFFER_SIZE];
+
+    server_ready = semaphore_create();
+    semaphore_initialize(server_ready, 0);
+    minithread_fork(server, NULL);
+    client = minisocket_client_create(my_address, SOCKET_PORT, &error);
+    check(client != NULL, "socket: client");
+    semaphore_P(server_ready);
+
+    check(minisocket_watch(ws, server_socket, WAITSET_LEVEL, server_socket) == 0, "socket: watch");
+    expect_idle(ws, "socket: ready before any message");
+    check(minisocket_send(client, text, textlen, &error) == textlen, "socket: send");
+    expect_ready(ws, server_socket, "socket: after a message");
+    /* A receive returns once max_len bytes came in, so ask for what was sent. */
+    check(minisocket_receive(server_socket, buffer, textlen, &error) == textlen, "socket: receive");
+    expect_idle(ws, "socket: drained");
+
+    /* The client closing makes the server's receive return at once. */
+    minisocket_close(client);
+    expect_ready(ws, server_socket, "socket: after the close");
+
+    check(minisocket_unwatch(ws, server_socket) == 0, "socket: unwatch");
+    waitset_destroy(ws);
+}
+
+int
+thread(int* arg) {
+    network_get_my_address(my_address);
+    minimsg_initialize();
+
+    test_ports();
+    test_socket();
+    printf("network7: ok\n");
+
+    exit(0);
+}
+
+int
+main(int argc, char** argv) {
+    short fromport;
+    fromport = atoi(argv[1]);
+    network_udp_ports(fromport,fromport);
+    textlen = strlen(text) + 1;
+    minithread_system_initialize(thread, NULL);
+    return -1;
+}
@@ -0,0 +1,116 @@
+/* barriertest.c
+
+   Check barriers and latches, on 4 processors unless MINITHREAD_CPUS says
+   otherwise. Threads go through one barrier for many rounds: each round
+   has to hold every thread back until all got there, so that all see the
+   phase of the others exactly, and has exactly one wait return 1, even
+   though the first threads out start on the next round while the last
+   ones are still leaving. A latch counted down from alarm handlers lets
+   go of the threads waiting on it once it gets to 0, and stays open.
+*/
+
+#include "testing.h"
+#include "alarm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 16
+#define ROUNDS 2000
+#define COUNT 3
+#define PATIENCE 60000   /* ms for the whole test */
+
+barrier_t barrier;
+latch_t finished;
+volatile int phase[THREADS];
+volatile int last[2 * ROUNDS];
+
+int worker(int* arg) {
+  long id = (long) arg;
+  int round, i;
+
+  for (round = 0; round < ROUNDS; round++) {
+    phase[id] = round;
+    if (barrier_wait(barrier))
+      __sync_add_and_fetch(&last[2 * round], 1);
+    for (i = 0; i < THREADS; i++)
+      check(phase[i] == round, "barrier: a thread not in the round");
+    if (barrier_wait(barrier))
+      __sync_add_and_fetch(&last[2 * round + 1], 1);
+  }
+  latch_count_down(finished);
+  return 0;
+}
+
+void test_barrier() {
+  barrier_t alone = barrier_create(1);
+  long i;
+
+  check(barrier_wait(alone) == 1 && barrier_wait(alone) == 1, "barrier: one party");
+  barrier_destroy(alone);
+
+  barrier = barrier_create(THREADS);
+  finished = latch_create(THREADS);
+  for (i = 0; i < THREADS; i++)
+    minithread_fork(worker, (int*) i);
+  latch_wait(finished);
+  for (i = 0; i < 2 * ROUNDS; i++)
+    check(last[i] == 1, "barrier: one last thread per round");
+  barrier_destroy(barrier);
+  latch_destroy(finished);
+}
+
+latch_t gate;
+semaphore_t released;
+
+int gate_waiter(int* arg) {
+  latch_wait(gate);
+  semaphore_V(released);
+  return 0;
+}
+
+void count_down(void* arg) {
+  latch_count_down(gate);
+}
+
+void test_latch() {
+  int i;
+
+  gate = latch_create(COUNT);
+  released = new_semaphore(0);
+  for (i = 0; i < THREADS; i++)
+    minithread_fork(gate_waiter, NULL);
+
+  for (i = 1; i < COUNT; i++)
+    register_alarm(10 * i, count_down, NULL);
+  minithread_sleep_with_timeout(10 * COUNT + 100);
+  check(latch_count(gate) == 1, "latch: counted down from alarms");
+  check(semaphore_P_timeout(released, 0) == 1, "latch: released while closed");
+
+  register_alarm(10, count_down, NULL);
+  for (i = 0; i < THREADS; i++)
+    semaphore_P(released);
+  check(latch_count(gate) == 0, "latch: open");
+
+  /* Open for good: no waiting, and counting down does nothing. */
+  latch_count_down(gate);
+  check(latch_count(gate) == 0, "latch: counted down past 0");
+  latch_wait(gate);
+  latch_destroy(gate);
+}
+
+int test(int* arg) {
+  start_watchdog(PATIENCE);
+
+  test_barrier();
+  test_latch();
+
+  printf("barriertest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(4);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,137 @@
+/* cachetest.c
+
+   Check the thread cache. A thread forked once the last one finished
+   takes its place, stack included, without allocating; stacks of another
+   size class do not, but are kept in their own class, and stacks too big
+   for any class are freed; a burst of threads finishing together is
+   trimmed back down; and the deepest stack a finished thread used is
+   reported, while a deep thread reusing a stack whose pages were given
+   back still runs.
+*/
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REUSES 1000
+#define BURST 200
+#define HIGH_WATERMARK 64            /* THREAD_CACHE_HIGH_WATERMARK in minithread.c */
+#define OTHER_CLASS (64 * 1024)
+#define UNCACHED (128 * 1024 * 1024)
+#define DEEP (96 * 1024)
+
+minithread_cache_stats_t stats() {
+  minithread_cache_stats_t s;
+
+  minithread_get_cache_stats(&s);
+  return s;
+}
+
+semaphore_t done;
+semaphore_t gate;
+
+int quick(int* arg) {
+  semaphore_V(done);
+  return 0;
+}
+
+int gated(int* arg) {
+  semaphore_P(gate);
+  semaphore_V(done);
+  return 0;
+}
+
+/* Use DEEP bytes of stack, and check they hold what was written. */
+int deep(int* arg) {
+  char buffer[DEEP];
+  int i;
+
+  memset(buffer, (long) arg, sizeof(buffer));
+  for (i = 0; i < DEEP; i += 4096)
+    check(buffer[i] == (char) (long) arg, "deep: stack");
+  semaphore_V(done);
+  return 0;
+}
+
+/*
+ * Wait for the threads finishing after before was taken, all but the
+ * hits, which came out of the cache, to have been cached or freed.
+ */
+void wait_cached(minithread_cache_stats_t before, int threads) {
+  unsigned long hits = stats().hits - before.hits;
+
+  WAIT_FOR(stats().cached + stats().frees >= before.cached + before.frees + threads - hits,
+           "finished threads not cached");
+}
+
+/* Fork proc on a stack of size bytes and wait for it to be cached or freed. */
+void run(proc_t proc, arg_t arg, size_t size) {
+  minithread_cache_stats_t before = stats();
+
+  check(minithread_fork_with_stack(proc, arg, size) != NULL, "fork");
+  semaphore_P(done);
+  wait_cached(before, 1);
+}
+
+int test(int* arg) {
+  minithread_cache_stats_t s, before;
+  int i;
+
+  done = new_semaphore(0);
+  gate = new_semaphore(0);
+
+  /* One in the cache, then every fork takes the thread the last one left. */
+  run(quick, NULL, 0);
+  before = stats();
+  for (i = 0; i < REUSES; i++)
+    run(quick, NULL, 0);
+  s = stats();
+  check(s.hits - before.hits == REUSES, "reuse: forks missed the cache");
+  check(s.misses == before.misses, "reuse: forks allocated");
+  check(s.cached == before.cached, "reuse: cache grew");
+
+  /* Another size class has its own threads. */
+  before = stats();
+  run(quick, NULL, OTHER_CLASS);
+  check(stats().misses == before.misses + 1, "classes: took a stack of another size");
+  run(quick, NULL, OTHER_CLASS);
+  check(stats().hits == before.hits + 1, "classes: class not reused");
+
+  /* Too big for any class. */
+  before = stats();
+  run(quick, NULL, UNCACHED);
+  s = stats();
+  check(s.frees == before.frees + 1 && s.cached == before.cached, "uncached: kept");
+
+  /* A burst, all finishing at once, is trimmed. */
+  before = stats();
+  for (i = 0; i < BURST; i++)
+    minithread_fork(gated, NULL);
+  for (i = 0; i < BURST; i++)
+    semaphore_V(gate);
+  for (i = 0; i < BURST; i++)
+    semaphore_P(done);
+  wait_cached(before, BURST);
+  s = stats();
+  check(s.frees > before.frees, "burst: not trimmed");
+  /* The one thread of the other class aside. */
+  check(s.cached <= HIGH_WATERMARK + 1, "burst: cache over its high watermark");
+
+  /* Deep stacks: measured, and reused after their pages were given back. */
+  run(deep, (int*) 1, 0);
+  check(stats().stack_high_water >= DEEP, "deep: stack high water");
+  for (i = 2; i < 10; i++)
+    run(deep, (int*) (long) i, 0);
+
+  s = stats();
+  printf("cachetest: ok, %lu hits, %lu misses, %lu frees, %d cached, %lu KB high water\n",
+         s.hits, s.misses, s.frees, s.cached, (unsigned long) (s.stack_high_water / 1024));
+  exit(0);
+}
+
+int main(void) {
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,116 @@
+/* cfstest.c
+
+   Check the "cfs" policy on one processor (run it without MINITHREAD_CPUS)
+   with a 2 ms tickless quantum. Spinning threads with the same tickets get
+   the same processor time, within a tenth, even if one of them started
+   late; threads with 100, 200 and 300 tickets get it in proportion 1:2:3.
+   Run time is read with minithread_get_stats.
+*/
+
+#include "testing.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 4
+#define FAIR_TIME 800                 /* ms */
+#define LATE 100                      /* ms */
+#define WEIGHTED_TIME 1200            /* ms */
+
+semaphore_t done;
+
+volatile int stop;
+
+int spinner(int* arg) {
+  volatile long x = 0;
+
+  while (!stop)
+    x++;
+  semaphore_V(done);
+  return 0;
+}
+
+uint64_t run_time(minithread_t t) {
+  minithread_stats_t stats;
+
+  minithread_get_stats(t, &stats);
+  return stats.run_time;
+}
+
+/* Equal tickets, one thread forked LATE ms after the others. */
+void test_fair() {
+  minithread_t threads[THREADS];
+  uint64_t least = ~0ULL, most = 0, time;
+  int i;
+
+  stop = 0;
+  for (i = 0; i < THREADS - 1; i++)
+    threads[i] = minithread_fork(spinner, NULL);
+  minithread_sleep_with_timeout(LATE);
+  threads[THREADS - 1] = minithread_fork(spinner, NULL);
+  minithread_sleep_with_timeout(FAIR_TIME);
+  stop = 1;
+  join(done, THREADS, "fair: spinners hung");
+
+  /* The late one could not have caught up on its first LATE ms. */
+  for (i = 0; i < THREADS - 1; i++) {
+    time = run_time(threads[i]);
+    if (time < least)
+      least = time;
+    if (time > most)
+      most = time;
+  }
+  time = run_time(threads[THREADS - 1]);
+  printf("cfstest: %d threads ran %.0f to %.0f ms, the late one %.0f ms\n", THREADS - 1,
+         least / 1e6, most / 1e6, time / 1e6);
+  check(most - least < most / 10, "fair: equal threads ran unequal times");
+  check(time > FAIR_TIME * (uint64_t) MILLISECOND / THREADS * 9 / 10, "fair: late thread starved");
+  check(time < most, "fair: late thread claimed the time it was not there");
+}
+
+void test_weighted() {
+  minithread_t threads[3];
+  uint64_t time[3], total = 0;
+  int i;
+
+  stop = 0;
+  for (i = 0; i < 3; i++) {
+    threads[i] = minithread_fork(spinner, NULL);
+    check(minithread_set_tickets(threads[i], (i + 1) * MINITHREAD_TICKETS_DEFAULT) == 0,
+          "weighted: set_tickets");
+  }
+  minithread_sleep_with_timeout(WEIGHTED_TIME);
+  stop = 1;
+  join(done, 3, "weighted: spinners hung");
+
+  for (i = 0; i < 3; i++) {
+    time[i] = run_time(threads[i]);
+    total += time[i];
+  }
+  printf("cfstest: 100, 200 and 300 tickets ran %.0f, %.0f and %.0f ms\n", time[0] / 1e6,
+         time[1] / 1e6, time[2] / 1e6);
+  for (i = 0; i < 3; i++) {
+    double share = (double) time[i] / total;
+    double expected = (i + 1) / 6.0;
+
+    check(share > expected * 0.85 && share < expected * 1.15, "weighted: run time does not follow tickets");
+  }
+}
+
+int test(int* arg) {
+  done = new_semaphore(0);
+
+  test_fair();
+  test_weighted();
+
+  printf("cfstest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_tickless(2 * MILLISECOND);
+  check(minithread_set_scheduler("cfs") == 0, "no cfs policy");
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,364 @@
+/* channeltest.c
+
+   Check the channels, then time them. A rendezvous channel only moves an
+   item when a sender meets a receiver; a receive from a full buffer moves
+   the item of a waiting sender into the slot it frees; a select takes its
+   waiters off the channels of the cases it did not do; and closing a
+   channel wakes the threads waiting to send to it and to receive from it.
+
+   Then two producers and two consumers move items through a channel of 16
+   slots, a rendezvous channel, and the ring buffer of three semaphores of
+   buffer.c, for comparison. Run it with a single processor (the default).
+*/
+
+#include "testing.h"
+#include "channel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SELECT_CHANNELS 10
+#define ITEMS 200000
+#define RING 16
+
+#define ITEM(n) ((void*) (intptr_t) (n))
+
+semaphore_t done;
+
+/* Let the other threads run until they block. */
+void settle() {
+  int i;
+
+  for (i = 0; i < 10; i++)
+    minithread_yield();
+}
+
+/* A thread waiting in a single send or receive, with its result. */
+typedef struct waiter {
+  channel_t channel;
+  void* item;
+  int status;
+  volatile int finished;
+} waiter;
+
+int sender(int* arg) {
+  waiter* w = (waiter*) arg;
+
+  w->status = channel_send(w->channel, w->item);
+  w->finished = 1;
+  semaphore_V(done);
+  return 0;
+}
+
+int receiver(int* arg) {
+  waiter* w = (waiter*) arg;
+
+  w->status = channel_recv(w->channel, &w->item);
+  w->finished = 1;
+  semaphore_V(done);
+  return 0;
+}
+
+void test_rendezvous() {
+  channel_t ch = channel_create(0);
+  waiter w;
+  void* item;
+
+  check(channel_try_send(ch, ITEM(1)) == 1, "rendezvous: send without a receiver");
+  check(channel_try_recv(ch, &item) == 1, "rendezvous: receive without a sender");
+
+  /* A receiver waiting takes the item straight away. */
+  w.channel = ch;
+  w.finished = 0;
+  minithread_fork(receiver, (int*) &w);
+  settle();
+  check(!w.finished, "rendezvous: receiver did not wait");
+  check(channel_try_send(ch, ITEM(2)) == 0, "rendezvous: send to a waiting receiver");
+  semaphore_P(done);
+  check(w.status == 0 && w.item == ITEM(2), "rendezvous: receiver got the item");
+
+  /* And a sender waiting hands its item over. */
+  w.item = ITEM(3);
+  w.finished = 0;
+  minithread_fork(sender, (int*) &w);
+  settle();
+  check(!w.finished, "rendezvous: sender did not wait");
+  check(channel_try_recv(ch, &item) == 0 && item == ITEM(3), "rendezvous: receive from a waiting sender");
+  semaphore_P(done);
+  check(w.status == 0, "rendezvous: sender succeeded");
+
+  channel_destroy(ch);
+}
+
+void test_full_buffer() {
+  channel_t ch = channel_create(2);
+  waiter w;
+  void* item;
+
+  check(channel_try_send(ch, ITEM(1)) == 0 && channel_try_send(ch, ITEM(2)) == 0, "full buffer: fill");
+  w.channel = ch;
+  w.item = ITEM(3);
+  w.finished = 0;
+  minithread_fork(sender, (int*) &w);
+  settle();
+  check(!w.finished, "full buffer: sender did not wait");
+
+  /* The item of the sender fills the slot freed before the sender runs. */
+  check(channel_try_recv(ch, &item) == 0 && item == ITEM(1), "full buffer: first item");
+  check(channel_try_send(ch, ITEM(4)) == 1, "full buffer: sender's item was not moved in");
+  semaphore_P(done);
+  check(w.status == 0, "full buffer: sender succeeded");
+  check(channel_try_recv(ch, &item) == 0 && item == ITEM(2), "full buffer: second item");
+  check(channel_try_recv(ch, &item) == 0 && item == ITEM(3), "full buffer: sender's item");
+  check(channel_try_recv(ch, &item) == 1, "full buffer: empty");
+
+  channel_destroy(ch);
+}
+
+channel_t select_channels[SELECT_CHANNELS];
+semaphore_t next_round;
+int select_count;
+int select_index;
+void* select_item;
+void* recv_item;
+
+/* Select over all the channels, then receive from the next one: a waiter
+   left behind on it by the select would take the item instead. */
+int selector(int* arg) {
+  channel_case_t cases[SELECT_CHANNELS];
+  int round;
+  int i;
+
+  for (round = 0; round < select_count; round++) {
+    semaphore_P(next_round);
+    for (i = 0; i < select_count; i++) {
+      cases[i].channel = select_channels[i];
+      cases[i].op = CHANNEL_RECV;
+    }
+    select_index = channel_select(cases, select_count, 1);
+    select_item = cases[select_index].item;
+    channel_recv(select_channels[(round + 1) % select_count], &recv_item);
+    semaphore_V(done);
+  }
+
+  return 0;
+}
+
+void test_select(int count) {
+  int round;
+  int i;
+
+  select_count = count;
+  for (i = 0; i < count; i++)
+    select_channels[i] = channel_create(0);
+
+  minithread_fork(selector, NULL);
+  for (round = 0; round < count; round++) {
+    semaphore_V(next_round);
+    while (channel_try_send(select_channels[round], ITEM(round)) == 1)
+      minithread_yield();
+    while (channel_try_send(select_channels[(round + 1) % count], ITEM(100 + round)) == 1)
+      minithread_yield();
+    semaphore_P(done);
+    check(select_index == round && select_item == ITEM(round), "select: case done");
+    check(recv_item == ITEM(100 + round), "select: waiters taken off the other channels");
+    for (i = 0; i < count; i++)
+      check(channel_try_send(select_channels[i], ITEM(-1)) == 1, "select: no receiver left waiting");
+  }
+
+  for (i = 0; i < count; i++)
+    channel_destroy(select_channels[i]);
+}
+
+channel_t empty;
+channel_t full;
+int closed_index;
+int closed_status;
+
+int close_selector(int* arg) {
+  channel_case_t cases[2];
+
+  cases[0].channel = empty;
+  cases[0].op = CHANNEL_RECV;
+  cases[1].channel = full;
+  cases[1].op = CHANNEL_SEND;
+  cases[1].item = ITEM(-1);
+  closed_index = channel_select(cases, 2, 1);
+  closed_status = cases[closed_index].status;
+  semaphore_V(done);
+  return 0;
+}
+
+void test_close() {
+  waiter r, s;
+  void* item;
+
+  empty = channel_create(0);
+  full = channel_create(1);
+  check(channel_try_send(full, ITEM(1)) == 0, "close: fill");
+
+  r.channel = empty;
+  r.finished = 0;
+  s.channel = full;
+  s.item = ITEM(2);
+  s.finished = 0;
+  minithread_fork(receiver, (int*) &r);
+  minithread_fork(sender, (int*) &s);
+  minithread_fork(close_selector, NULL);
+  settle();
+  check(!r.finished && !s.finished, "close: threads did not wait");
+
+  /* Closing the empty channel wakes its receivers, the selector too. */
+  check(channel_close(empty) == 0, "close: empty");
+  semaphore_P(done);
+  semaphore_P(done);
+  check(r.finished && r.status == -1 && r.item == NULL, "close: receiver woken");
+  check(closed_index == 0 && closed_status == -1, "close: selector woken");
+  check(!s.finished, "close: sender still waits");
+
+  /* Closing the full one wakes its sender, and leaves its item. */
+  check(channel_close(full) == 0, "close: full");
+  semaphore_P(done);
+  check(s.status == -1, "close: sender woken");
+  check(channel_recv(full, &item) == 0 && item == ITEM(1), "close: item left");
+  check(channel_recv(full, &item) == -1, "close: closed and empty");
+  check(channel_send(full, ITEM(3)) == -1, "close: send");
+  check(channel_close(full) == -1, "close: twice");
+
+  channel_destroy(empty);
+  channel_destroy(full);
+}
+
+void report(char* what, uint64_t start) {
+  uint64_t elapsed = currentTimeNanos() - start;
+
+  printf("%-10s %d items in %.1f ms: %.1f ns per item\n", what, 2 * ITEMS,
+         elapsed / 1e6, (double) elapsed / (2 * ITEMS));
+}
+
+long sum;
+
+int producer(int* arg) {
+  channel_t ch = (channel_t) arg;
+  long i;
+
+  for (i = 1; i <= ITEMS; i++)
+    channel_send(ch, ITEM(i));
+  semaphore_V(done);
+  return 0;
+}
+
+/* Consumers on different processors add up their own items first. */
+int consumer(int* arg) {
+  channel_t ch = (channel_t) arg;
+  void* item;
+  long received = 0;
+
+  while (channel_recv(ch, &item) == 0)
+    received += (intptr_t) item;
+  __sync_fetch_and_add(&sum, received);
+  semaphore_V(done);
+  return 0;
+}
+
+void bench_channel(char* what, int capacity) {
+  channel_t ch = channel_create(capacity);
+  uint64_t start;
+
+  sum = 0;
+  start = currentTimeNanos();
+  minithread_fork(producer, (int*) ch);
+  minithread_fork(producer, (int*) ch);
+  minithread_fork(consumer, (int*) ch);
+  minithread_fork(consumer, (int*) ch);
+  semaphore_P(done);
+  semaphore_P(done);
+  channel_close(ch);
+  semaphore_P(done);
+  semaphore_P(done);
+  report(what, start);
+  check(sum == (long) ITEMS * (ITEMS + 1), "bench: every item received once");
+
+  channel_destroy(ch);
+}
+
+long ring[RING];
+int ring_in;
+int ring_out;
+semaphore_t space;
+semaphore_t items;
+semaphore_t mutex;
+
+int ring_producer(int* arg) {
+  long i;
+
+  for (i = 1; i <= ITEMS; i++) {
+    semaphore_P(space);
+    semaphore_P(mutex);
+    ring[ring_in] = i;
+    ring_in = (ring_in + 1) % RING;
+    semaphore_V(mutex);
+    semaphore_V(items);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+int ring_consumer(int* arg) {
+  long i;
+
+  for (i = 1; i <= ITEMS; i++) {
+    semaphore_P(items);
+    semaphore_P(mutex);
+    sum += ring[ring_out];
+    ring_out = (ring_out + 1) % RING;
+    semaphore_V(mutex);
+    semaphore_V(space);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void bench_semaphores() {
+  uint64_t start;
+  int i;
+
+  space = new_semaphore(RING);
+  items = new_semaphore(0);
+  mutex = new_semaphore(1);
+
+  sum = 0;
+  start = currentTimeNanos();
+  minithread_fork(ring_producer, NULL);
+  minithread_fork(ring_producer, NULL);
+  minithread_fork(ring_consumer, NULL);
+  minithread_fork(ring_consumer, NULL);
+  for (i = 0; i < 4; i++)
+    semaphore_P(done);
+  report("semaphores", start);
+  check(sum == (long) ITEMS * (ITEMS + 1), "bench: every item received once");
+}
+
+int test(int* arg) {
+  done = new_semaphore(0);
+  next_round = new_semaphore(0);
+
+  test_rendezvous();
+  test_full_buffer();
+  test_select(3);
+  test_select(SELECT_CHANNELS);
+  test_close();
+  printf("channeltest: ok\n");
+
+  bench_channel("channel", RING);
+  bench_channel("rendezvous", 0);
+  bench_semaphores();
+
+  exit(0);
+}
+
+int main(void) {
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,199 @@
+/* cotest.c
+
+   Check coroutines, on 2 processors unless MINITHREAD_CPUS says otherwise,
+   with 2 dispatchers. Many coroutines wait on signals of their own which
+   several threads post at once, and every post has to let exactly one
+   wait go on; a post made before the wait is kept for it; a post to a
+   signal many coroutines wait on lets only one of them go on, while the
+   others keep running; and a coroutine sleeping with CO_SLEEP goes on no
+   sooner than asked, and not much later.
+*/
+
+#include "testing.h"
+#include "coroutine.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define COROUTINES 20000
+#define WAITS 5
+#define POSTERS 4
+#define SHARED 10
+#define SLEEPERS 100
+
+semaphore_t done;
+semaphore_t posted;
+
+/* Signals posted from threads. */
+typedef struct waiter {
+  cosignal_t sig;
+  int step;
+  int woken;
+} waiter;
+
+waiter waiters[COROUTINES];
+
+int wait_posts(coroutine_t co, void* arg) {
+  waiter* w = (waiter*) arg;
+
+  CO_BEGIN(co);
+  for (w->step = 0; w->step < WAITS; w->step++) {
+    CO_WAIT_SIGNAL(co, w->sig);
+    w->woken++;
+  }
+  semaphore_V(done);
+  CO_END(co);
+}
+
+int poster(int* arg) {
+  long first = (long) arg;
+  int round;
+  long i;
+
+  /* Each poster takes every POSTERS-th signal, and they all overlap. With
+     the posts made before, the even coroutines get all they wait for. */
+  for (round = 0; round < WAITS - 1; round++) {
+    for (i = first; i < COROUTINES; i += POSTERS)
+      cosignal_post(waiters[i].sig);
+    minithread_yield();
+  }
+  semaphore_V(posted);
+  return 0;
+}
+
+void test_posts() {
+  uint64_t start;
+  long i, woken;
+
+  for (i = 0; i < COROUTINES; i++) {
+    waiters[i].sig = cosignal_create();
+    /* Half of them get their first post before they wait. */
+    if (i % 2 == 0)
+      cosignal_post(waiters[i].sig);
+    check(coroutine_spawn(wait_posts, &waiters[i]) != NULL, "spawn");
+  }
+  for (i = 0; i < POSTERS; i++)
+    minithread_fork(poster, (int*) i);
+  join(posted, POSTERS, "posters");
+
+  /* The even ones had all their posts, the odd ones are one short. */
+  join(done, COROUTINES / 2, "coroutines waiting on posts");
+  start = currentTimeNanos();
+  do {
+    check_waiting(start, "coroutines waiting on posts");
+    minithread_yield();
+    for (woken = 0, i = 1; i < COROUTINES; i += 2)
+      woken += waiters[i].woken;
+  } while (woken < (WAITS - 1) * (COROUTINES / 2));
+  for (i = 0; i < COROUTINES; i++)
+    check(waiters[i].woken == (i % 2 == 0 ? WAITS : WAITS - 1), "one wait per post");
+  for (i = 1; i < COROUTINES; i += 2)
+    cosignal_post(waiters[i].sig);
+  join(done, COROUTINES / 2, "coroutines waiting on posts");
+  for (i = 0; i < COROUTINES; i++) {
+    check(waiters[i].woken == WAITS, "one wait per post");
+    cosignal_destroy(waiters[i].sig);
+  }
+}
+
+/* One signal for many coroutines. */
+cosignal_t shared;
+volatile int shared_woken;
+volatile int spins;
+
+int wait_shared(coroutine_t co, void* arg) {
+  CO_BEGIN(co);
+  CO_WAIT_SIGNAL(co, shared);
+  __sync_add_and_fetch(&shared_woken, 1);
+  semaphore_V(done);
+  CO_END(co);
+}
+
+int spin(coroutine_t co, void* arg) {
+  CO_BEGIN(co);
+  while (spins < 1000) {
+    spins++;
+    CO_YIELD(co);
+  }
+  semaphore_V(done);
+  CO_END(co);
+}
+
+void test_shared() {
+  int i;
+
+  shared = cosignal_create();
+  for (i = 0; i < SHARED; i++)
+    coroutine_spawn(wait_shared, NULL);
+
+  /* The waiters do not hold up the dispatchers. */
+  coroutine_spawn(spin, NULL);
+  join(done, 1, "coroutine running past waiters");
+  check(shared_woken == 0, "shared: woken before any post");
+
+  for (i = 1; i <= SHARED; i++) {
+    cosignal_post(shared);
+    join(done, 1, "shared: waiter after a post");
+    minithread_sleep_with_timeout(5);
+    check(shared_woken == i, "shared: one waiter per post");
+  }
+  cosignal_destroy(shared);
+}
+
+/* CO_SLEEP. */
+typedef struct sleeper {
+  int delay;
+  uint64_t start;
+  uint64_t slept;
+} sleeper;
+
+sleeper sleepers[SLEEPERS];
+
+int sleep_once(coroutine_t co, void* arg) {
+  sleeper* s = (sleeper*) arg;
+
+  CO_BEGIN(co);
+  s->start = currentTimeNanos();
+  CO_SLEEP(co, s->delay);
+  s->slept = currentTimeNanos() - s->start;
+  semaphore_V(done);
+  CO_END(co);
+}
+
+void test_sleep() {
+  uint64_t most = 0;
+  int i;
+
+  for (i = 0; i < SLEEPERS; i++) {
+    sleepers[i].delay = 10 + i % 50;
+    coroutine_spawn(sleep_once, &sleepers[i]);
+  }
+  join(done, SLEEPERS, "sleepers");
+  for (i = 0; i < SLEEPERS; i++) {
+    check(sleepers[i].slept >= sleepers[i].delay * 1000000ULL, "sleep: woken early");
+    if (sleepers[i].slept - sleepers[i].delay * 1000000ULL > most)
+      most = sleepers[i].slept - sleepers[i].delay * 1000000ULL;
+  }
+  check(most < 1000 * 1000000ULL, "sleep: woken a second late");
+  printf("cotest: sleeps at most %.1f ms late\n", most / 1e6);
+}
+
+int test(int* arg) {
+  done = new_semaphore(0);
+  posted = new_semaphore(0);
+  check(coroutine_initialize(2) == 0, "initialize");
+
+  test_posts();
+  test_shared();
+  test_sleep();
+
+  printf("cotest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(2);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,165 @@
+/* futuretest.c
+
+   Check futures, on 2 processors unless MINITHREAD_CPUS says otherwise.
+   Futures completed from alarm handlers wake up a thread waiting for any
+   of them when the first alarm goes off, with the index of that one, and
+   a thread waiting for all of them after the last; several threads
+   waiting for the same future all get its value; a future completes only
+   once; and a future_fork future joins its thread. Then a thread
+   completes futures while another is starting to wait for them, many
+   times over, and no completion may be missed.
+*/
+
+#include "testing.h"
+#include "future.h"
+#include "alarm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DATA(n) ((void*) (intptr_t) (n))
+#define ALARMS 4
+#define GETTERS 5
+#define RACES 2000
+#define PATIENCE 30000   /* ms for the whole test */
+
+future_t futures[ALARMS];
+
+/* Completes futures[n] with n + 1. */
+void complete_alarm(void* arg) {
+  long n = (long) arg;
+
+  future_complete(futures[n], DATA(n + 1));
+}
+
+/* Alarm k goes off after delays[k] ms; the second one first. */
+int delays[ALARMS] = {350, 150, 550, 250};
+
+void create_futures() {
+  long i;
+
+  for (i = 0; i < ALARMS; i++)
+    futures[i] = future_create();
+}
+
+void destroy_futures() {
+  int i;
+
+  for (i = 0; i < ALARMS; i++)
+    future_destroy(futures[i]);
+}
+
+void test_alarms() {
+  uint64_t start;
+  long i;
+
+  create_futures();
+  start = currentTimeNanos();
+  for (i = 0; i < ALARMS; i++)
+    register_alarm(delays[i], complete_alarm, (void*) i);
+
+  check(future_wait_any(futures, ALARMS) == 1, "wait_any: first to complete");
+  check(currentTimeNanos() - start >= delays[1] * 1000000ULL, "wait_any: returned early");
+  check(!future_is_complete(futures[2]), "wait_any: returned late");
+  check(future_get(futures[1]) == DATA(2), "wait_any: value");
+
+  future_wait_all(futures, ALARMS);
+  check(currentTimeNanos() - start >= delays[2] * 1000000ULL, "wait_all: returned early");
+  for (i = 0; i < ALARMS; i++)
+    check(future_get(futures[i]) == DATA(i + 1), "wait_all: values");
+
+  /* Complete already: lowest index first, and no waiting. */
+  check(future_wait_any(futures, ALARMS) == 0, "wait_any: lowest complete");
+  check(future_wait_any(futures, 0) == -1, "wait_any: none");
+  check(future_complete(futures[0], DATA(9)) == -1, "completed twice");
+  check(future_get(futures[0]) == DATA(1), "value changed by a second completion");
+  destroy_futures();
+}
+
+semaphore_t got;
+future_t shared;
+
+int getter(int* arg) {
+  check(future_get(shared) == DATA(1), "shared: value");
+  semaphore_V(got);
+  return 0;
+}
+
+void test_shared() {
+  int i;
+
+  shared = future_create();
+  for (i = 0; i < GETTERS; i++)
+    minithread_fork(getter, NULL);
+  minithread_sleep_with_timeout(20);
+  check(semaphore_P_timeout(got, 0) == 1, "shared: got before completion");
+
+  futures[0] = shared;
+  register_alarm(50, complete_alarm, (void*) 0);
+  for (i = 0; i < GETTERS; i++)
+    semaphore_P(got);
+  future_destroy(shared);
+}
+
+int forked(int* arg) {
+  return 42;
+}
+
+/* Completes futures[0..1] as soon as it is told to. */
+semaphore_t go;
+volatile int racing = 1;
+
+int completer(int* arg) {
+  while (1) {
+    semaphore_P(go);
+    if (!racing)
+      return 0;
+    future_complete(futures[1], DATA(2));
+    future_complete(futures[0], DATA(1));
+  }
+}
+
+void test_races() {
+  int round, i;
+
+  minithread_fork(completer, NULL);
+  for (round = 0; round < RACES; round++) {
+    create_futures();
+    semaphore_V(go);
+    i = future_wait_any(futures, 2);
+    check(i == 0 || i == 1, "race: wait_any");
+    future_wait_all(futures, 2);
+    check(future_get(futures[0]) == DATA(1) && future_get(futures[1]) == DATA(2),
+          "race: values");
+    destroy_futures();
+  }
+  racing = 0;
+  semaphore_V(go);
+}
+
+int test(int* arg) {
+  future_t f;
+
+  got = new_semaphore(0);
+  go = new_semaphore(0);
+  start_watchdog(PATIENCE);
+
+  test_alarms();
+  test_shared();
+
+  f = future_fork(forked, NULL);
+  check(future_get(f) == DATA(42), "future_fork: return value");
+  future_destroy(f);
+
+  test_races();
+
+  printf("futuretest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(2);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,149 @@
+/* grouptest.c
+
+   Check thread groups on one processor (run it without MINITHREAD_CPUS)
+   with a 2 ms tickless quantum. Threads forked by a thread of a group land
+   in that group. Two uncapped groups of weights 100 and 300 split the
+   processor about 1:3, whatever the number of threads in each. A group
+   capped to 100 ms every 400 ms runs for about a quarter of the time, even
+   though its threads would take it all, and an uncapped group gets the
+   rest.
+*/
+
+#include "testing.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SHARE_TIME 1000               /* ms */
+#define CAP_TIME 2000                 /* ms */
+#define QUOTA (100 * MILLISECOND)
+#define PERIOD (400 * MILLISECOND)
+
+semaphore_t done;
+
+minithread_group_t child_group;
+
+int child(int* arg) {
+  semaphore_V(done);
+  return 0;
+}
+
+int parent(int* arg) {
+  minithread_t t = minithread_fork(child, NULL);
+
+  check(t != NULL, "fork");
+  child_group = minithread_group_of(t);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_fork() {
+  minithread_group_t g = minithread_group_create(NULL, MINITHREAD_GROUP_WEIGHT_DEFAULT);
+  minithread_group_stats_t stats;
+  minithread_t t;
+
+  check(g != NULL, "fork: group_create");
+  check(minithread_group_of(minithread_self()) == minithread_group_root(), "fork: test not in the root group");
+  t = minithread_fork(parent, NULL);
+  check(minithread_group_of(t) == minithread_group_root(), "fork: thread not in its parent's group");
+  check(minithread_group_join(g, t) == 0, "fork: group_join");
+  minithread_group_get_stats(g, &stats);
+  check(stats.threads == 1, "fork: thread count after join");
+  join(done, 2, "fork: threads hung");
+  check(child_group == g, "fork: child not in its parent's group");
+  check(minithread_group_destroy(g) == 0, "fork: group_destroy after its threads finished");
+}
+
+volatile int stop;
+
+int spinner(int* arg) {
+  volatile long x = 0;
+
+  while (!stop)
+    x++;
+  semaphore_V(done);
+  return 0;
+}
+
+/* Fork count spinners into g. */
+void spin_in(minithread_group_t g, int count) {
+  minithread_t t;
+
+  while (count-- > 0) {
+    t = minithread_fork(spinner, NULL);
+    check(t != NULL, "fork");
+    check(minithread_group_join(g, t) == 0, "group_join");
+  }
+}
+
+/* Run spinners for ms milliseconds, then get the stats of both groups. */
+void spin_for(int ms, int threads, minithread_group_t g1, minithread_group_stats_t* s1,
+              minithread_group_t g2, minithread_group_stats_t* s2) {
+  minithread_sleep_with_timeout(ms);
+  stop = 1;
+  join(done, threads, "spinners hung");
+  minithread_group_get_stats(g1, s1);
+  minithread_group_get_stats(g2, s2);
+  check(minithread_group_destroy(g1) == 0 && minithread_group_destroy(g2) == 0, "group_destroy");
+}
+
+void test_weights() {
+  minithread_group_t light = minithread_group_create(NULL, 100);
+  minithread_group_t heavy = minithread_group_create(NULL, 300);
+  minithread_group_stats_t light_stats, heavy_stats;
+  double share;
+
+  check(light != NULL && heavy != NULL, "weights: group_create");
+  stop = 0;
+  /* More threads in the lighter group: the weights are per group. */
+  spin_in(light, 2);
+  spin_in(heavy, 1);
+  spin_for(SHARE_TIME, 3, light, &light_stats, heavy, &heavy_stats);
+
+  share = (double) heavy_stats.run_time / (light_stats.run_time + heavy_stats.run_time);
+  printf("grouptest: weights 100 and 300 ran %.0f and %.0f ms, %.2f of the time to the second\n",
+         light_stats.run_time / 1e6, heavy_stats.run_time / 1e6, share);
+  check(share > 0.65 && share < 0.85, "weights: run time does not follow weights");
+}
+
+void test_cap() {
+  minithread_group_t capped = minithread_group_create(NULL, MINITHREAD_GROUP_WEIGHT_DEFAULT);
+  minithread_group_t free_group = minithread_group_create(NULL, MINITHREAD_GROUP_WEIGHT_DEFAULT);
+  minithread_group_stats_t capped_stats, free_stats;
+  double expected;
+
+  check(capped != NULL && free_group != NULL, "cap: group_create");
+  check(minithread_group_set_cap(minithread_group_root(), QUOTA, PERIOD) == -1, "cap: root capped");
+  check(minithread_group_set_cap(capped, QUOTA, PERIOD) == 0, "cap: set_cap");
+  stop = 0;
+  spin_in(capped, 2);
+  spin_in(free_group, 1);
+  spin_for(CAP_TIME, 3, capped, &capped_stats, free_group, &free_stats);
+
+  expected = (double) CAP_TIME * MILLISECOND * QUOTA / PERIOD;
+  printf("grouptest: capped to %.0f ms every %.0f ms, ran %.0f ms of %d (%.0f expected), "
+         "held back %lu times\n", QUOTA / 1e6, PERIOD / 1e6, capped_stats.run_time / 1e6,
+         CAP_TIME, expected / 1e6, capped_stats.throttles);
+  check(capped_stats.run_time > expected * 0.85 && capped_stats.run_time < expected * 1.15,
+        "cap: run time not near the quota");
+  check(capped_stats.throttles > 0, "cap: never held back");
+  check(free_stats.run_time > CAP_TIME * (uint64_t) MILLISECOND / 2, "cap: other group starved");
+}
+
+int test(int* arg) {
+  done = new_semaphore(0);
+
+  test_fork();
+  test_weights();
+  test_cap();
+
+  printf("grouptest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_tickless(2 * MILLISECOND);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
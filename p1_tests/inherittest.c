@@ -0,0 +1,149 @@
+/* inherittest.c
+
+   Check priority inheritance through semaphores initialized with
+   semaphore_initialize_mutex, on one processor (run it without
+   MINITHREAD_CPUS) with a 2 ms tickless quantum. A low priority thread L
+   owns a semaphore a high priority thread H waits for, while a medium
+   priority thread M spins for SPIN ms: only by inheriting H's priority
+   does L get to run past M and let H go on, so H has to finish before M.
+   Then the same through a chain: H waits on A, whose owner waits on B,
+   which L owns. Without inheritance, H would finish after M both times.
+*/
+
+#include "testing.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LOW 1
+#define MEDIUM 2
+#define HIGH 3
+#define SPIN 100                      /* ms */
+
+semaphore_t a;
+semaphore_t b;
+semaphore_t go;
+semaphore_t done;
+
+int order;
+int h_order;
+int m_order;
+
+/* Let lower priority threads run until t has blocked on a semaphore. */
+void wait_blocked(minithread_t t) {
+  uint64_t start = currentTimeNanos();
+
+  while (blocks(t, MINITHREAD_BLOCK_SEMAPHORE) == 0) {
+    check_waiting(start, "thread never blocked");
+    minithread_sleep_with_timeout(1);
+  }
+}
+
+minithread_t fork_at(proc_t proc, int priority) {
+  minithread_t t = minithread_fork(proc, NULL);
+
+  check(t != NULL, "fork");
+  check(minithread_set_priority(t, priority) == 0, "set_priority");
+  return t;
+}
+
+/* Owns a, until go. */
+int low(int* arg) {
+  semaphore_P(a);
+  semaphore_P(go);
+  semaphore_V(a);
+  semaphore_V(done);
+  return 0;
+}
+
+/* Owns b, until go. */
+int low_chained(int* arg) {
+  semaphore_P(b);
+  semaphore_P(go);
+  semaphore_V(b);
+  semaphore_V(done);
+  return 0;
+}
+
+/* Owns a, and waits for b. */
+int middle_owner(int* arg) {
+  semaphore_P(a);
+  semaphore_P(b);
+  semaphore_V(b);
+  semaphore_V(a);
+  semaphore_V(done);
+  return 0;
+}
+
+int medium(int* arg) {
+  uint64_t start = currentTimeNanos();
+
+  while (currentTimeNanos() - start < SPIN * (uint64_t) MILLISECOND)
+    ;
+  m_order = ++order;
+  semaphore_V(done);
+  return 0;
+}
+
+int high(int* arg) {
+  semaphore_P(a);
+  semaphore_V(a);
+  h_order = ++order;
+  semaphore_V(done);
+  return 0;
+}
+
+/* Start M and H, let L go, and check who finished first. */
+void race(int threads, char* what) {
+  order = h_order = m_order = 0;
+  fork_at(medium, MEDIUM);
+  fork_at(high, HIGH);
+  semaphore_V(go);
+  join(done, threads, "threads hung");
+  check(h_order != 0 && m_order != 0, "H or M did not finish");
+  check(h_order < m_order, what);
+}
+
+void test_direct() {
+  minithread_t l;
+
+  l = fork_at(low, LOW);
+  wait_blocked(l);
+  race(3, "direct: H finished after M");
+  check(minithread_get_priority(l) == LOW, "direct: L's own priority changed");
+}
+
+void test_chain() {
+  minithread_t l, x;
+
+  l = fork_at(low_chained, LOW);
+  wait_blocked(l);
+  x = fork_at(middle_owner, LOW);
+  wait_blocked(x);
+  race(4, "chain: H finished after M");
+  check(minithread_get_priority(x) == LOW, "chain: owner's own priority changed");
+}
+
+int test(int* arg) {
+  check(minithread_set_priority(minithread_self(), MINITHREAD_PRIORITY_MAX) == 0,
+        "set_priority of the test");
+  a = semaphore_create();
+  semaphore_initialize_mutex(a);
+  b = semaphore_create();
+  semaphore_initialize_mutex(b);
+  go = new_semaphore(0);
+  done = new_semaphore(0);
+
+  test_direct();
+  test_chain();
+
+  printf("inherittest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_tickless(2 * MILLISECOND);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
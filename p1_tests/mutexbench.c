@@ -0,0 +1,89 @@
+/* mutexbench.c
+
+   Measure the cost of a critical section: threads take turns incrementing
+   a shared counter, under a mutex, then under a semaphore initialized to
+   1. Preemption is the only thing that makes the mutex contended, while
+   every P and V of the semaphore disables interrupts. Run it with a single
+   processor (the default).
+*/
+
+#include "minithread.h"
+#include "synch.h"
+#include "machineprimitives.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 8
+#define ROUNDS 200000
+
+mutex_t m;
+semaphore_t sem;
+semaphore_t done;
+long counter;
+
+void report(char* what, uint64_t start) {
+  uint64_t elapsed = currentTimeNanos() - start;
+  unsigned long increments = (unsigned long) THREADS * ROUNDS;
+
+  printf("%-10s %lu increments in %.1f ms: %.1f ns per increment%s\n", what,
+         increments, elapsed / 1e6, (double) elapsed / increments,
+         counter == increments ? "" : " (WRONG COUNT)");
+}
+
+int mutex_incrementer(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    mutex_lock(m);
+    counter++;
+    mutex_unlock(m);
+  }
+  semaphore_V(done);
+
+  return 0;
+}
+
+int semaphore_incrementer(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_P(sem);
+    counter++;
+    semaphore_V(sem);
+  }
+  semaphore_V(done);
+
+  return 0;
+}
+
+void bench(char* what, proc_t incrementer) {
+  uint64_t start;
+  int i;
+
+  counter = 0;
+  start = currentTimeNanos();
+  for (i = 0; i < THREADS; i++)
+    minithread_fork(incrementer, NULL);
+  for (i = 0; i < THREADS; i++)
+    semaphore_P(done);
+  report(what, start);
+}
+
+int run(int* arg) {
+  m = mutex_create();
+  sem = semaphore_create();
+  semaphore_initialize(sem, 1);
+  done = semaphore_create();
+  semaphore_initialize(done, 0);
+
+  bench("mutex", mutex_incrementer);
+  bench("semaphore", semaphore_incrementer);
+
+  exit(0);
+}
+
+int main(void) {
+  minithread_system_initialize(run, NULL);
+  return -1;
+}
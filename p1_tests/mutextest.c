@@ -0,0 +1,210 @@
+/* mutextest.c
+
+   Check mutexes and condition variables on several processors (4, unless
+   MINITHREAD_CPUS says otherwise). First the states of a mutex: a free
+   one is locked and unlocked without blocking; threads locking a held one
+   block until it is unlocked, and each gets it in turn; a woken thread
+   that finds the mutex taken again blocks again, and still gets it. Then
+   threads on every processor increment a shared counter, and pass a turn
+   around and fill and empty a small buffer with cond_signal alone, which
+   would hang if a signal were ever lost.
+*/
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WAITERS 4
+#define THREADS 8
+#define INCREMENTS 100000
+#define TURNS 20000
+#define SLOTS 4
+#define ITEMS 50000
+
+mutex_t m;
+semaphore_t done;
+
+/* Wait until t has blocked on a mutex n times. */
+void wait_blocked(minithread_t t, unsigned long n) {
+  WAIT_FOR(blocks(t, MINITHREAD_BLOCK_MUTEX) >= n, "thread never blocked");
+}
+
+volatile int entered;
+
+int locker(int* arg) {
+  mutex_lock(m);
+  entered++;
+  mutex_unlock(m);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_states() {
+  minithread_t waiters[WAITERS];
+  minithread_t self = minithread_self();
+  int i;
+
+  /* Free, locked, free again, all without blocking. */
+  mutex_lock(m);
+  check(mutex_trylock(m) == -1, "trylock of a locked mutex");
+  mutex_unlock(m);
+  check(mutex_trylock(m) == 0, "trylock of a free mutex");
+  mutex_unlock(m);
+  check(blocks(self, MINITHREAD_BLOCK_MUTEX) == 0, "uncontended lock blocked");
+
+  /* Contended: the lockers wait, then each gets it. */
+  entered = 0;
+  mutex_lock(m);
+  for (i = 0; i < WAITERS; i++)
+    waiters[i] = minithread_fork(locker, NULL);
+  for (i = 0; i < WAITERS; i++)
+    wait_blocked(waiters[i], 1);
+  check(entered == 0, "lockers entered a held mutex");
+  mutex_unlock(m);
+  join(done, WAITERS, "contended lockers hung");
+  check(entered == WAITERS, "every locker entered once");
+  check(mutex_trylock(m) == 0, "mutex free after contention");
+  mutex_unlock(m);
+
+  /* Locked again before the woken locker runs: it has to wait again. */
+  entered = 0;
+  mutex_lock(m);
+  waiters[0] = minithread_fork(locker, NULL);
+  wait_blocked(waiters[0], 1);
+  mutex_unlock(m);
+  mutex_lock(m);
+  if (entered == 0) {
+    wait_blocked(waiters[0], 2);
+    check(entered == 0, "locker entered a held mutex");
+  }
+  mutex_unlock(m);
+  join(done, 1, "woken locker hung");
+  check(entered == 1, "woken locker entered once");
+}
+
+long counter;
+
+int incrementer(int* arg) {
+  int i;
+
+  for (i = 0; i < INCREMENTS; i++) {
+    mutex_lock(m);
+    counter++;
+    mutex_unlock(m);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_counter() {
+  int i;
+
+  counter = 0;
+  for (i = 0; i < THREADS; i++)
+    minithread_fork(incrementer, NULL);
+  join(done, THREADS, "incrementers hung");
+  check(counter == (long) THREADS * INCREMENTS, "counter");
+}
+
+cond_t turned;
+int turn;
+
+/* Wait for turn to be mine, then pass it on, with a single condition. */
+int turner(int* arg) {
+  int mine = *arg;
+  int i;
+
+  for (i = 0; i < TURNS; i++) {
+    mutex_lock(m);
+    while (turn != mine)
+      cond_wait(turned, m);
+    turn = !mine;
+    cond_signal(turned);
+    mutex_unlock(m);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+cond_t not_full;
+cond_t not_empty;
+int slots[SLOTS];
+int head;
+int used;
+long received;
+
+int producer(int* arg) {
+  int i;
+
+  for (i = 1; i <= ITEMS; i++) {
+    mutex_lock(m);
+    while (used == SLOTS)
+      cond_wait(not_full, m);
+    slots[(head + used++) % SLOTS] = i;
+    cond_signal(not_empty);
+    mutex_unlock(m);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+int consumer(int* arg) {
+  int i;
+
+  for (i = 1; i <= ITEMS; i++) {
+    mutex_lock(m);
+    while (used == 0)
+      cond_wait(not_empty, m);
+    received += slots[head];
+    head = (head + 1) % SLOTS;
+    used--;
+    cond_signal(not_full);
+    mutex_unlock(m);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_signals() {
+  int players[2] = { 0, 1 };
+  int i;
+
+  turned = cond_create();
+  turn = 0;
+  minithread_fork(turner, &players[0]);
+  minithread_fork(turner, &players[1]);
+  join(done, 2, "turn lost");
+
+  not_full = cond_create();
+  not_empty = cond_create();
+  received = 0;
+  for (i = 0; i < THREADS / 2; i++) {
+    minithread_fork(producer, NULL);
+    minithread_fork(consumer, NULL);
+  }
+  join(done, THREADS, "buffer signal lost");
+  check(received == (long) THREADS / 2 * ITEMS * (ITEMS + 1) / 2, "buffer items");
+
+  cond_destroy(turned);
+  cond_destroy(not_full);
+  cond_destroy(not_empty);
+}
+
+int test(int* arg) {
+  m = mutex_create();
+  done = new_semaphore(0);
+
+  test_states();
+  test_counter();
+  test_signals();
+  printf("mutextest: ok on %d processors\n", minithread_get_cpu_count());
+
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(4);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,235 @@
+/* policytest.c
+
+   Run the same workload under every scheduling policy, each in a process
+   of its own (only the one MINITHREAD_SCHEDULER names, if it is set), on
+   one processor with a 2 ms tickless quantum. Threads pass a turn around
+   by yielding, which has to switch threads even under "fifo", where time
+   slices are unbounded; hand the processor over with minithread_yield_to
+   and through a pair of semaphores; and a batch of forked threads yields a
+   few times each and finishes. Under "stride" and "lottery", two spinning
+   threads with 100 and 300 tickets then split the processor about 1:3.
+   With more processors (MINITHREAD_CPUS), the cases that depend on which
+   thread runs where, yield_to and the shares, are skipped.
+*/
+
+#include "testing.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define PLAYERS 3
+#define TURNS 2000
+#define ROUNDS 10000
+#define FORKS 100
+#define YIELDS 10
+#define SHARE_TIME 1000               /* ms */
+#define LOW_TICKETS 100
+#define HIGH_TICKETS 300
+
+char* policies[] = { "mlfq", "stride", "lottery", "fifo", "cfs", NULL };
+
+semaphore_t done;
+
+volatile int turn;
+
+/* Wait for my turn by yielding, then pass it on. */
+int player(int* arg) {
+  int mine = *arg;
+  int i;
+
+  for (i = 0; i < TURNS; i++) {
+    WAIT_FOR(turn == mine, "yield: turn never came");
+    turn = (mine + 1) % PLAYERS;
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_yield() {
+  int players[PLAYERS];
+  int i;
+
+  turn = 0;
+  for (i = 0; i < PLAYERS; i++) {
+    players[i] = i;
+    minithread_fork(player, &players[i]);
+  }
+  join(done, PLAYERS, "yield: players hung");
+}
+
+volatile int ran;
+semaphore_t blocker;
+
+int runner(int* arg) {
+  ran++;
+  semaphore_V(done);
+  return 0;
+}
+
+int sleeper(int* arg) {
+  semaphore_P(blocker);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_yield_to() {
+  minithread_t t;
+  int i;
+
+  for (i = 0; i < ROUNDS / 100; i++) {
+    ran = 0;
+    t = minithread_fork(runner, NULL);
+    check(minithread_yield_to(t) == 0, "yield_to: runnable thread refused");
+    check(ran == 1, "yield_to: target did not run");
+    join(done, 1, "yield_to: target hung");
+  }
+
+  /* A blocked thread cannot be switched to. */
+  blocker = new_semaphore(0);
+  t = minithread_fork(sleeper, NULL);
+  WAIT_FOR(blocks(t, MINITHREAD_BLOCK_SEMAPHORE) > 0, "yield_to: thread never blocked");
+  check(minithread_yield_to(t) == -1, "yield_to: blocked thread accepted");
+  semaphore_V(blocker);
+  join(done, 1, "yield_to: woken thread hung");
+  semaphore_destroy(blocker);
+}
+
+semaphore_t ping;
+semaphore_t pong;
+
+int ponger(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_P(ping);
+    semaphore_V(pong);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_handoff() {
+  int i;
+
+  ping = new_semaphore(0);
+  pong = new_semaphore(0);
+  minithread_fork(ponger, NULL);
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_V(ping);
+    check(semaphore_P_timeout(pong, TEST_PATIENCE) == 0, "handoff: pong lost");
+  }
+  join(done, 1, "handoff: ponger hung");
+  semaphore_destroy(ping);
+  semaphore_destroy(pong);
+}
+
+int yielder(int* arg) {
+  int i;
+
+  for (i = 0; i < YIELDS; i++)
+    minithread_yield();
+  semaphore_V(done);
+  return 0;
+}
+
+void test_fork() {
+  int i;
+
+  for (i = 0; i < FORKS; i++)
+    check(minithread_fork(yielder, NULL) != NULL, "fork: failed");
+  join(done, FORKS, "fork: yielders hung");
+}
+
+volatile int stop;
+
+int spinner(int* arg) {
+  volatile long x = 0;
+
+  while (!stop)
+    x++;
+  semaphore_V(done);
+  return 0;
+}
+
+/* Two spinners with different tickets, for SHARE_TIME ms on one processor. */
+void test_shares() {
+  minithread_t low, high;
+  minithread_stats_t low_stats, high_stats;
+  double share;
+
+  stop = 0;
+  low = minithread_fork(spinner, NULL);
+  high = minithread_fork(spinner, NULL);
+  check(minithread_set_tickets(low, LOW_TICKETS) == 0, "shares: set_tickets");
+  check(minithread_set_tickets(high, HIGH_TICKETS) == 0, "shares: set_tickets");
+  minithread_sleep_with_timeout(SHARE_TIME);
+  stop = 1;
+  join(done, 2, "shares: spinners hung");
+
+  minithread_get_stats(low, &low_stats);
+  minithread_get_stats(high, &high_stats);
+  share = (double) high_stats.run_time / (low_stats.run_time + high_stats.run_time);
+  printf("policytest: %s: %d and %d tickets ran %.0f and %.0f ms, %.2f of the time to the second\n",
+         minithread_scheduler_name(), LOW_TICKETS, HIGH_TICKETS, low_stats.run_time / 1e6,
+         high_stats.run_time / 1e6, share);
+  check(share > 0.65 && share < 0.85, "shares: run time does not follow tickets");
+}
+
+int test(int* arg) {
+  const char* name = minithread_scheduler_name();
+
+  done = new_semaphore(0);
+
+  test_yield();
+  test_handoff();
+  test_fork();
+  /* Another processor could steal the threads these look at. */
+  if (minithread_get_cpu_count() == 1) {
+    test_yield_to();
+    if (strcmp(name, "stride") == 0 || strcmp(name, "lottery") == 0)
+      test_shares();
+  }
+
+  printf("policytest: %s: ok on %d processors\n", name, minithread_get_cpu_count());
+  exit(0);
+}
+
+int run(char* policy) {
+  minithread_set_cpu_count(1);
+  minithread_set_tickless(2 * MILLISECOND);
+  if (minithread_set_scheduler(policy) == -1) {
+    printf("policytest: no policy %s\n", policy);
+    return 1;
+  }
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
+
+int main(void) {
+  char* only = getenv("MINITHREAD_SCHEDULER");
+  int failed = 0;
+  int status;
+  pid_t pid;
+  int i;
+
+  if (only != NULL)
+    return run(only);
+
+  for (i = 0; policies[i] != NULL; i++) {
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+      return run(policies[i]);
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      printf("policytest: FAILED under %s\n", policies[i]);
+      failed = 1;
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,99 @@
+/* pooltest.c
+
+   Check worker pools, on 2 processors unless MINITHREAD_CPUS says
+   otherwise. Workers are forked up to the maximum while tasks keep them
+   busy, then tasks queue up to the capacity and try_submit fails beyond
+   it; workers beyond the minimum go once idle for a whole timeout;
+   resizing forks and lets workers go; and destroying a pool runs what is
+   still queued. Every task has to run exactly once.
+*/
+
+#include "testing.h"
+#include "minithread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MIN_WORKERS 1
+#define MAX_WORKERS 4
+#define CAPACITY 8
+#define TASKS 20000
+
+minithread_pool_t pool;
+semaphore_t gate;
+int ran[TASKS];
+
+minithread_pool_stats_t stats() {
+  minithread_pool_stats_t s;
+
+  minithread_pool_get_stats(pool, &s);
+  return s;
+}
+
+int count_task(int* arg) {
+  ran[(long) arg]++;
+  return 0;
+}
+
+int gated_task(int* arg) {
+  semaphore_P(gate);
+  return 0;
+}
+
+int test(int* arg) {
+  minithread_pool_stats_t s;
+  long i;
+
+  gate = new_semaphore(0);
+  pool = minithread_pool_create(MIN_WORKERS, MAX_WORKERS, CAPACITY);
+  check(pool != NULL, "create");
+  check(stats().workers == MIN_WORKERS, "minimum forked");
+
+  /* Busy workers make the pool grow, up to the maximum. */
+  for (i = 0; i < MAX_WORKERS; i++)
+    check(minithread_pool_submit(pool, gated_task, NULL) == 0, "submit");
+  WAIT_FOR(stats().workers == MAX_WORKERS && stats().idle == 0 && stats().queued == 0,
+           "workers forked up to the maximum");
+
+  /* Then tasks queue, up to the capacity. */
+  for (i = 0; i < CAPACITY; i++)
+    check(minithread_pool_try_submit(pool, count_task, (int*) i) == 0, "try_submit with room");
+  check(minithread_pool_try_submit(pool, count_task, NULL) == -1, "try_submit when full");
+  s = stats();
+  check(s.workers == MAX_WORKERS && s.queued == CAPACITY && s.rejected == 1, "queued at the maximum");
+
+  for (i = 0; i < MAX_WORKERS; i++)
+    semaphore_V(gate);
+  WAIT_FOR(stats().completed == MAX_WORKERS + CAPACITY, "queued tasks completed");
+  for (i = 0; i < CAPACITY; i++)
+    check(ran[i] == 1, "queued task ran once");
+
+  /* Idle for long enough, the pool shrinks back to the minimum. */
+  minithread_sleep_with_timeout(3 * MINITHREAD_POOL_IDLE_TIMEOUT);
+  check(stats().workers == MIN_WORKERS, "idle workers let go");
+
+  check(minithread_pool_resize(pool, 3, 3) == 0, "resize up");
+  WAIT_FOR(stats().workers == 3, "resize forked workers");
+  check(minithread_pool_resize(pool, 0, 2) == 0, "resize down");
+  WAIT_FOR(stats().workers <= 2, "resize let workers go");
+
+  /* Many more tasks than workers, then destroyed with some still queued. */
+  for (i = 0; i < TASKS; i++) {
+    ran[i] = 0;
+    check(minithread_pool_submit(pool, count_task, (int*) i) == 0, "submit");
+  }
+  s = stats();
+  minithread_pool_destroy(pool);
+  for (i = 0; i < TASKS; i++)
+    check(ran[i] == 1, "task ran exactly once");
+
+  printf("pooltest: ok on %d processors, max queued %d, max wait %.1f us\n",
+         minithread_get_cpu_count(), s.max_queued, s.max_wait_time / 1e3);
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(2);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
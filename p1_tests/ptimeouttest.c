@@ -0,0 +1,170 @@
+/* ptimeouttest.c
+
+   Check semaphore_P_timeout, on 2 processors unless MINITHREAD_CPUS says
+   otherwise. A P that times out returns 1, no sooner than asked, and
+   leaves the count as it was; one that a V gets to first returns 0 right
+   away, and its timeout going off later does nothing; a P with a count
+   or a timeout of 0 does not block; and a thread that timed out is no
+   longer in line, so the next V goes to one still waiting. Then threads
+   V, pausing longer than the timeouts now and then, while others P
+   with short timeouts until they are done, and every V has to be taken
+   exactly once.
+*/
+
+#include "testing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TIMEOUT 200
+#define RACERS 3
+#define VS 3000
+
+semaphore_t sem;
+semaphore_t done;
+
+/* The count of sem, taken down to 0 and put back. */
+int count() {
+  int n = 0, i;
+
+  while (semaphore_P_timeout(sem, 0) == 0)
+    n++;
+  for (i = 0; i < n; i++)
+    semaphore_V(sem);
+  return n;
+}
+
+void test_timeout() {
+  uint64_t start = currentTimeNanos();
+
+  check(semaphore_P_timeout(sem, TIMEOUT) == 1, "timeout: returned 0");
+  check(currentTimeNanos() - start >= TIMEOUT * 1000000ULL, "timeout: returned early");
+  check(count() == 0, "timeout: count changed");
+
+  semaphore_V(sem);
+  semaphore_V(sem);
+  start = currentTimeNanos();
+  check(semaphore_P_timeout(sem, TIMEOUT) == 0, "available: timed out");
+  check(semaphore_P_timeout(sem, 0) == 0, "poll: timed out with a count");
+  check(currentTimeNanos() - start < TIMEOUT * 1000000ULL, "available: blocked");
+  check(semaphore_P_timeout(sem, 0) == 1, "poll: returned 0 at 0");
+  check(semaphore_P_timeout(sem, -1) == 1, "poll: returned 0 with a negative timeout");
+}
+
+volatile int result;
+volatile uint64_t waited;
+
+int timed_waiter(int* arg) {
+  uint64_t start = currentTimeNanos();
+
+  result = semaphore_P_timeout(sem, (long) arg);
+  waited = currentTimeNanos() - start;
+  semaphore_V(done);
+  return 0;
+}
+
+int waiter(int* arg) {
+  semaphore_P(sem);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_v_first() {
+  result = -1;
+  minithread_fork(timed_waiter, (int*) TIMEOUT);
+  minithread_sleep_with_timeout(20);
+  check(result == -1, "V first: returned before the V");
+  semaphore_V(sem);
+  check(semaphore_P_timeout(done, TEST_PATIENCE) == 0, "V first: not woken");
+  check(result == 0, "V first: timed out");
+  check(waited < TIMEOUT * 1000000ULL, "V first: woken by the timeout");
+
+  /* The timeout going off later takes nothing and wakes nobody. */
+  minithread_sleep_with_timeout(2 * TIMEOUT);
+  semaphore_V(sem);
+  check(count() == 1, "V first: count changed by the timeout");
+  semaphore_P(sem);
+}
+
+void test_timed_out_leaves() {
+  minithread_fork(timed_waiter, (int*) (TIMEOUT / 4));
+  minithread_sleep_with_timeout(10);
+  minithread_fork(waiter, NULL);
+  check(semaphore_P_timeout(done, TEST_PATIENCE) == 0, "leaves: timed waiter not back");
+  check(result == 1, "leaves: did not time out");
+
+  /* Only the plain waiter is left in line for this V. */
+  semaphore_V(sem);
+  check(semaphore_P_timeout(done, TEST_PATIENCE) == 0, "leaves: V went to a thread that timed out");
+  check(count() == 0, "leaves: count");
+}
+
+volatile int taken;
+volatile int timeouts;
+volatile int stop;
+semaphore_t v_done;
+
+int v_racer(int* arg) {
+  uint64_t start;
+  int i;
+
+  for (i = 0; i < VS; i++) {
+    semaphore_V(sem);
+    if (i % 4 == 0)
+      minithread_yield();
+    /* Spin rather than sleep, so that Vs keep landing as timeouts go off. */
+    if (i % 32 == 0)
+      for (start = currentTimeNanos(); currentTimeNanos() - start < 5000000ULL;)
+        ;
+  }
+  semaphore_V(v_done);
+  return 0;
+}
+
+int p_racer(int* arg) {
+  while (!stop) {
+    if (semaphore_P_timeout(sem, 1) == 0)
+      __sync_add_and_fetch(&taken, 1);
+    else
+      __sync_add_and_fetch(&timeouts, 1);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_race() {
+  int i;
+
+  for (i = 0; i < RACERS; i++) {
+    minithread_fork(v_racer, NULL);
+    minithread_fork(p_racer, NULL);
+  }
+  for (i = 0; i < RACERS; i++)
+    check(semaphore_P_timeout(v_done, TEST_PATIENCE) == 0, "race: V threads not done");
+  stop = 1;
+  for (i = 0; i < RACERS; i++)
+    check(semaphore_P_timeout(done, TEST_PATIENCE) == 0, "race: P threads not done");
+  check(taken + count() == RACERS * VS, "race: V lost or taken twice");
+  printf("ptimeouttest: %d Ps timed out in the race\n", timeouts);
+}
+
+int test(int* arg) {
+  sem = new_semaphore(0);
+  done = new_semaphore(0);
+  v_done = new_semaphore(0);
+
+  test_timeout();
+  test_v_first();
+  test_timed_out_leaves();
+  test_race();
+
+  printf("ptimeouttest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(2);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
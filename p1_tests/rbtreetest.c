@@ -0,0 +1,138 @@
+/* rbtreetest.c
+
+   Check the red-black tree on its own, without minithreads. OPERATIONS
+   random inserts and deletes over NODES nodes with few distinct keys,
+   checking after every CHECK_EVERY of them that the tree is ordered, with
+   nodes of equal keys in the order they were inserted in, that it is
+   balanced (no red node has a red child, every path has as many black
+   nodes, the root is black), that parent links are right, and that
+   rbtree_first, rbtree_next and rbtree_size agree with it. Then the tree
+   is emptied from the front, as the scheduler does.
+*/
+
+#include "rbtree.h"
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NODES 1000
+#define KEYS 64
+#define OPERATIONS 400000
+#define CHECK_EVERY 100
+
+typedef struct item {
+  int key;
+  unsigned long inserted;  /* when it was last inserted */
+  int in_tree;
+  rbtree_node node;
+} item;
+
+#define item_of(n) rbtree_entry(n, item, node)
+
+item items[NODES];
+rbtree tree;
+int tree_size;
+
+int less(rbtree_node_t a, rbtree_node_t b) {
+  return item_of(a)->key < item_of(b)->key;
+}
+
+/* Whether a goes before b: by key, then by insertion. */
+int before(item* a, item* b) {
+  return a->key < b->key || (a->key == b->key && a->inserted < b->inserted);
+}
+
+item* last_seen;
+int seen;
+
+/* Check the subtree at n, visiting it in order. Returns its black height. */
+int check_subtree(rbtree_node_t n, rbtree_node_t parent) {
+  int left, right;
+
+  if (n == NULL)
+    return 1;
+  check(n->parent == parent, "parent link");
+  check(!n->red || ((n->left == NULL || !n->left->red) && (n->right == NULL || !n->right->red)),
+        "red node with a red child");
+
+  left = check_subtree(n->left, n);
+  if (last_seen != NULL)
+    check(before(last_seen, item_of(n)), "out of order");
+  check(item_of(n)->in_tree, "node not inserted");
+  last_seen = item_of(n);
+  seen++;
+  right = check_subtree(n->right, n);
+
+  check(left == right, "black heights differ");
+  return left + !n->red;
+}
+
+void check_tree() {
+  rbtree_node_t n;
+  item* prev = NULL;
+  int count = 0;
+
+  last_seen = NULL;
+  seen = 0;
+  check(tree.root == NULL || !tree.root->red, "red root");
+  check_subtree(tree.root, NULL);
+  check(seen == tree_size, "nodes lost or duplicated");
+  check(rbtree_size(&tree) == tree_size, "size");
+
+  for (n = rbtree_first(&tree); n != NULL; n = rbtree_next(n)) {
+    if (prev != NULL)
+      check(before(prev, item_of(n)), "rbtree_next out of order");
+    prev = item_of(n);
+    count++;
+  }
+  check(count == tree_size, "rbtree_next missed nodes");
+  check(tree_size > 0 || rbtree_first(&tree) == NULL, "first of an empty tree");
+}
+
+int main(void) {
+  unsigned long clock = 0;
+  rbtree_node_t n;
+  item* it;
+  int i;
+
+  srandom(445);
+  rbtree_init(&tree);
+  for (i = 0; i < NODES; i++) {
+    rbtree_node_init(&items[i].node);
+    items[i].in_tree = 0;
+  }
+  check_tree();
+
+  for (i = 0; i < OPERATIONS; i++) {
+    it = &items[random() % NODES];
+    if (it->in_tree) {
+      rbtree_delete(&tree, &it->node);
+      it->in_tree = 0;
+      tree_size--;
+    } else {
+      it->key = random() % KEYS;
+      it->inserted = ++clock;
+      rbtree_insert(&tree, &it->node, less);
+      it->in_tree = 1;
+      tree_size++;
+    }
+    if (i % CHECK_EVERY == 0)
+      check_tree();
+  }
+  check_tree();
+  printf("rbtreetest: %d operations, %d nodes left in the tree\n", OPERATIONS, tree_size);
+
+  /* Take the first node off until the tree is empty. */
+  while ((n = rbtree_first(&tree)) != NULL) {
+    rbtree_delete(&tree, n);
+    item_of(n)->in_tree = 0;
+    tree_size--;
+    if (tree_size % CHECK_EVERY == 0)
+      check_tree();
+  }
+  check(tree_size == 0 && rbtree_size(&tree) == 0, "tree not emptied");
+
+  printf("rbtreetest: ok\n");
+  return 0;
+}
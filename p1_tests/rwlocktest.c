@@ -0,0 +1,204 @@
+/* rwlocktest.c
+
+   Check reader-writer locks on several processors (4, unless
+   MINITHREAD_CPUS says otherwise). Readers hold the lock all at once: each
+   one waits, lock in hand, for all the others to come in. A writer waits
+   for the readers and keeps out everybody else, and threads on every
+   processor mixing reads and writes never see a writer alongside anybody.
+   Then the preference: with prefer_writers, a reader arriving while a
+   writer waits behind the current readers waits too, and the writer goes
+   first; without it, the reader goes in right away.
+*/
+
+#include "testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define READERS 8
+#define THREADS 8
+#define ROUNDS 20000
+#define WRITE_EVERY 10
+
+rwlock_t l;
+semaphore_t done;
+
+/* Wait until t has blocked on a reader-writer lock. */
+void wait_blocked(minithread_t t) {
+  WAIT_FOR(blocks(t, MINITHREAD_BLOCK_RWLOCK) > 0, "thread never blocked");
+}
+
+volatile int inside;
+
+/* Hold the lock for reading until every reader has it. */
+int reader(int* arg) {
+  rwlock_rdlock(l);
+  __sync_fetch_and_add(&inside, 1);
+  WAIT_FOR(inside == READERS, "readers: not all inside at once");
+  rwlock_rdunlock(l);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_readers() {
+  int i;
+
+  inside = 0;
+  for (i = 0; i < READERS; i++)
+    minithread_fork(reader, NULL);
+  join(done, READERS, "readers hung");
+}
+
+volatile int entered;
+
+int writer(int* arg) {
+  rwlock_wrlock(l);
+  entered++;
+  rwlock_wrunlock(l);
+  semaphore_V(done);
+  return 0;
+}
+
+int quick_reader(int* arg) {
+  rwlock_rdlock(l);
+  entered++;
+  rwlock_rdunlock(l);
+  semaphore_V(done);
+  return 0;
+}
+
+void test_exclusion() {
+  minithread_t t;
+
+  /* A writer waits for a reader. */
+  entered = 0;
+  rwlock_rdlock(l);
+  t = minithread_fork(writer, NULL);
+  wait_blocked(t);
+  check(entered == 0, "writer entered alongside a reader");
+  rwlock_rdunlock(l);
+  join(done, 1, "writer hung");
+  check(entered == 1, "writer entered once");
+
+  /* A reader and a writer wait for a writer. */
+  entered = 0;
+  rwlock_wrlock(l);
+  t = minithread_fork(quick_reader, NULL);
+  wait_blocked(t);
+  t = minithread_fork(writer, NULL);
+  wait_blocked(t);
+  check(entered == 0, "entered alongside a writer");
+  rwlock_wrunlock(l);
+  join(done, 2, "reader and writer hung");
+  check(entered == 2, "reader and writer entered once");
+}
+
+volatile int readers_in;
+volatile int writers_in;
+volatile int overlaps;
+
+/* Mostly read, sometimes write, counting who is in there. */
+int mixer(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    if (i % WRITE_EVERY == 0) {
+      rwlock_wrlock(l);
+      if (__sync_fetch_and_add(&writers_in, 1) != 0 || readers_in != 0)
+        overlaps++;
+      if (i % (WRITE_EVERY * 10) == 0)
+        minithread_yield();
+      __sync_fetch_and_sub(&writers_in, 1);
+      rwlock_wrunlock(l);
+    } else {
+      rwlock_rdlock(l);
+      __sync_fetch_and_add(&readers_in, 1);
+      if (writers_in != 0)
+        overlaps++;
+      if (i % 100 == 1)
+        minithread_yield();
+      __sync_fetch_and_sub(&readers_in, 1);
+      rwlock_rdunlock(l);
+    }
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+void test_mixed() {
+  int i;
+
+  for (i = 0; i < THREADS; i++)
+    minithread_fork(mixer, NULL);
+  join(done, THREADS, "mixers hung");
+  check(overlaps == 0, "a writer shared the lock");
+}
+
+volatile int order;
+volatile int writer_order;
+volatile int reader_order;
+
+int ordered_writer(int* arg) {
+  rwlock_wrlock(l);
+  writer_order = ++order;
+  rwlock_wrunlock(l);
+  semaphore_V(done);
+  return 0;
+}
+
+int ordered_reader(int* arg) {
+  rwlock_rdlock(l);
+  reader_order = ++order;
+  rwlock_rdunlock(l);
+  semaphore_V(done);
+  return 0;
+}
+
+/* A reader comes while a writer waits behind a reader (this thread). */
+void test_preference(int prefer_writers) {
+  minithread_t w, r;
+
+  rwlock_destroy(l);
+  l = rwlock_create(prefer_writers);
+  order = writer_order = reader_order = 0;
+
+  rwlock_rdlock(l);
+  w = minithread_fork(ordered_writer, NULL);
+  wait_blocked(w);
+  r = minithread_fork(ordered_reader, NULL);
+  if (prefer_writers) {
+    wait_blocked(r);
+    check(reader_order == 0, "prefer_writers: reader passed a waiting writer");
+    rwlock_rdunlock(l);
+    join(done, 2, "prefer_writers: hung");
+    check(writer_order == 1 && reader_order == 2, "prefer_writers: writer not first");
+  } else {
+    join(done, 1, "reader held back by a waiting writer");
+    check(reader_order == 1 && writer_order == 0, "reader not first");
+    rwlock_rdunlock(l);
+    join(done, 1, "writer hung");
+    check(writer_order == 2, "writer entered once");
+  }
+  check(blocks(r, MINITHREAD_BLOCK_RWLOCK) == (unsigned long) prefer_writers, "reader blocked");
+}
+
+int test(int* arg) {
+  l = rwlock_create(0);
+  done = new_semaphore(0);
+
+  test_readers();
+  test_exclusion();
+  test_mixed();
+  test_preference(1);
+  test_preference(0);
+  rwlock_destroy(l);
+  printf("rwlocktest: ok on %d processors\n", minithread_get_cpu_count());
+
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(4);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,139 @@
+/* stacktest.c
+
+   Check thread stacks. A thread recursing without end runs into the guard
+   page right below its stack and dies of SIGSEGV, once it used about all
+   of its stack and not before: that is done in a child process, which
+   leaves how deep it got in memory shared with this one. Stacks are only
+   reserved, so many large ones take up little memory until they are used,
+   and a thread does get to use all of the stack it asked for.
+*/
+
+#include "testing.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define OVERFLOW_STACK (128 * 1024)
+#define FRAME 256
+#define LARGE_STACK (16 * 1024 * 1024)
+#define THREADS 100
+#define USED (12 * 1024 * 1024)
+
+/* How deep the overflowing thread got, shared with the child process. */
+volatile long* deepest;
+char* top;
+
+void recurse() {
+  volatile char frame[FRAME];
+
+  frame[0] = 1;
+  *deepest = top - (char*) frame;
+  if (*deepest >= 0)
+    recurse();
+  frame[1] = 2;
+}
+
+int overflow(int* arg) {
+  char here;
+
+  top = &here;
+  recurse();
+  return 0;
+}
+
+int overflow_main(int* arg) {
+  minithread_fork_with_stack(overflow, NULL, OVERFLOW_STACK);
+  minithread_sleep_with_timeout(10000);
+  exit(0);
+}
+
+void test_overflow() {
+  int status;
+  pid_t child;
+
+  deepest = mmap(NULL, sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  check(deepest != MAP_FAILED, "mmap");
+  fflush(stdout);
+  child = fork();
+  check(child != -1, "fork");
+  if (child == 0) {
+    minithread_system_initialize(overflow_main, NULL);
+    exit(0);
+  }
+  check(waitpid(child, &status, 0) == child, "waitpid");
+  check(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, "overflow: not stopped by SIGSEGV");
+  check(*deepest > OVERFLOW_STACK - 4 * 4096, "overflow: stopped before the end of the stack");
+  check(*deepest <= OVERFLOW_STACK, "overflow: went past the stack");
+  printf("stacktest: overflowed after %ld of %d KB\n", *deepest / 1024, OVERFLOW_STACK / 1024);
+}
+
+/* Resident memory, in KB. */
+long resident() {
+  long size, pages;
+  FILE* f = fopen("/proc/self/statm", "r");
+
+  check(f != NULL && fscanf(f, "%ld %ld", &size, &pages) == 2, "statm");
+  fclose(f);
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+semaphore_t gate;
+semaphore_t done;
+
+int idle(int* arg) {
+  semaphore_P(gate);
+  semaphore_V(done);
+  return 0;
+}
+
+/* Touch USED bytes of stack, a page at a time, and check them. */
+int use_stack(int* arg) {
+  char buffer[USED];
+  int i;
+
+  for (i = 0; i < USED; i += 4096)
+    buffer[i] = (char) i;
+  for (i = 0; i < USED; i += 4096)
+    check(buffer[i] == (char) i, "large: stack");
+  semaphore_V(done);
+  return 0;
+}
+
+int test(int* arg) {
+  long before, grown;
+  int i;
+
+  gate = new_semaphore(0);
+  done = new_semaphore(0);
+
+  /* Reserved, not committed. */
+  before = resident();
+  for (i = 0; i < THREADS; i++)
+    check(minithread_fork_with_stack(idle, NULL, LARGE_STACK) != NULL, "large: fork");
+  minithread_yield();
+  grown = resident() - before;
+  check(grown < THREADS * 64, "large: stacks committed");
+  printf("stacktest: %d stacks of %d MB, %ld KB resident\n", THREADS, LARGE_STACK >> 20, grown);
+  for (i = 0; i < THREADS; i++)
+    semaphore_V(gate);
+  for (i = 0; i < THREADS; i++)
+    semaphore_P(done);
+
+  /* All of it usable. */
+  check(minithread_fork_with_stack(use_stack, NULL, LARGE_STACK) != NULL, "large: fork");
+  semaphore_P(done);
+
+  printf("stacktest: ok\n");
+  exit(0);
+}
+
+int main(void) {
+  test_overflow();
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
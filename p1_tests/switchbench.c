@@ -0,0 +1,162 @@
+/* switchbench.c
+
+   Measure the cost of a context switch. First the bare switch primitives,
+   between two stacks of a host thread of their own, then with the whole
+   scheduler: two threads hand the processor back and forth, by yielding,
+   then through a pair of semaphores, with and without directed handoff,
+   and by yielding to one another. Run it with a single processor (the
+   default).
+*/
+
+#include "minithread.h"
+#include "synch.h"
+#include "machineprimitives.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROUNDS 1000000
+
+semaphore_t ping;
+semaphore_t pong;
+semaphore_t done;
+
+void report(char* what, uint64_t start, unsigned long switches) {
+  uint64_t elapsed = currentTimeNanos() - start;
+
+  printf("%-10s %lu switches in %.1f ms: %.1f ns per switch\n", what, switches,
+         elapsed / 1e6, (double) elapsed / switches);
+}
+
+typedef void (*switch_t)(stack_pointer_t*, stack_pointer_t*);
+
+switch_t switch_primitive;
+stack_pointer_t main_sp;
+stack_pointer_t peer_sp;
+
+int peer(int* arg) {
+  while (1)
+    switch_primitive(&peer_sp, &main_sp);
+
+  return 0;
+}
+
+void bench_primitive(char* what, switch_t primitive) {
+  uint64_t start;
+  int i;
+
+  switch_primitive = primitive;
+  start = currentTimeNanos();
+  for (i = 0; i < ROUNDS; i++)
+    switch_primitive(&main_sp, &peer_sp);
+  report(what, start, 2UL * ROUNDS);
+}
+
+/* Runs on a host thread of its own, away from the minithreads. */
+void* bench_primitives(void* arg) {
+  stack_pointer_t base;
+
+  minithread_allocate_stack(&base, &peer_sp);
+  minithread_initialize_stack(&peer_sp, peer, NULL, peer, NULL);
+
+  bench_primitive("full", minithread_switch);
+  bench_primitive("fast", minithread_switch_fast);
+
+  return NULL;
+}
+
+int yielder(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    minithread_yield();
+  semaphore_V(done);
+
+  return 0;
+}
+
+minithread_t bencher;
+minithread_t peer_thread;
+
+int yield_peer(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    minithread_yield_to(bencher);
+  semaphore_V(done);
+
+  return 0;
+}
+
+int ponger(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_P(ping);
+    semaphore_V(pong);
+  }
+
+  return 0;
+}
+
+int bench(int* arg) {
+  uint64_t start;
+  int i;
+
+  ping = semaphore_create();
+  semaphore_initialize(ping, 0);
+  pong = semaphore_create();
+  semaphore_initialize(pong, 0);
+  done = semaphore_create();
+  semaphore_initialize(done, 0);
+
+  /* Every yield of either thread switches to the other one. */
+  minithread_fork(yielder, NULL);
+  start = currentTimeNanos();
+  for (i = 0; i < ROUNDS; i++)
+    minithread_yield();
+  semaphore_P(done);
+  report("yield", start, 2UL * ROUNDS);
+
+  /* Every P blocks, switching to the thread about to V. */
+  minithread_fork(ponger, NULL);
+  start = currentTimeNanos();
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_V(ping);
+    semaphore_P(pong);
+  }
+  report("semaphore", start, 2UL * ROUNDS);
+
+  /* The same, but each V switches straight to the thread it wakes up. */
+  semaphore_set_handoff(ping, 1);
+  semaphore_set_handoff(pong, 1);
+  minithread_fork(ponger, NULL);
+  start = currentTimeNanos();
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_V(ping);
+    semaphore_P(pong);
+  }
+  report("handoff", start, 2UL * ROUNDS);
+
+  /* Directed yields, back and forth. */
+  bencher = minithread_self();
+  peer_thread = minithread_fork(yield_peer, NULL);
+  start = currentTimeNanos();
+  for (i = 0; i < ROUNDS; i++)
+    minithread_yield_to(peer_thread);
+  semaphore_P(done);
+  report("yield_to", start, 2UL * ROUNDS);
+
+  exit(0);
+}
+
+int main(void) {
+  pthread_t host;
+
+  pthread_create(&host, NULL, bench_primitives, NULL);
+  pthread_join(host, NULL);
+
+  minithread_system_initialize(bench, NULL);
+  return -1;
+}
@@ -0,0 +1,186 @@
+/* tasktest.c
+
+   Stress the fork-join tasks on 4 processors, unless MINITHREAD_CPUS says
+   otherwise, with a worker on each. Workers race to pop the tasks they
+   spawn while the others steal them, so every task of a wide and deep tree
+   has to run exactly once, and every sync has to wait for all of its
+   tasks: leaves mark their own slot, and each round checks all of them.
+   A scope with more tasks than fit on a deque, parallel_for, and several
+   threads starting trees at once with minitask_run are checked the same
+   way. Then, over and over, a task spawns a child while the other workers
+   are left idle long enough to block, and waits for another worker to
+   pick the child up without syncing it: a lost wakeup leaves it waiting.
+   Then the workers are shut down.
+*/
+
+#include "testing.h"
+#include "minitask.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEPTH 14
+#define LEAVES (1 << DEPTH)
+#define ROUNDS 20
+#define WIDE (3 * MINITASK_DEQUE_SIZE)
+#define RANGE (1 << 18)
+#define RUNNERS 4
+#define WAKEUPS 200
+#define IDLE 10                       /* ms to leave the workers idle for */
+
+/* A subtree: the leaves from first, 2^depth of them, each marking its slot. */
+typedef struct tree {
+  int first;
+  int depth;
+  volatile int* marks;
+  long leaves;
+} tree;
+
+int walk(int* arg) {
+  tree* t = (tree*) arg;
+  minitask_scope_t scope = MINITASK_SCOPE_INIT;
+  tree left, right;
+
+  if (t->depth == 0) {
+    t->marks[t->first]++;
+    t->leaves = 1;
+    return 0;
+  }
+
+  left.first = t->first;
+  right.first = t->first + (1 << (t->depth - 1));
+  left.depth = right.depth = t->depth - 1;
+  left.marks = right.marks = t->marks;
+  minitask_spawn(&scope, walk, (int*) &left);
+  minitask_spawn(&scope, walk, (int*) &right);
+  minitask_sync(&scope);
+
+  /* Both halves must be done here, not just on their way. */
+  t->leaves = left.leaves + right.leaves;
+  return 0;
+}
+
+void run_tree(volatile int* marks, char* what) {
+  tree t;
+  int i;
+
+  for (i = 0; i < LEAVES; i++)
+    marks[i] = 0;
+  t.first = 0;
+  t.depth = DEPTH;
+  t.marks = marks;
+  minitask_run(walk, (int*) &t);
+  check(t.leaves == LEAVES, what);
+  for (i = 0; i < LEAVES; i++)
+    check(marks[i] == 1, what);
+}
+
+volatile int tree_marks[LEAVES];
+volatile int wide_marks[WIDE];
+
+int mark_wide(int* arg) {
+  wide_marks[(long) arg]++;
+  return 0;
+}
+
+/* More tasks in one scope than a deque holds: the rest run right away. */
+int wide(int* arg) {
+  minitask_scope_t scope = MINITASK_SCOPE_INIT;
+  long i;
+
+  for (i = 0; i < WIDE; i++)
+    minitask_spawn(&scope, mark_wide, (int*) i);
+  minitask_sync(&scope);
+  return 0;
+}
+
+volatile int range_marks[RANGE];
+
+void mark_range(int i, void* arg) {
+  range_marks[i]++;
+}
+
+volatile int runner_marks[RUNNERS][LEAVES];
+semaphore_t done;
+
+int runner(int* arg) {
+  long id = (long) arg;
+  int round;
+
+  for (round = 0; round < ROUNDS / 4; round++)
+    run_tree(runner_marks[id], "concurrent minitask_run");
+  semaphore_V(done);
+  return 0;
+}
+
+volatile int child_started;
+minithread_t child_worker;
+
+int child(int* arg) {
+  child_worker = minithread_self();
+  child_started = 1;
+  return 0;
+}
+
+/* Spawn a child and let another worker take it, without syncing meanwhile. */
+int wakeup(int* arg) {
+  minitask_scope_t scope = MINITASK_SCOPE_INIT;
+
+  child_started = 0;
+  minitask_spawn(&scope, child, NULL);
+  WAIT_FOR(child_started, "no idle worker woken");
+  check(child_worker != minithread_self(), "child run by its parent");
+  minitask_sync(&scope);
+  return 0;
+}
+
+void test_wakeup() {
+  uint64_t start;
+  int round;
+
+  for (round = 0; round < WAKEUPS; round++) {
+    start = currentTimeNanos();
+    while (currentTimeNanos() - start < IDLE * (uint64_t) MILLISECOND)
+      minithread_yield();
+    minitask_run(wakeup, NULL);
+  }
+}
+
+int test(int* arg) {
+  int round;
+  long i;
+
+  check(minitask_initialize(0) == 0, "initialize");
+
+  for (round = 0; round < ROUNDS; round++)
+    run_tree(tree_marks, "tree");
+
+  minitask_run(wide, NULL);
+  for (i = 0; i < WIDE; i++)
+    check(wide_marks[i] == 1, "wide scope");
+
+  minitask_parallel_for(0, RANGE, 64, mark_range, NULL);
+  for (i = 0; i < RANGE; i++)
+    check(range_marks[i] == 1, "parallel_for");
+
+  done = new_semaphore(0);
+  for (i = 0; i < RUNNERS; i++)
+    minithread_fork(runner, (int*) i);
+  for (i = 0; i < RUNNERS; i++)
+    semaphore_P(done);
+
+  /* With one worker, nobody else could take the child. */
+  if (minithread_get_cpu_count() > 1)
+    test_wakeup();
+
+  minitask_shutdown();
+  printf("tasktest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(4);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,55 @@
+/* testing.c
+
+   Helpers shared by the test programs in p1_tests, see testing.h.
+*/
+
+#define _GNU_SOURCE
+
+#include "testing.h"
+#include "interrupts.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void check(int ok, char* what) {
+  if (!ok) {
+    printf("%s: FAILED: %s\n", program_invocation_short_name, what);
+    exit(1);
+  }
+}
+
+void check_waiting(uint64_t start, char* what) {
+  check(currentTimeNanos() - start < TEST_PATIENCE * (uint64_t) MILLISECOND, what);
+}
+
+void join(semaphore_t done, int count, char* what) {
+  int i;
+
+  for (i = 0; i < count; i++)
+    check(semaphore_P_timeout(done, TEST_PATIENCE) == 0, what);
+}
+
+static int watchdog(int* arg) {
+  minithread_sleep_with_timeout((int) (long) arg);
+  check(0, "timed out");
+  return 0;
+}
+
+void start_watchdog(int ms) {
+  minithread_fork(watchdog, (int*) (long) ms);
+}
+
+semaphore_t new_semaphore(int count) {
+  semaphore_t sem = semaphore_create();
+
+  semaphore_initialize(sem, count);
+  return sem;
+}
+
+unsigned long blocks(minithread_t t, minithread_block_reason_t reason) {
+  minithread_stats_t stats;
+
+  minithread_get_stats(t, &stats);
+  return stats.blocks[reason];
+}
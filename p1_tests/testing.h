@@ -0,0 +1,46 @@
+/* testing.h
+
+   Helpers shared by the test programs in p1_tests. The Makefile builds
+   every program whose name ends in "test" with testing.o linked in, so
+   each test keeps only its own checks.
+*/
+
+#ifndef __TESTING_H__
+#define __TESTING_H__
+
+#include "minithread.h"
+#include "synch.h"
+#include "machineprimitives.h"
+
+/* ms before a thread or a condition waited for is taken to hang */
+#define TEST_PATIENCE 30000
+
+/* Unless ok, print "<program>: FAILED: <what>" and exit(1). */
+extern void check(int ok, char* what);
+
+/* Fail with what if more than TEST_PATIENCE ms went by since start. */
+extern void check_waiting(uint64_t start, char* what);
+
+/* Yield until cond holds, failing with what after TEST_PATIENCE ms. */
+#define WAIT_FOR(cond, what)                                              \
+  do {                                                                    \
+    uint64_t wait_start = currentTimeNanos();                             \
+    while (!(cond)) {                                                     \
+      check_waiting(wait_start, what);                                    \
+      minithread_yield();                                                 \
+    }                                                                     \
+  } while (0)
+
+/* Wait for count threads to V done, failing with what if they hang. */
+extern void join(semaphore_t done, int count, char* what);
+
+/* Fork a thread that fails the test once ms milliseconds have gone by. */
+extern void start_watchdog(int ms);
+
+/* A new semaphore, initialized to count. */
+extern semaphore_t new_semaphore(int count);
+
+/* How many times t has blocked for reason. */
+extern unsigned long blocks(minithread_t t, minithread_block_reason_t reason);
+
+#endif /* __TESTING_H__ */
@@ -0,0 +1,135 @@
+/* ticklesstest.c
+
+   Check the tickless clock, on 4 processors and with a 10 ms quantum
+   unless MINITHREAD_CPUS and MINITHREAD_TICKLESS say otherwise. A thread
+   sleeping 2 ms wakes up no sooner and not much later, where a periodic
+   clock would round the sleep up to a whole period; alarms go off on time
+   the same way while threads spin on every processor, in the middle of
+   their quanta; and once all threads but one are asleep, the idle
+   processors take no clock interrupts at all. How soon a thread woken up
+   by an alarm gets to run past spinning ones is up to the scheduling
+   policy, so that is not checked here.
+*/
+
+#include "testing.h"
+#include "interrupts.h"
+#include "alarm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLEEPS 200
+#define SLEEP 2                       /* ms */
+#define LATE (20 * MILLISECOND)       /* a fifth of a periodic clock's period */
+#define ALARMS 50
+#define ALARM 3                       /* ms */
+#define IDLE 500                      /* ms */
+
+volatile int stop;
+semaphore_t stopped;
+
+int spin(int* arg) {
+  volatile long x = 0;
+
+  while (!stop)
+    x++;
+  semaphore_V(stopped);
+  return 0;
+}
+
+void test_sleep() {
+  uint64_t start, late, worst = 0, total = 0;
+  int i;
+
+  for (i = 0; i < SLEEPS; i++) {
+    start = currentTimeNanos();
+    minithread_sleep_with_timeout(SLEEP);
+    check(currentTimeNanos() - start >= SLEEP * MILLISECOND, "sleep: woken early");
+    late = currentTimeNanos() - start - SLEEP * MILLISECOND;
+    total += late;
+    if (late > worst)
+      worst = late;
+  }
+  check(worst < LATE, "sleep: woken late");
+  printf("ticklesstest: %d ms sleeps woken %.0f us late on average, %.0f us at worst\n",
+         SLEEP, total / SLEEPS / 1e3, worst / 1e3);
+}
+
+uint64_t fired;
+semaphore_t alarmed;
+
+void on_alarm(void* arg) {
+  fired = currentTimeNanos();
+  semaphore_V(alarmed);
+}
+
+void test_alarm() {
+  uint64_t start, late, worst = 0;
+  int i;
+
+  alarmed = new_semaphore(0);
+  for (i = 0; i < ALARMS; i++) {
+    start = currentTimeNanos();
+    register_alarm(ALARM, on_alarm, NULL);
+    semaphore_P(alarmed);
+    check(fired - start >= ALARM * MILLISECOND, "alarm: early");
+    late = fired - start - ALARM * MILLISECOND;
+    if (late > worst)
+      worst = late;
+  }
+  check(worst < LATE, "alarm: late");
+  printf("ticklesstest: %d ms alarms went off %.0f us late at worst, on busy processors\n",
+         ALARM, worst / 1e3);
+}
+
+/* Clock interrupts of every processor over IDLE ms with this thread asleep. */
+void test_idle() {
+  unsigned long before[MINITHREAD_MAX_CPUS];
+  unsigned long taken;
+  int cpus = minithread_get_cpu_count();
+  int busy = 0, i;
+
+  for (i = 0; i < cpus; i++)
+    before[i] = minithread_cpu_clock_interrupts(i);
+  minithread_sleep_with_timeout(IDLE);
+
+  /* The sleep's own alarm wakes up one processor, once or twice. */
+  for (i = 0; i < cpus; i++) {
+    taken = minithread_cpu_clock_interrupts(i) - before[i];
+    printf("ticklesstest: processor %d took %lu clock interrupts in %d ms\n", i, taken, IDLE);
+    if (taken > 0)
+      busy++;
+    check(taken <= 2, "idle: processor interrupted while idle");
+  }
+  check(busy <= 1, "idle: idle processors interrupted");
+}
+
+int test(int* arg) {
+  int cpus = minithread_get_cpu_count();
+  int i;
+
+  check(minithread_clock_is_tickless(), "clock not tickless");
+  stopped = new_semaphore(0);
+
+  test_sleep();
+  for (i = 0; i < cpus; i++)
+    minithread_fork(spin, NULL);
+  test_alarm();
+
+  stop = 1;
+  for (i = 0; i < cpus; i++)
+    semaphore_P(stopped);
+  /* Let the processors run out of work. */
+  minithread_sleep_with_timeout(50);
+  test_idle();
+
+  printf("ticklesstest: ok on %d processors\n", cpus);
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_cpu_count(4);
+  minithread_set_tickless(10 * MILLISECOND);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
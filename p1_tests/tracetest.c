@@ -0,0 +1,214 @@
+/* tracetest.c
+
+   Check the scheduling statistics and the trace exporter, on one processor
+   (run it without MINITHREAD_CPUS) under a policy with time slices, with
+   a 2 ms tickless quantum. With tracing on, two threads yield to each
+   other, one blocks on a semaphore a known number of times, one sleeps a
+   known number of times, and two spin long enough to be preempted. Their
+   blocks[] counters have to match what they did. The trace is then
+   dumped, read back line by line as Chrome trace JSON, and every thread's
+   slices, by how they ended, have to add up to its voluntary and
+   involuntary switches.
+*/
+
+#include "testing.h"
+#include "minithread_trace.h"
+#include "interrupts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define YIELDS 50
+#define BLOCKS 20
+#define SLEEPS 10
+#define SPIN 50                       /* ms */
+#define CAPACITY 100000
+#define LINE 512
+
+enum { YIELDER1, YIELDER2, BLOCKER, SLEEPER, SPINNER1, SPINNER2, THREADS };
+
+minithread_t threads[THREADS];
+int ids[THREADS];
+
+/* Slices read back from the trace, by thread and by how they ended. */
+enum { END_PREEMPT, END_YIELD, END_BLOCK, END_EXIT, ENDS };
+char* end_names[ENDS] = { "preempt", "yield", "block", "exit" };
+int ends[THREADS][ENDS];
+
+semaphore_t ping;
+semaphore_t done;
+
+int yielder(int* arg) {
+  int i;
+
+  ids[*arg] = minithread_id();
+  for (i = 0; i < YIELDS; i++)
+    minithread_yield();
+  semaphore_V(done);
+  return 0;
+}
+
+int blocker(int* arg) {
+  int i;
+
+  ids[*arg] = minithread_id();
+  for (i = 0; i < BLOCKS; i++)
+    semaphore_P(ping);
+  semaphore_V(done);
+  return 0;
+}
+
+int sleeper(int* arg) {
+  int i;
+
+  ids[*arg] = minithread_id();
+  for (i = 0; i < SLEEPS; i++)
+    minithread_sleep_with_timeout(1);
+  semaphore_V(done);
+  return 0;
+}
+
+int spinner(int* arg) {
+  uint64_t start = currentTimeNanos();
+
+  ids[*arg] = minithread_id();
+  while (currentTimeNanos() - start < SPIN * (uint64_t) MILLISECOND)
+    ;
+  semaphore_V(done);
+  return 0;
+}
+
+void run_workload() {
+  static int which[THREADS];
+  proc_t procs[THREADS] = { yielder, yielder, blocker, sleeper, spinner, spinner };
+  int i;
+
+  for (i = 0; i < THREADS; i++) {
+    which[i] = i;
+    threads[i] = minithread_fork(procs[i], &which[i]);
+    check(threads[i] != NULL, "fork");
+  }
+  /* Wake the blocker up once it has had time to block every time. */
+  for (i = 0; i < BLOCKS; i++) {
+    minithread_sleep_with_timeout(2);
+    semaphore_V(ping);
+  }
+  join(done, THREADS, "workload hung");
+}
+
+/* Read the dumped trace back, counting slices by thread and end. */
+void read_trace(char* path) {
+  char line[LINE];
+  char end[16];
+  FILE* in = fopen(path, "r");
+  double ts, dur, last_ts = -1;
+  int metadata = 0, slices = 0, closed = 0;
+  int thread, tid, cpu, level, len, i, e;
+
+  check(in != NULL, "trace: open");
+  check(fgets(line, LINE, in) != NULL && strcmp(line, "{\"traceEvents\":[\n") == 0, "trace: header");
+
+  while (fgets(line, LINE, in) != NULL) {
+    check(!closed, "trace: events after the end");
+    len = strlen(line);
+    check(len > 1 && line[len - 1] == '\n', "trace: line too long");
+    line[--len] = '\0';
+    if (strcmp(line, "]}") == 0) {
+      closed = 1;
+      continue;
+    }
+    if (line[len - 1] == ',')
+      line[--len] = '\0';
+
+    if (sscanf(line, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+               "\"args\":{\"name\":\"cpu %d\"}}", &tid, &cpu) == 2) {
+      check(tid == cpu && cpu < minithread_get_cpu_count(), "trace: processor name");
+      metadata++;
+      continue;
+    }
+
+    check(sscanf(line, "{\"name\":\"thread %d\",\"cat\":\"run\",\"ph\":\"X\",\"ts\":%lf,"
+                 "\"dur\":%lf,\"pid\":0,\"tid\":%d,\"args\":{\"level\":%d,\"end\":\"%15[a-z]\"}}",
+                 &thread, &ts, &dur, &tid, &level, end) == 6, "trace: unreadable event");
+    check(line[len - 1] == '}' && line[len - 2] == '}', "trace: event not closed");
+    check(ts >= last_ts && dur >= 0, "trace: slices out of order");
+    last_ts = ts;
+    slices++;
+
+    for (e = 0; e < ENDS && strcmp(end, end_names[e]) != 0; e++)
+      ;
+    check(e < ENDS, "trace: unknown end");
+    for (i = 0; i < THREADS; i++)
+      if (ids[i] == thread)
+        ends[i][e]++;
+  }
+  check(closed, "trace: not closed");
+  check(metadata == minithread_get_cpu_count(), "trace: processors");
+  fclose(in);
+  printf("tracetest: read back %d slices\n", slices);
+}
+
+int test(int* arg) {
+  char path[] = "/tmp/tracetestXXXXXX";
+  minithread_stats_t stats;
+  int fd, i;
+
+  ping = new_semaphore(0);
+  done = new_semaphore(0);
+
+  check(minithread_trace_start(0) == -1, "trace_start without room");
+  check(minithread_trace_start(CAPACITY) == 0, "trace_start");
+  run_workload();
+  minithread_trace_stop();
+
+  fd = mkstemp(path);
+  check(fd != -1, "mkstemp");
+  close(fd);
+  check(minithread_trace_dump(path) == 0, "trace_dump");
+  read_trace(path);
+  unlink(path);
+
+  for (i = 0; i < THREADS; i++) {
+    minithread_get_stats(threads[i], &stats);
+    printf("tracetest: thread %d: %lu voluntary, %lu involuntary switches; "
+           "%d yield, %d block, %d exit, %d preempt slices\n", ids[i], stats.voluntary_switches,
+           stats.involuntary_switches, ends[i][END_YIELD], ends[i][END_BLOCK], ends[i][END_EXIT],
+           ends[i][END_PREEMPT]);
+    check(ends[i][END_EXIT] == 1, "trace: thread did not exit once");
+    check(stats.voluntary_switches ==
+          (unsigned long) (ends[i][END_YIELD] + ends[i][END_BLOCK] + ends[i][END_EXIT]),
+          "voluntary switches do not match the trace");
+    check(stats.involuntary_switches == (unsigned long) ends[i][END_PREEMPT],
+          "involuntary switches do not match the trace");
+  }
+
+  /* What the workload did. */
+  for (i = YIELDER1; i <= YIELDER2; i++) {
+    check(ends[i][END_YIELD] > 0 && ends[i][END_YIELD] <= YIELDS, "yielder: yields");
+    check(ends[i][END_BLOCK] == 0, "yielder: blocked");
+  }
+  minithread_get_stats(threads[BLOCKER], &stats);
+  check(stats.blocks[MINITHREAD_BLOCK_SEMAPHORE] == BLOCKS, "blocker: semaphore blocks");
+  check(ends[BLOCKER][END_BLOCK] == BLOCKS, "blocker: block slices");
+  check(stats.last_block_reason == MINITHREAD_BLOCK_SEMAPHORE, "blocker: last block reason");
+  minithread_get_stats(threads[SLEEPER], &stats);
+  check(stats.blocks[MINITHREAD_BLOCK_SLEEP] == SLEEPS, "sleeper: sleep blocks");
+  check(stats.blocks[MINITHREAD_BLOCK_SEMAPHORE] == 0, "sleeper: semaphore blocks");
+  check(ends[SLEEPER][END_BLOCK] == SLEEPS, "sleeper: block slices");
+  for (i = SPINNER1; i <= SPINNER2; i++) {
+    minithread_get_stats(threads[i], &stats);
+    check(stats.involuntary_switches > 0, "spinner: never preempted");
+    check(stats.run_time >= SPIN * (uint64_t) MILLISECOND / 4, "spinner: run time");
+  }
+
+  printf("tracetest: ok on %d processors\n", minithread_get_cpu_count());
+  exit(0);
+}
+
+int main(void) {
+  minithread_set_tickless(2 * MILLISECOND);
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
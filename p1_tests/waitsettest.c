@@ -0,0 +1,190 @@
+/* waitsettest.c
+
+   Check wait sets over semaphores. A level-triggered semaphore is reported
+   by every wait for as long as its count is positive, an edge-triggered
+   one once per V; a semaphore ready when it is added is reported at once;
+   a wait reporting fewer than are ready reports the others next time; a
+   V wakes up a thread waiting on the set; waits time out, and polls do not
+   block; and destroying a semaphore takes it out of the sets watching it.
+*/
+
+#include "testing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DATA(n) ((void*) (intptr_t) (n))
+
+/* Poll ws for one semaphore, and return its data, or NULL. */
+void* poll_one(waitset_t ws) {
+  void* ready[1];
+
+  return waitset_wait(ws, ready, 1, 0) == 1 ? ready[0] : NULL;
+}
+
+void test_level() {
+  waitset_t ws = waitset_create();
+  semaphore_t sem = new_semaphore(0);
+
+  check(waitset_add(ws, sem, WAITSET_LEVEL, DATA(1)) == 0, "level: add");
+  check(waitset_add(ws, sem, WAITSET_LEVEL, DATA(1)) == -1, "level: added twice");
+  check(poll_one(ws) == NULL, "level: ready at 0");
+  semaphore_V(sem);
+  semaphore_V(sem);
+  check(poll_one(ws) == DATA(1), "level: ready after V");
+  check(poll_one(ws) == DATA(1), "level: still ready");
+  semaphore_P(sem);
+  check(poll_one(ws) == DATA(1), "level: ready while positive");
+  semaphore_P(sem);
+  check(poll_one(ws) == NULL, "level: ready once drained");
+  check(waitset_remove(ws, sem) == 0, "level: remove");
+  check(waitset_remove(ws, sem) == -1, "level: removed twice");
+
+  semaphore_destroy(sem);
+  waitset_destroy(ws);
+}
+
+void test_edge() {
+  waitset_t ws = waitset_create();
+  semaphore_t sem = new_semaphore(0);
+
+  check(waitset_add(ws, sem, WAITSET_EDGE, DATA(2)) == 0, "edge: add");
+  semaphore_V(sem);
+  semaphore_V(sem);
+  check(poll_one(ws) == DATA(2), "edge: ready after V");
+  check(poll_one(ws) == NULL, "edge: reported twice for one edge");
+  semaphore_V(sem);
+  check(poll_one(ws) == DATA(2), "edge: ready after another V");
+  check(poll_one(ws) == NULL, "edge: reported twice for the second edge");
+
+  semaphore_destroy(sem);
+  waitset_destroy(ws);
+}
+
+void test_ready_at_add() {
+  waitset_t ws = waitset_create();
+  semaphore_t level = new_semaphore(1);
+  semaphore_t edge = new_semaphore(1);
+  void* ready[2];
+
+  waitset_add(ws, level, WAITSET_LEVEL, DATA(3));
+  waitset_add(ws, edge, WAITSET_EDGE, DATA(4));
+  check(waitset_wait(ws, ready, 2, 0) == 2 && ready[0] == DATA(3) && ready[1] == DATA(4),
+        "add: ready semaphores reported");
+
+  waitset_destroy(ws);
+  semaphore_destroy(level);
+  semaphore_destroy(edge);
+}
+
+void test_partial() {
+  waitset_t ws = waitset_create();
+  semaphore_t sems[3];
+  void* ready[2];
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    sems[i] = new_semaphore(0);
+    waitset_add(ws, sems[i], WAITSET_LEVEL, DATA(10 + i));
+    semaphore_V(sems[i]);
+  }
+  check(waitset_wait(ws, ready, 2, 0) == 2 && ready[0] == DATA(10) && ready[1] == DATA(11),
+        "partial: first two");
+  check(waitset_wait(ws, ready, 2, 0) == 2 && ready[0] == DATA(12) && ready[1] == DATA(10),
+        "partial: the one left out comes first");
+
+  waitset_destroy(ws);
+  for (i = 0; i < 3; i++)
+    semaphore_destroy(sems[i]);
+}
+
+waitset_t shared;
+semaphore_t later;
+void* woken_with;
+semaphore_t done;
+
+int waiter(int* arg) {
+  void* ready[1];
+
+  if (waitset_wait(shared, ready, 1, -1) == 1)
+    woken_with = ready[0];
+  semaphore_V(done);
+  return 0;
+}
+
+void test_wakeup() {
+  shared = waitset_create();
+  later = new_semaphore(0);
+  done = new_semaphore(0);
+  woken_with = NULL;
+
+  waitset_add(shared, later, WAITSET_EDGE, DATA(5));
+  minithread_fork(waiter, NULL);
+  minithread_sleep_with_timeout(20);
+  check(woken_with == NULL, "wakeup: woken before the V");
+  semaphore_V(later);
+  semaphore_P(done);
+  check(woken_with == DATA(5), "wakeup: woken by the V");
+
+  waitset_destroy(shared);
+  semaphore_destroy(later);
+  semaphore_destroy(done);
+}
+
+void test_timeout() {
+  waitset_t ws = waitset_create();
+  semaphore_t sem = new_semaphore(0);
+  void* ready[1];
+  uint64_t start;
+
+  waitset_add(ws, sem, WAITSET_LEVEL, DATA(6));
+  start = currentTimeNanos();
+  check(waitset_wait(ws, ready, 1, 0) == 0, "timeout: poll");
+  check(waitset_wait(ws, ready, 1, 50) == 0, "timeout: wait");
+  check(currentTimeNanos() - start >= 40000000ULL, "timeout: returned early");
+
+  waitset_destroy(ws);
+  semaphore_destroy(sem);
+}
+
+void test_destroy() {
+  waitset_t first = waitset_create();
+  waitset_t second = waitset_create();
+  semaphore_t gone = new_semaphore(0);
+  semaphore_t kept = new_semaphore(0);
+
+  waitset_add(first, gone, WAITSET_LEVEL, DATA(7));
+  waitset_add(second, gone, WAITSET_EDGE, DATA(7));
+  waitset_add(second, kept, WAITSET_EDGE, DATA(8));
+  semaphore_V(gone);
+
+  /* Ready in both sets, then destroyed: neither reports it any more. */
+  semaphore_destroy(gone);
+  check(poll_one(first) == NULL, "destroy: level entry left behind");
+  check(poll_one(second) == NULL, "destroy: edge entry left behind");
+  semaphore_V(kept);
+  check(poll_one(second) == DATA(8), "destroy: other entry dropped");
+
+  waitset_destroy(first);
+  waitset_destroy(second);
+  semaphore_destroy(kept);
+}
+
+int test(int* arg) {
+  test_level();
+  test_edge();
+  test_ready_at_add();
+  test_partial();
+  test_wakeup();
+  test_timeout();
+  test_destroy();
+  printf("waitsettest: ok\n");
+
+  exit(0);
+}
+
+int main(void) {
+  minithread_system_initialize(test, NULL);
+  return -1;
+}
@@ -0,0 +1,135 @@
+/*
+ * Preemption and the FPU state: threads keep a value of their own in SSE,
+ * AVX and, where the processor has them, AVX-512 registers (the upper half
+ * of a ZMM register, one of ZMM16-31 and an opmask), while spinning long
+ * enough to be interrupted many times, then check it is still there. The
+ * interrupt trampoline has to restore every one of these components.
+ */
+
+#include "minithread.h"
+#include "synch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 3
+#define ROUNDS 5
+#define SPIN 100000000L
+
+semaphore_t done;
+int corrupted = 0;
+
+static void check(char* what, long id, long got) {
+  if (got != id) {
+    printf("%s thread %ld found %ld\n", what, id, got);
+    corrupted++;
+  }
+}
+
+int sse(int* arg) {
+  long id = (long) arg;
+  long lo, hi;
+  int r;
+
+  for (r = 0; r < ROUNDS; r++) {
+    __asm__ volatile(
+        "movq %2, %%xmm5\n\t"
+        "punpcklqdq %%xmm5, %%xmm5\n\t"
+        "movq %3, %%rcx\n"
+        "1:\n\t"
+        "decq %%rcx\n\t"
+        "jnz 1b\n\t"
+        "movq %%xmm5, %0\n\t"
+        "punpckhqdq %%xmm5, %%xmm5\n\t"
+        "movq %%xmm5, %1\n\t"
+        : "=r"(lo), "=r"(hi)
+        : "r"(id), "r"(SPIN)
+        : "rcx", "xmm5", "cc");
+    check("sse low", id, lo);
+    check("sse high", id, hi);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+__attribute__((target("avx"))) int avx(int* arg) {
+  long id = (long) arg;
+  long out[4];
+  int r, i;
+
+  for (r = 0; r < ROUNDS; r++) {
+    __asm__ volatile(
+        "vbroadcastsd %1, %%ymm6\n\t"
+        "movq %2, %%rcx\n"
+        "1:\n\t"
+        "decq %%rcx\n\t"
+        "jnz 1b\n\t"
+        "vmovdqu %%ymm6, %0\n\t"
+        "vzeroupper\n\t"
+        : "=m"(out)
+        : "m"(id), "r"(SPIN)
+        : "rcx", "xmm6", "cc");
+    for (i = 0; i < 4; i++)
+      check("avx", id, out[i]);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+__attribute__((target("avx512f"))) int avx512(int* arg) {
+  long id = (long) arg;
+  long low[8], high[8];
+  long mask = 0;
+  int r, i;
+
+  for (r = 0; r < ROUNDS; r++) {
+    __asm__ volatile(
+        "vpbroadcastq %3, %%zmm7\n\t"
+        "vpbroadcastq %3, %%zmm23\n\t"
+        "kmovw %k3, %%k3\n\t"
+        "movq %4, %%rcx\n"
+        "1:\n\t"
+        "decq %%rcx\n\t"
+        "jnz 1b\n\t"
+        "vmovdqu64 %%zmm7, %0\n\t"
+        "vmovdqu64 %%zmm23, %1\n\t"
+        "kmovw %%k3, %k2\n\t"
+        "vzeroupper\n\t"
+        : "=m"(low), "=m"(high), "=r"(mask)
+        : "r"(id), "r"(SPIN)
+        : "rcx", "xmm7", "xmm23", "k3", "cc");
+    for (i = 0; i < 8; i++) {
+      check("zmm", id, low[i]);
+      check("zmm16-31", id, high[i]);
+    }
+    check("opmask", id, mask);
+  }
+  semaphore_V(done);
+  return 0;
+}
+
+int run(int* arg) {
+  int avx512_threads = __builtin_cpu_supports("avx512f") ? THREADS : 0;
+  long i;
+
+  done = semaphore_create();
+  semaphore_initialize(done, 0);
+
+  for (i = 1; i <= THREADS; i++) {
+    minithread_fork(sse, (int*) i);
+    minithread_fork(avx, (int*) (i + 10));
+    if (avx512_threads)
+      minithread_fork(avx512, (int*) (i + 20));
+  }
+  for (i = 0; i < 2 * THREADS + avx512_threads; i++)
+    semaphore_P(done);
+
+  printf("%s: %d corrupted, AVX-512 %s\n", corrupted ? "FAILED" : "ok", corrupted,
+         avx512_threads ? "checked" : "not available");
+  exit(corrupted != 0);
+}
+
+int main(void) {
+  minithread_system_initialize(run, NULL);
+  return -1;
+}
@@ -0,0 +1,289 @@
+/*
+ * Intrusive red-black tree implementation.
+ *
+ */
+#include "rbtree.h"
+
+// Leaves are NULL and count as black. The root is black, a red node has
+// black children, and every path from a node down to its leaves goes
+// through as many black nodes, so no path is more than twice as long as
+// another.
+
+/*
+ * Initialize an empty tree.
+ */
+void
+rbtree_init(rbtree_t tree) {
+	tree->root = NULL;
+	tree->leftmost = NULL;
+	tree->size = 0;
+}
+
+/*
+ * Initialize a node as not being in any tree.
+ */
+void
+rbtree_node_init(rbtree_node_t node) {
+	node->parent = NULL;
+	node->left = NULL;
+	node->right = NULL;
+	node->red = 0;
+}
+
+static int
+rbtree_is_red(rbtree_node_t node) {
+	return node != NULL && node->red;
+}
+
+// Put new in the place of old under old's parent.
+static void
+rbtree_replace_child(rbtree_t tree, rbtree_node_t old, rbtree_node_t new) {
+	if (old->parent == NULL) tree->root = new;
+	else if (old == old->parent->left) old->parent->left = new;
+	else old->parent->right = new;
+}
+
+static void
+rbtree_rotate_left(rbtree_t tree, rbtree_node_t x) {
+	rbtree_node_t y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL) y->left->parent = x;
+	y->parent = x->parent;
+	rbtree_replace_child(tree, x, y);
+	y->left = x;
+	x->parent = y;
+}
+
+static void
+rbtree_rotate_right(rbtree_t tree, rbtree_node_t x) {
+	rbtree_node_t y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL) y->right->parent = x;
+	y->parent = x->parent;
+	rbtree_replace_child(tree, x, y);
+	y->right = x;
+	x->parent = y;
+}
+
+// Restore the invariants after a red node was inserted.
+static void
+rbtree_insert_fixup(rbtree_t tree, rbtree_node_t node) {
+	rbtree_node_t parent;
+	rbtree_node_t grandparent;
+	rbtree_node_t uncle;
+
+	while ((parent = node->parent) != NULL && parent->red) {
+		// A red parent is not the root, so there is a grandparent.
+		grandparent = parent->parent;
+
+		if (parent == grandparent->left) {
+			uncle = grandparent->right;
+			if (rbtree_is_red(uncle)) {
+				parent->red = 0;
+				uncle->red = 0;
+				grandparent->red = 1;
+				node = grandparent;
+				continue;
+			}
+			if (node == parent->right) {
+				rbtree_rotate_left(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = 0;
+			grandparent->red = 1;
+			rbtree_rotate_right(tree, grandparent);
+		} else {
+			uncle = grandparent->left;
+			if (rbtree_is_red(uncle)) {
+				parent->red = 0;
+				uncle->red = 0;
+				grandparent->red = 1;
+				node = grandparent;
+				continue;
+			}
+			if (node == parent->left) {
+				rbtree_rotate_right(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = 0;
+			grandparent->red = 1;
+			rbtree_rotate_left(tree, grandparent);
+		}
+	}
+
+	tree->root->red = 0;
+}
+
+/*
+ * Insert a node in the tree, after the nodes that do not go after it.
+ */
+void
+rbtree_insert(rbtree_t tree, rbtree_node_t node, rbtree_less_t less) {
+	rbtree_node_t parent = NULL;
+	rbtree_node_t *link = &tree->root;
+	int leftmost = 1;
+
+	while (*link != NULL) {
+		parent = *link;
+		if (less(node, parent)) {
+			link = &parent->left;
+		} else {
+			link = &parent->right;
+			leftmost = 0;
+		}
+	}
+
+	node->parent = parent;
+	node->left = NULL;
+	node->right = NULL;
+	node->red = 1;
+	*link = node;
+
+	if (leftmost) tree->leftmost = node;
+	tree->size++;
+
+	rbtree_insert_fixup(tree, node);
+}
+
+// Restore the invariants after a black node was taken out from above node,
+// which may be a NULL leaf, hence its parent being given.
+static void
+rbtree_delete_fixup(rbtree_t tree, rbtree_node_t node, rbtree_node_t parent) {
+	rbtree_node_t sibling;
+
+	while (node != tree->root && !rbtree_is_red(node)) {
+		// The path through node is one black short, so its sibling is not a leaf.
+		if (node == parent->left) {
+			sibling = parent->right;
+			if (sibling->red) {
+				sibling->red = 0;
+				parent->red = 1;
+				rbtree_rotate_left(tree, parent);
+				sibling = parent->right;
+			}
+			if (!rbtree_is_red(sibling->left) && !rbtree_is_red(sibling->right)) {
+				sibling->red = 1;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (!rbtree_is_red(sibling->right)) {
+				sibling->left->red = 0;
+				sibling->red = 1;
+				rbtree_rotate_right(tree, sibling);
+				sibling = parent->right;
+			}
+			sibling->red = parent->red;
+			parent->red = 0;
+			sibling->right->red = 0;
+			rbtree_rotate_left(tree, parent);
+		} else {
+			sibling = parent->left;
+			if (sibling->red) {
+				sibling->red = 0;
+				parent->red = 1;
+				rbtree_rotate_right(tree, parent);
+				sibling = parent->left;
+			}
+			if (!rbtree_is_red(sibling->left) && !rbtree_is_red(sibling->right)) {
+				sibling->red = 1;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (!rbtree_is_red(sibling->left)) {
+				sibling->right->red = 0;
+				sibling->red = 1;
+				rbtree_rotate_left(tree, sibling);
+				sibling = parent->left;
+			}
+			sibling->red = parent->red;
+			parent->red = 0;
+			sibling->left->red = 0;
+			rbtree_rotate_right(tree, parent);
+		}
+		node = tree->root;
+	}
+
+	if (node != NULL) node->red = 0;
+}
+
+/*
+ * Remove a node from the tree it is in.
+ */
+void
+rbtree_delete(rbtree_t tree, rbtree_node_t node) {
+	rbtree_node_t removed;
+	rbtree_node_t child;
+	rbtree_node_t parent;
+	int removed_red;
+
+	if (tree->leftmost == node) tree->leftmost = rbtree_next(node);
+
+	// The node taken out of the tree is node itself if it has a free
+	// child, otherwise its successor, which then takes node's place.
+	if (node->left == NULL || node->right == NULL) {
+		removed = node;
+	} else {
+		removed = node->right;
+		while (removed->left != NULL) removed = removed->left;
+	}
+
+	child = removed->left != NULL ? removed->left : removed->right;
+	parent = removed->parent;
+	removed_red = removed->red;
+
+	if (child != NULL) child->parent = parent;
+	rbtree_replace_child(tree, removed, child);
+
+	if (removed != node) {
+		if (parent == node) parent = removed;
+		removed->parent = node->parent;
+		removed->left = node->left;
+		removed->right = node->right;
+		removed->red = node->red;
+		rbtree_replace_child(tree, node, removed);
+		if (removed->left != NULL) removed->left->parent = removed;
+		if (removed->right != NULL) removed->right->parent = removed;
+	}
+
+	if (!removed_red) rbtree_delete_fixup(tree, child, parent);
+
+	tree->size--;
+	rbtree_node_init(node);
+}
+
+/*
+ * Return the first node of the tree, or NULL if it is empty.
+ */
+rbtree_node_t
+rbtree_first(rbtree_t tree) {
+	return tree->leftmost;
+}
+
+/*
+ * Return the node after the given one, or NULL at the end of the tree.
+ */
+rbtree_node_t
+rbtree_next(rbtree_node_t node) {
+	if (node->right != NULL) {
+		node = node->right;
+		while (node->left != NULL) node = node->left;
+		return node;
+	}
+
+	while (node->parent != NULL && node == node->parent->right) node = node->parent;
+	return node->parent;
+}
+
+/*
+ * Return the number of nodes in the tree.
+ */
+int
+rbtree_size(rbtree_t tree) {
+	return tree->size;
+}
@@ -0,0 +1,80 @@
+/*
+ * Intrusive red-black tree manipulation functions
+ */
+#ifndef __RBTREE_H__
+#define __RBTREE_H__
+
+#include <stddef.h>
+
+/*
+ * Like an intrusive queue, the tree does not allocate nodes: every object
+ * that can be put in the tree carries an rbtree_node of its own. The tree
+ * stays balanced, so inserting and deleting take O(log n), and it keeps
+ * track of its leftmost node, so finding the first one takes O(1).
+ *
+ * Nodes are ordered by a comparison function given at insertion. Nodes
+ * that compare equal stay in the order they were inserted in.
+ */
+typedef struct rbtree_node {
+	struct rbtree_node *parent;
+	struct rbtree_node *left;
+	struct rbtree_node *right;
+	int red;
+} rbtree_node;
+typedef rbtree_node *rbtree_node_t;
+
+typedef struct rbtree {
+	rbtree_node_t root;
+	rbtree_node_t leftmost;
+	int size;
+} rbtree;
+typedef rbtree *rbtree_t;
+
+/*
+ * Return nonzero if a goes before b.
+ */
+typedef int (*rbtree_less_t)(rbtree_node_t a, rbtree_node_t b);
+
+/*
+ * Get back the object a node is embedded in, given its type and the name of
+ * the node field.
+ */
+#define rbtree_entry(node, type, member) \
+	((type *) ((char *) (node) - offsetof(type, member)))
+
+/*
+ * Initialize an empty tree.
+ */
+extern void rbtree_init(rbtree_t tree);
+
+/*
+ * Initialize a node as not being in any tree.
+ */
+extern void rbtree_node_init(rbtree_node_t node);
+
+/*
+ * Insert a node in the tree, after the nodes that do not go after it.
+ */
+extern void rbtree_insert(rbtree_t tree, rbtree_node_t node, rbtree_less_t less);
+
+/*
+ * Remove a node from the tree it is in.
+ */
+extern void rbtree_delete(rbtree_t tree, rbtree_node_t node);
+
+/*
+ * Return the first node of the tree, or NULL if it is empty.
+ */
+extern rbtree_node_t rbtree_first(rbtree_t tree);
+
+/*
+ * Return the node after the given one, or NULL at the end of the tree.
+ */
+extern rbtree_node_t rbtree_next(rbtree_node_t node);
+
+/*
+ * Return the number of nodes in the tree.
+ */
+extern int rbtree_size(rbtree_t tree);
+
+#endif /*__RBTREE_H__*/
@@ -0,0 +1,121 @@
+/*
+ * Completely fair scheduling policy.
+ *
+ */
+#include <stdlib.h>
+
+#include "interrupts.h"
+#include "minithread_private.h"
+#include "rbtree.h"
+#include "scheduler_policy.h"
+
+/*
+	Every thread has a virtual runtime, which advances with the processor
+	time it is charged, in nanoseconds, measured at every context switch, and
+	more slowly the more tickets it has. The runnable threads are kept in a
+	red-black tree ordered by virtual runtime, and the leftmost one runs
+	next.
+
+	min_vtime follows the smallest virtual runtime of the queue and never goes
+	back. A thread that wakes up, or comes from another processor, is placed
+	no further back than CFS_SLEEPER_CREDIT behind it: a sleeper gets to run
+	soon, but cannot claim the time it spent asleep. It preempts the running
+	thread if that one is ahead by more than CFS_WAKEUP_GRANULARITY.
+*/
+
+#define CFS_SLEEPER_CREDIT (10 * MILLISECOND)
+#define CFS_WAKEUP_GRANULARITY (1 * MILLISECOND)
+
+typedef struct cfs {
+	rbtree 		tree;
+	uint64_t 	min_vtime;
+} cfs;
+
+#define minithread_of_node(node) rbtree_entry(node, minithread, run_node)
+
+//Virtual runtimes are compared by their difference, so that they can wrap around.
+static int cfs_less(rbtree_node_t a, rbtree_node_t b){
+	return (int64_t) (minithread_of_node(a)->vtime - minithread_of_node(b)->vtime) < 0;
+}
+
+//Virtual runtime for ran nanoseconds of processor time.
+static uint64_t cfs_scale(minithread_t t, uint64_t ran){
+	return ran * MINITHREAD_TICKETS_DEFAULT / t->tickets;
+}
+
+//Advance the virtual runtime of t by the time it ran since it was last charged.
+static void cfs_charge(minithread_t t){
+	t->vtime += cfs_scale(t, t->stats.run_time - t->vtime_charged);
+	t->vtime_charged = t->stats.run_time;
+}
+
+static void *cfs_create(){
+	cfs *c = (cfs *) malloc(sizeof(cfs));
+	if(c == NULL) return NULL;
+
+	rbtree_init(&c->tree);
+	c->min_vtime = 0;
+	return c;
+}
+
+static void cfs_destroy(void *run_queue){
+	free(run_queue);
+}
+
+static void cfs_enqueue(void *run_queue, minithread_t t){
+	cfs *c = (cfs *) run_queue;
+	uint64_t floor = c->min_vtime - CFS_SLEEPER_CREDIT;
+
+	cfs_charge(t);
+	if((int64_t) (t->vtime - floor) < 0) t->vtime = floor;
+	rbtree_insert(&c->tree, &t->run_node, cfs_less);
+}
+
+static void cfs_wake(void *run_queue, minithread_t t){
+	cfs_enqueue(run_queue, t);
+}
+
+static minithread_t cfs_dequeue(void *run_queue){
+	cfs *c = (cfs *) run_queue;
+	rbtree_node_t node = rbtree_first(&c->tree);
+	minithread_t t;
+
+	if(node == NULL) return NULL;
+
+	rbtree_delete(&c->tree, node);
+	t = minithread_of_node(node);
+	if((int64_t) (t->vtime - c->min_vtime) > 0) c->min_vtime = t->vtime;
+	return t;
+}
+
+static void cfs_remove(void *run_queue, minithread_t t){
+	cfs *c = (cfs *) run_queue;
+
+	rbtree_delete(&c->tree, &t->run_node);
+}
+
+//A thread runs for a quantum at a time, then goes on again only if it is still the leftmost.
+static int cfs_tick(void *run_queue, minithread_t t, int quanta){
+	return quanta >= 1 ? 0 : 1;
+}
+
+//Whether t, just woken up, should preempt current, counting the time current has run so far.
+static int cfs_preempt(void *run_queue, minithread_t current, minithread_t t){
+	uint64_t ran = current->stats.run_time + (currentTimeNanos() - current->running_since) -
+		current->vtime_charged;
+
+	return (int64_t) (current->vtime + cfs_scale(current, ran) - t->vtime) >
+		(int64_t) CFS_WAKEUP_GRANULARITY;
+}
+
+const scheduler_ops scheduler_cfs = {
+	"cfs",
+	cfs_create,
+	cfs_destroy,
+	cfs_wake,
+	cfs_enqueue,
+	cfs_dequeue,
+	cfs_remove,
+	cfs_tick,
+	cfs_preempt
+};
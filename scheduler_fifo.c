@@ -0,0 +1,67 @@
+/*
+ * First come, first served scheduling policy.
+ *
+ */
+#include <stdlib.h>
+
+#include "minithread_private.h"
+#include "intrusive_queue.h"
+#include "scheduler_policy.h"
+
+// A single queue, and no time slices: a thread only gives the processor up
+// when it blocks or yields, or for a thread of higher priority.
+typedef struct fifo {
+	iqueue 		queue;
+} fifo;
+
+static void *fifo_create(){
+	fifo *f = (fifo *) malloc(sizeof(fifo));
+	if(f == NULL) return NULL;
+
+	iqueue_init(&f->queue);
+	return f;
+}
+
+static void fifo_destroy(void *run_queue){
+	free(run_queue);
+}
+
+static void fifo_enqueue(void *run_queue, minithread_t t){
+	fifo *f = (fifo *) run_queue;
+
+	iqueue_append(&f->queue, &t->queue_link);
+}
+
+static void fifo_wake(void *run_queue, minithread_t t){
+	fifo_enqueue(run_queue, t);
+}
+
+static minithread_t fifo_dequeue(void *run_queue){
+	fifo *f = (fifo *) run_queue;
+	iqueue_link_t link;
+
+	if(iqueue_dequeue(&f->queue, &link) == -1) return NULL;
+	return minithread_of(link);
+}
+
+static void fifo_remove(void *run_queue, minithread_t t){
+	fifo *f = (fifo *) run_queue;
+
+	iqueue_delete(&f->queue, &t->queue_link);
+}
+
+static int fifo_tick(void *run_queue, minithread_t t, int quanta){
+	return -1;
+}
+
+const scheduler_ops scheduler_fifo = {
+	"fifo",
+	fifo_create,
+	fifo_destroy,
+	fifo_wake,
+	fifo_enqueue,
+	fifo_dequeue,
+	fifo_remove,
+	fifo_tick,
+	NULL
+};
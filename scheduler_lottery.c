@@ -0,0 +1,84 @@
+/*
+ * Lottery scheduling policy.
+ *
+ */
+#include <stdlib.h>
+
+#include "minithread_private.h"
+#include "intrusive_queue.h"
+#include "random.h"
+#include "scheduler_policy.h"
+
+// Every dequeue draws one of the tickets of the queued threads at random,
+// and the thread holding it runs next: on average, every thread gets
+// processor time in proportion to its tickets. Drawing walks the queue.
+typedef struct lottery {
+	iqueue 			queue;
+	unsigned int 	tickets;
+} lottery;
+
+static void *lottery_create(){
+	lottery *l = (lottery *) malloc(sizeof(lottery));
+	if(l == NULL) return NULL;
+
+	iqueue_init(&l->queue);
+	l->tickets = 0;
+	return l;
+}
+
+static void lottery_destroy(void *run_queue){
+	free(run_queue);
+}
+
+static void lottery_enqueue(void *run_queue, minithread_t t){
+	lottery *l = (lottery *) run_queue;
+
+	iqueue_append(&l->queue, &t->queue_link);
+	l->tickets += t->tickets;
+}
+
+static void lottery_wake(void *run_queue, minithread_t t){
+	lottery_enqueue(run_queue, t);
+}
+
+static void lottery_remove(void *run_queue, minithread_t t){
+	lottery *l = (lottery *) run_queue;
+
+	iqueue_delete(&l->queue, &t->queue_link);
+	l->tickets -= t->tickets;
+}
+
+static minithread_t lottery_dequeue(void *run_queue){
+	lottery *l = (lottery *) run_queue;
+	iqueue_link_t link;
+	unsigned int winner;
+
+	if(iqueue_length(&l->queue) == 0) return NULL;
+
+	//genintrand draws from 1 to tickets.
+	winner = genintrand(l->tickets);
+	for(link = iqueue_first(&l->queue); link != NULL; link = iqueue_next(&l->queue, link)){
+		if(winner <= minithread_of(link)->tickets) break;
+		winner -= minithread_of(link)->tickets;
+	}
+
+	lottery_remove(run_queue, minithread_of(link));
+	return minithread_of(link);
+}
+
+//Every thread runs for one quantum at a time.
+static int lottery_tick(void *run_queue, minithread_t t, int quanta){
+	return quanta >= 1 ? 0 : 1;
+}
+
+const scheduler_ops scheduler_lottery = {
+	"lottery",
+	lottery_create,
+	lottery_destroy,
+	lottery_wake,
+	lottery_enqueue,
+	lottery_dequeue,
+	lottery_remove,
+	lottery_tick,
+	NULL
+};
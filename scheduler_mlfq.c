@@ -0,0 +1,133 @@
+/*
+ * Multilevel feedback queue scheduling policy.
+ *
+ */
+#include <stdlib.h>
+
+#include "minithread_private.h"
+#include "multilevel_queue.h"
+#include "scheduler_policy.h"
+
+#define MAXVAL 100
+
+int number_of_levels = 4;
+int maxval = MAXVAL;
+static int quanta_durations[4] = {1, 2, 4, 8};
+static int quanta_proportions[4] = {0,50, 75, 90};
+
+//Level to peek for every value of the frequency counter, built from quanta_proportions.
+static unsigned char level_of_slot[MAXVAL];
+
+// A thread's level is its queued_level. The frequency counter goes round
+// the slots, so that every dequeue starts looking at level l for
+// quanta_proportions[l + 1] - quanta_proportions[l] out of maxval dequeues.
+typedef struct mlfq {
+	multilevel_queue_t 	queue;
+	int 				freq_count;
+} mlfq;
+
+//Fill level_of_slot: level l gets the slots from its proportion up to the next level's.
+static void mlfq_init_slots(){
+	int slot;
+	int level = 0;
+
+	for(slot = 0; slot < maxval; slot++){
+		while(level < number_of_levels - 1 && slot >= quanta_proportions[level + 1]) level++;
+		level_of_slot[slot] = level;
+	}
+}
+
+static void *mlfq_create(){
+	mlfq *q = (mlfq *) malloc(sizeof(mlfq));
+	if(q == NULL) return NULL;
+
+	q->queue = multilevel_queue_new(number_of_levels);
+	if(q->queue == NULL){
+		free(q);
+		return NULL;
+	}
+	q->freq_count = 0;
+	mlfq_init_slots();
+	return q;
+}
+
+static void mlfq_destroy(void *run_queue){
+	mlfq *q = (mlfq *) run_queue;
+
+	multilevel_queue_free(q->queue);
+	free(q);
+}
+
+static void mlfq_wake(void *run_queue, minithread_t t){
+	mlfq *q = (mlfq *) run_queue;
+
+	t->queued_level = 0;
+	multilevel_queue_enqueue(q->queue, 0, &t->queue_link);
+}
+
+//A thread switched out without blocking goes one level down.
+static void mlfq_enqueue(void *run_queue, minithread_t t){
+	mlfq *q = (mlfq *) run_queue;
+
+	if(t->queued_level < number_of_levels - 1) t->queued_level++;
+	multilevel_queue_enqueue(q->queue, t->queued_level, &t->queue_link);
+}
+
+//Pick the level to peek on the multilevel_queue based on the frequency counter.
+static int mlfq_pick_level(mlfq *q){
+	int level = level_of_slot[q->freq_count];
+
+	if(++q->freq_count == maxval) q->freq_count = 0;
+
+	return level;
+}
+
+static minithread_t mlfq_dequeue(void *run_queue){
+	mlfq *q = (mlfq *) run_queue;
+	iqueue_link_t link;
+	minithread_t t;
+	int level = mlfq_pick_level(q);
+	int deq_level;
+
+	deq_level = multilevel_queue_dequeue(q->queue, level, &link);
+
+	if(deq_level == -1){
+		//No threads found from the picked level down, start over from 0.
+		level = 0;
+		q->freq_count = quanta_proportions[level];
+		deq_level = multilevel_queue_dequeue(q->queue, level, &link);
+		if(deq_level == -1) return NULL;
+	}
+
+	if(deq_level != level){
+		q->freq_count = quanta_proportions[deq_level];
+	}
+
+	t = minithread_of(link);
+	t->queued_level = deq_level;
+	return t;
+}
+
+static void mlfq_remove(void *run_queue, minithread_t t){
+	mlfq *q = (mlfq *) run_queue;
+
+	multilevel_queue_delete(q->queue, t->queued_level, &t->queue_link);
+}
+
+static int mlfq_tick(void *run_queue, minithread_t t, int quanta){
+	int duration = quanta_durations[t->queued_level];
+
+	return quanta >= duration ? 0 : duration - quanta;
+}
+
+const scheduler_ops scheduler_mlfq = {
+	"mlfq",
+	mlfq_create,
+	mlfq_destroy,
+	mlfq_wake,
+	mlfq_enqueue,
+	mlfq_dequeue,
+	mlfq_remove,
+	mlfq_tick,
+	NULL
+};
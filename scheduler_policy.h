@@ -0,0 +1,81 @@
+/*
+ * scheduler_policy.h:
+ *  Scheduling policies. Every virtual processor has a ready queue, kept by
+ *  the scheduler in minithread.c. Threads with a priority above
+ *  MINITHREAD_PRIORITY_NORMAL are run first, round robin; which of the
+ *  others runs next, and for how long, is up to the policy, chosen once at
+ *  minithread_system_initialize (see minithread_set_scheduler).
+ *
+ *  A policy is a table of hooks on a run queue of its own, one per virtual
+ *  processor. They are all called with interrupts disabled. A thread is on
+ *  at most one run queue at a time, linked through its queue_link, or its
+ *  run_node for a policy that keeps a tree.
+ */
+#ifndef __SCHEDULER_POLICY_H__
+#define __SCHEDULER_POLICY_H__
+
+#include "minithread.h"
+
+typedef struct scheduler_ops {
+	const char *name;
+
+	/* Allocate an empty run queue. Returns NULL on failure. */
+	void *(*create)();
+
+	/* Free an empty run queue. */
+	void (*destroy)(void *run_queue);
+
+	/* Queue t, which just became runnable: new, woken up or moved. */
+	void (*wake)(void *run_queue, minithread_t t);
+
+	/* Queue t, which was running and stopped without blocking. */
+	void (*enqueue)(void *run_queue, minithread_t t);
+
+	/* Take the thread to run next off the queue. Returns NULL if it is empty. */
+	minithread_t (*dequeue)(void *run_queue);
+
+	/* Take t off the queue, wherever it is on it. */
+	void (*remove)(void *run_queue, minithread_t t);
+
+	/*
+	 * t has run for quanta quanta of its time slice (0 when it starts
+	 * one). Returns how many more it gets, 0 to preempt it now or -1 to
+	 * let it run until it blocks or yields.
+	 */
+	int (*tick)(void *run_queue, minithread_t t, int quanta);
+
+	/*
+	 * Whether t, which just woke up, should preempt current, which is
+	 * running. May be NULL: woken up threads then wait for the running
+	 * one's time slice to end.
+	 */
+	int (*preempt)(void *run_queue, minithread_t current, minithread_t t);
+} scheduler_ops;
+
+/*
+ * The policies that come with the system.
+ *
+ * scheduler_mlfq: multilevel feedback queue. Threads start at the top
+ *  level and move down one level, to longer time slices, every time they
+ *  are switched out without blocking. Lower levels are visited less often.
+ *
+ * scheduler_stride, scheduler_lottery: proportional share. A thread gets
+ *  processor time in proportion to its tickets (minithread_set_tickets),
+ *  deterministically (the thread that ran the least per ticket goes next)
+ *  or by drawing a ticket at random.
+ *
+ * scheduler_fifo: first come, first served. Threads run until they block
+ *  or yield.
+ *
+ * scheduler_cfs: completely fair. Threads are charged the processor time
+ *  they actually use, weighted by their tickets, and the one that has been
+ *  charged the least runs next. A thread that wakes up preempts the running
+ *  one if that one is well ahead of it.
+ */
+extern const scheduler_ops scheduler_mlfq;
+extern const scheduler_ops scheduler_stride;
+extern const scheduler_ops scheduler_lottery;
+extern const scheduler_ops scheduler_fifo;
+extern const scheduler_ops scheduler_cfs;
+
+#endif /*__SCHEDULER_POLICY_H__*/
@@ -0,0 +1,111 @@
+/*
+ * Stride scheduling policy.
+ *
+ */
+#include <stdlib.h>
+
+#include "minithread_private.h"
+#include "intrusive_queue.h"
+#include "scheduler_policy.h"
+
+// Every thread has a virtual time (its pass), which advances as it runs,
+// more slowly the more tickets it has: a thread with the default number of
+// tickets advances at the rate of real time. The thread with the lowest
+// virtual time runs next, so over time every thread gets processor time in
+// proportion to its tickets.
+//
+// The queue is kept sorted by virtual time. A thread coming off the
+// processor usually has the highest, so it is inserted looking from the
+// back. The queue's own virtual time is that of the last thread dequeued:
+// a thread that slept is brought up to it, rather than being allowed to
+// catch up on the time it did not use.
+typedef struct stride {
+	iqueue 		queue;
+	uint64_t 	vtime;
+} stride;
+
+//Advance the virtual time of t by the time it ran since it was last charged.
+static void stride_charge(minithread_t t){
+	uint64_t ran = t->stats.run_time - t->vtime_charged;
+
+	t->vtime += ran * MINITHREAD_TICKETS_DEFAULT / t->tickets;
+	t->vtime_charged = t->stats.run_time;
+}
+
+//Insert t after the threads whose virtual time is not above its own.
+static void stride_insert(stride *s, minithread_t t){
+	iqueue_link_t link;
+
+	for(link = iqueue_last(&s->queue); link != NULL; link = iqueue_prev(&s->queue, link)){
+		if(minithread_of(link)->vtime <= t->vtime) break;
+	}
+
+	if(link == NULL){
+		iqueue_prepend(&s->queue, &t->queue_link);
+	} else if(iqueue_next(&s->queue, link) == NULL){
+		iqueue_append(&s->queue, &t->queue_link);
+	} else {
+		iqueue_insert_before(&s->queue, iqueue_next(&s->queue, link), &t->queue_link);
+	}
+}
+
+static void *stride_create(){
+	stride *s = (stride *) malloc(sizeof(stride));
+	if(s == NULL) return NULL;
+
+	iqueue_init(&s->queue);
+	s->vtime = 0;
+	return s;
+}
+
+static void stride_destroy(void *run_queue){
+	free(run_queue);
+}
+
+static void stride_enqueue(void *run_queue, minithread_t t){
+	stride *s = (stride *) run_queue;
+
+	stride_charge(t);
+	//It may have been stolen from another processor, with a clock of its own.
+	if(t->vtime < s->vtime) t->vtime = s->vtime;
+	stride_insert(s, t);
+}
+
+static void stride_wake(void *run_queue, minithread_t t){
+	stride_enqueue(run_queue, t);
+}
+
+static minithread_t stride_dequeue(void *run_queue){
+	stride *s = (stride *) run_queue;
+	iqueue_link_t link;
+	minithread_t t;
+
+	if(iqueue_dequeue(&s->queue, &link) == -1) return NULL;
+
+	t = minithread_of(link);
+	s->vtime = t->vtime;
+	return t;
+}
+
+static void stride_remove(void *run_queue, minithread_t t){
+	stride *s = (stride *) run_queue;
+
+	iqueue_delete(&s->queue, &t->queue_link);
+}
+
+//Every thread runs for one quantum at a time.
+static int stride_tick(void *run_queue, minithread_t t, int quanta){
+	return quanta >= 1 ? 0 : 1;
+}
+
+const scheduler_ops scheduler_stride = {
+	"stride",
+	stride_create,
+	stride_destroy,
+	stride_wake,
+	stride_enqueue,
+	stride_dequeue,
+	stride_remove,
+	stride_tick,
+	NULL
+};
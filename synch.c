@@ -4,8 +4,9 @@
 
 #include "defs.h"
 #include "synch.h"
-#include "queue.h"
+#include "intrusive_queue.h"
 #include "minithread.h"
+#include "minithread_private.h"
 #include "interrupts.h"
 
 /*
@@ -17,10 +18,21 @@
  * Semaphores.
  */
 typedef struct semaphore {
-    queue_t waiting_q;
+    iqueue waiting_q;   // waiting threads, highest priority first
     int count;
+    int tracks_owner;   // initialized with semaphore_initialize_mutex
+    int handoff;        // V switches to the thread it wakes up
+    minithread_t owner;
+    iqueue_link owner_link; // on the owner's owned_semaphores
+    iqueue watchers;        // wait set entries watching it
 } semaphore;
 
+#define semaphore_of(link) iqueue_entry(link, semaphore, owner_link)
+
+static void semaphore_release(semaphore_t sem);
+static void waitset_notify(semaphore_t sem);
+static void waitset_detach(semaphore_t sem);
+
 
 /*
  * semaphore_t semaphore_create()
@@ -28,14 +40,19 @@ typedef struct semaphore {
  */
 semaphore_t semaphore_create() {
     semaphore_t new_semaphore = (semaphore *)malloc(sizeof(semaphore));
-    new_semaphore->waiting_q = queue_new();
+    iqueue_init(&new_semaphore->waiting_q);
+    new_semaphore->tracks_owner = 0;
+    new_semaphore->handoff = 0;
+    new_semaphore->owner = NULL;
+    iqueue_link_init(&new_semaphore->owner_link);
+    iqueue_init(&new_semaphore->watchers);
 	
     return new_semaphore;
 }
 
 /*
  * semaphore_destroy(semaphore_t sem);
- *      Deallocate a semaphore.
+ *      Deallocate a semaphore, and stop the wait sets watching it.
  */
 void semaphore_destroy(semaphore_t sem) {
     interrupt_level_t old_interrupt_level;
@@ -47,7 +64,8 @@ void semaphore_destroy(semaphore_t sem) {
     // will re-enable at the end of this function.
     old_interrupt_level = set_interrupt_level(DISABLED);
 
-    queue_free(sem->waiting_q);
+    semaphore_release(sem);
+    waitset_detach(sem);
     free(sem);
 
     set_interrupt_level(old_interrupt_level);
@@ -70,6 +88,116 @@ void semaphore_initialize(semaphore_t sem, int cnt) {
     set_interrupt_level(old_interrupt_level);
 }
 
+/*
+ * semaphore_initialize_mutex(semaphore_t sem)
+ *      initialize sem with a count of 1, owned by the thread that P's it.
+ */
+void semaphore_initialize_mutex(semaphore_t sem) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    sem->count = 1;
+    sem->tracks_owner = 1;
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * semaphore_set_handoff(semaphore_t sem, int handoff)
+ *      turn directed handoff on V on or off.
+ */
+void semaphore_set_handoff(semaphore_t sem, int handoff) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    sem->handoff = handoff;
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+
+/*
+ * Priority inheritance. Waiters are kept in priority order, FIFO among
+ * equals, so that V wakes up the most urgent one. A thread blocking on a
+ * semaphore with an owner lends its priority to the owner, and on down the
+ * chain of owners blocked on semaphores of their own. The owner gets its
+ * own priority back when it gives the semaphore up.
+ */
+
+// Put t on the waiting queue of sem, behind the threads of the same or higher priority.
+static void semaphore_wait_insert(semaphore_t sem, minithread_t t) {
+    iqueue_link_t link;
+
+    for (link = iqueue_first(&sem->waiting_q); link != NULL;
+         link = iqueue_next(&sem->waiting_q, link)) {
+        if (minithread_of(link)->effective_priority < t->effective_priority) {
+            iqueue_insert_before(&sem->waiting_q, link, &t->queue_link);
+            return;
+        }
+    }
+    iqueue_append(&sem->waiting_q, &t->queue_link);
+}
+
+// Raise the owner of sem, and the owners it waits for in turn, to priority.
+static void semaphore_donate(semaphore_t sem, int priority) {
+    while (sem != NULL && sem->owner != NULL &&
+           sem->owner->effective_priority < priority) {
+        minithread_t owner = sem->owner;
+
+        minithread_set_effective_priority(owner, priority);
+        sem = owner->blocked_on;
+        if (sem != NULL) {
+            iqueue_delete(&sem->waiting_q, &owner->queue_link);
+            semaphore_wait_insert(sem, owner);
+        }
+    }
+}
+
+int semaphore_donated_priority(minithread_t t) {
+    iqueue_link_t link;
+    int priority = MINITHREAD_PRIORITY_NORMAL;
+
+    for (link = iqueue_first(&t->owned_semaphores); link != NULL;
+         link = iqueue_next(&t->owned_semaphores, link)) {
+        iqueue_link_t first = iqueue_first(&semaphore_of(link)->waiting_q);
+
+        if (first != NULL && minithread_of(first)->effective_priority > priority)
+            priority = minithread_of(first)->effective_priority;
+    }
+    return priority;
+}
+
+void semaphore_priority_changed(minithread_t t) {
+    semaphore_t sem = t->blocked_on;
+
+    if (sem == NULL) return;
+
+    iqueue_delete(&sem->waiting_q, &t->queue_link);
+    semaphore_wait_insert(sem, t);
+    semaphore_donate(sem, t->effective_priority);
+}
+
+// Make t the owner of sem, if it tracks its owner.
+static void semaphore_acquire(semaphore_t sem, minithread_t t) {
+    if (!sem->tracks_owner) return;
+
+    sem->owner = t;
+    iqueue_append(&t->owned_semaphores, &sem->owner_link);
+}
+
+// Take sem away from its owner, which goes back to the priority it had without it.
+static void semaphore_release(semaphore_t sem) {
+    minithread_t owner = sem->owner;
+    int inherited;
+
+    if (owner == NULL) return;
+
+    iqueue_delete(&owner->owned_semaphores, &sem->owner_link);
+    sem->owner = NULL;
+
+    inherited = semaphore_donated_priority(owner);
+    minithread_set_effective_priority(owner,
+        owner->priority > inherited ? owner->priority : inherited);
+}
+
 
 /*
  * semaphore_P(semaphore_t sem)
@@ -84,15 +212,96 @@ void semaphore_P(semaphore_t sem) {
 
     if (--sem->count < 0) {
         // Resources are not available. Thread should be added to
-        // the waiting queue.
-        queue_append(sem->waiting_q, minithread_self());
-        set_interrupt_level(old_interrupt_level);
-        minithread_stop();
+        // the waiting queue. It blocks with interrupts still disabled,
+        // so a V on another processor cannot slip in before it stops.
+        // V hands the semaphore over, ownership included.
+        minithread_t self = minithread_self();
+
+        semaphore_wait_insert(sem, self);
+        self->blocked_on = sem;
+        semaphore_donate(sem, self->effective_priority);
+        minithread_block(MINITHREAD_BLOCK_SEMAPHORE);
+    } else {
+        semaphore_acquire(sem, minithread_self());
     }
 
     set_interrupt_level(old_interrupt_level);
 }
 
+/*
+ * A timed P arms the alarm embedded in the waiting thread's TCB, which
+ * is free as the thread cannot sleep meanwhile, with a wait record on the
+ * thread's stack. If the alarm goes off while the thread is still queued,
+ * it takes the thread off the queue, with the count it took, and wakes it
+ * up. If a V got to the thread first, the alarm does nothing.
+ */
+typedef struct semaphore_timed_wait {
+    minithread_t thread;
+    int timed_out;
+} semaphore_timed_wait;
+
+static void semaphore_timeout(void *arg) {
+    semaphore_timed_wait *wait = (semaphore_timed_wait *)arg;
+    minithread_t t = wait->thread;
+    semaphore_t sem = t->blocked_on;
+    minithread_t owner;
+
+    if (sem == NULL) return;
+
+    iqueue_delete(&sem->waiting_q, &t->queue_link);
+    sem->count++;
+    t->blocked_on = NULL;
+    wait->timed_out = 1;
+
+    // The owner no longer inherits from t.
+    owner = sem->owner;
+    if (owner != NULL) {
+        int inherited = semaphore_donated_priority(owner);
+
+        minithread_set_effective_priority(owner,
+            owner->priority > inherited ? owner->priority : inherited);
+        semaphore_priority_changed(owner);
+    }
+
+    minithread_start(t);
+}
+
+/*
+ * int semaphore_P_timeout(semaphore_t sem, int timeout)
+ *      P on the semaphore, giving up after timeout milliseconds.
+ */
+int semaphore_P_timeout(semaphore_t sem, int timeout) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+    semaphore_timed_wait wait;
+
+    wait.timed_out = 0;
+
+    if (--sem->count < 0) {
+        minithread_t self = minithread_self();
+
+        if (timeout <= 0) {
+            sem->count++;
+            set_interrupt_level(old_interrupt_level);
+            return 1;
+        }
+
+        wait.thread = self;
+        semaphore_wait_insert(sem, self);
+        self->blocked_on = sem;
+        semaphore_donate(sem, self->effective_priority);
+        register_alarm_embedded(&self->sleep_alarm, timeout, semaphore_timeout, &wait);
+        minithread_block(MINITHREAD_BLOCK_SEMAPHORE);
+
+        // The record on the stack goes away with this call.
+        deregister_alarm(&self->sleep_alarm);
+    } else {
+        semaphore_acquire(sem, minithread_self());
+    }
+
+    set_interrupt_level(old_interrupt_level);
+    return wait.timed_out;
+}
+
 /*
  * semaphore_V(semaphore_t sem)
  *      V on the sempahore.
@@ -104,13 +313,801 @@ void semaphore_V(semaphore_t sem) {
     // will re-enable at the end of this function.
     interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
 
+    semaphore_release(sem);
+
     if (++sem->count <= 0) {
-        // Threads are waiting on resources, so pop one off the
-        // queue and start it
-        minithread_t thread_to_start;
-        queue_dequeue(sem->waiting_q, (void **)&thread_to_start);
-        minithread_start(thread_to_start);
+        // Threads are waiting on resources, so pop the most urgent one
+        // off the queue and start it. It inherits from those left.
+        iqueue_link_t link;
+        iqueue_link_t next;
+        minithread_t t;
+
+        iqueue_dequeue(&sem->waiting_q, &link);
+        t = minithread_of(link);
+        t->blocked_on = NULL;
+        semaphore_acquire(sem, t);
+
+        next = iqueue_first(&sem->waiting_q);
+        if (next != NULL) semaphore_donate(sem, minithread_of(next)->effective_priority);
+
+        minithread_start(t);
+
+        // With handoff, a thread (not an interrupt handler, which runs
+        // with interrupts disabled) switches to the waiter right away,
+        // unless that would let a less urgent thread run first.
+        if (sem->handoff && old_interrupt_level == ENABLED &&
+            t->effective_priority >= minithread_self()->effective_priority) {
+            minithread_yield_to(t);
+        }
+    } else if (iqueue_length(&sem->watchers) > 0) {
+        waitset_notify(sem);
+    }
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+
+/*
+ * Mutexes. The state word is all the fast paths touch: a thread locks a
+ * free mutex with one compare and swap, and unlocks it with one swap,
+ * which finds out whether anybody waits. Waiting threads mark it
+ * contended, queue themselves and block, all with interrupts disabled,
+ * so the unlocking thread, which takes the slow path to wake one up,
+ * cannot miss them. A woken thread competes for the mutex again with
+ * the ones that did not wait.
+ */
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2   // locked, and threads may be waiting
+
+typedef struct mutex {
+    int state;
+    iqueue waiting_q;
+} mutex;
+
+typedef struct cond {
+    iqueue waiting_q;
+} cond;
+
+/*
+ * mutex_t mutex_create()
+ *      Allocate a new, unlocked mutex.
+ */
+mutex_t mutex_create() {
+    mutex_t m = (mutex *)malloc(sizeof(mutex));
+
+    if (m == NULL) return NULL;
+    m->state = MUTEX_UNLOCKED;
+    iqueue_init(&m->waiting_q);
+
+    return m;
+}
+
+/*
+ * mutex_destroy(mutex_t m)
+ *      Deallocate a mutex.
+ */
+void mutex_destroy(mutex_t m) {
+    free(m);
+}
+
+/*
+ * mutex_lock(mutex_t m)
+ *      Lock m, blocking until it is free.
+ */
+void mutex_lock(mutex_t m) {
+    interrupt_level_t old_interrupt_level;
+
+    if (compare_and_swap(&m->state, MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED)
+        return;
+
+    // Contended: from now on the mutex stays marked as such until it is
+    // unlocked, as other threads may queue up behind this one.
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    while (swap(&m->state, MUTEX_CONTENDED) != MUTEX_UNLOCKED) {
+        iqueue_append(&m->waiting_q, &minithread_self()->queue_link);
+        minithread_block(MINITHREAD_BLOCK_MUTEX);
+    }
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * int mutex_trylock(mutex_t m)
+ *      Lock m if it is free. Returns 0 (success) or -1 (failure).
+ */
+int mutex_trylock(mutex_t m) {
+    return compare_and_swap(&m->state, MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED ? 0 : -1;
+}
+
+/*
+ * mutex_unlock(mutex_t m)
+ *      Unlock m, waking up a waiting thread if it was contended.
+ */
+void mutex_unlock(mutex_t m) {
+    interrupt_level_t old_interrupt_level;
+    iqueue_link_t link;
+
+    if (swap(&m->state, MUTEX_UNLOCKED) == MUTEX_LOCKED) return;
+
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    if (iqueue_dequeue(&m->waiting_q, &link) == 0)
+        minithread_start(minithread_of(link));
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+
+/*
+ * Condition variables. A waiting thread queues itself and unlocks the
+ * mutex with interrupts disabled, and blocks before enabling them again,
+ * so signals, which disable them too, either find it queued or come
+ * before it unlocked the mutex.
+ */
+
+/*
+ * cond_t cond_create()
+ *      Allocate a new condition variable.
+ */
+cond_t cond_create() {
+    cond_t c = (cond *)malloc(sizeof(cond));
+
+    if (c == NULL) return NULL;
+    iqueue_init(&c->waiting_q);
+
+    return c;
+}
+
+/*
+ * cond_destroy(cond_t c)
+ *      Deallocate a condition variable.
+ */
+void cond_destroy(cond_t c) {
+    free(c);
+}
+
+/*
+ * cond_wait(cond_t c, mutex_t m)
+ *      Unlock m and wait on c, then lock m again.
+ */
+void cond_wait(cond_t c, mutex_t m) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    iqueue_append(&c->waiting_q, &minithread_self()->queue_link);
+    mutex_unlock(m);
+    minithread_block(MINITHREAD_BLOCK_COND);
+
+    set_interrupt_level(old_interrupt_level);
+
+    mutex_lock(m);
+}
+
+/*
+ * cond_signal(cond_t c)
+ *      Wake up the first thread waiting on c.
+ */
+void cond_signal(cond_t c) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+    iqueue_link_t link;
+
+    if (iqueue_dequeue(&c->waiting_q, &link) == 0)
+        minithread_start(minithread_of(link));
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * cond_broadcast(cond_t c)
+ *      Wake up every thread waiting on c.
+ */
+void cond_broadcast(cond_t c) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    minithread_start_all(&c->waiting_q);
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+
+/*
+ * Reader-writer locks. The state word holds the number of readers, or
+ * RWLOCK_WRITER, and RWLOCK_WAITING once threads are queued. The fast
+ * paths only succeed while nobody waits: readers add themselves, the
+ * last reader out and writers clear the word, with one compare and swap.
+ * Everything else happens with interrupts disabled: threads that have to
+ * wait set RWLOCK_WAITING and queue up, and whoever frees the lock while
+ * it is set hands it over to the next writer or to all waiting readers,
+ * which return holding it. The fast paths change the word in between, so
+ * the slow paths update it with compare and swap as well.
+ */
+#define RWLOCK_WRITER   (1 << 30)
+#define RWLOCK_WAITING  (1 << 29)
+#define RWLOCK_READERS  (RWLOCK_WAITING - 1)
+
+typedef struct rwlock {
+    int state;
+    int prefer_writers;
+    iqueue readers_q;
+    iqueue writers_q;
+} rwlock;
+
+/*
+ * rwlock_t rwlock_create(int prefer_writers)
+ *      Allocate a new, free reader-writer lock.
+ */
+rwlock_t rwlock_create(int prefer_writers) {
+    rwlock_t l = (rwlock *)malloc(sizeof(rwlock));
+
+    if (l == NULL) return NULL;
+    l->state = 0;
+    l->prefer_writers = prefer_writers;
+    iqueue_init(&l->readers_q);
+    iqueue_init(&l->writers_q);
+
+    return l;
+}
+
+/*
+ * rwlock_destroy(rwlock_t l)
+ *      Deallocate a reader-writer lock.
+ */
+void rwlock_destroy(rwlock_t l) {
+    free(l);
+}
+
+// Hand the lock, which nobody holds any more, over to the threads waiting
+// for it. Must be called with interrupts disabled.
+static void rwlock_wake(rwlock_t l) {
+    iqueue_link_t link;
+    int readers;
+
+    if (iqueue_length(&l->writers_q) > 0 &&
+        (l->prefer_writers || iqueue_length(&l->readers_q) == 0)) {
+        iqueue_dequeue(&l->writers_q, &link);
+        swap(&l->state, RWLOCK_WRITER |
+             (iqueue_length(&l->writers_q) + iqueue_length(&l->readers_q) > 0 ? RWLOCK_WAITING : 0));
+        minithread_start(minithread_of(link));
+        return;
+    }
+
+    readers = iqueue_length(&l->readers_q);
+    swap(&l->state, readers | (iqueue_length(&l->writers_q) > 0 ? RWLOCK_WAITING : 0));
+    minithread_start_all(&l->readers_q);
+}
+
+/*
+ * rwlock_rdlock(rwlock_t l)
+ *      Take l for reading, blocking while a writer holds it (or, with
+ *      writer preference, waits for it).
+ */
+void rwlock_rdlock(rwlock_t l) {
+    interrupt_level_t old_interrupt_level;
+    int state = l->state;
+
+    if (!(state & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+        compare_and_swap(&l->state, state, state + 1) == state)
+        return;
+
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    while (1) {
+        state = l->state;
+        if (!(state & RWLOCK_WRITER) &&
+            !(l->prefer_writers && iqueue_length(&l->writers_q) > 0)) {
+            if (compare_and_swap(&l->state, state, state + 1) == state) break;
+        } else if (compare_and_swap(&l->state, state, state | RWLOCK_WAITING) == state) {
+            // Woken up holding the lock.
+            iqueue_append(&l->readers_q, &minithread_self()->queue_link);
+            minithread_block(MINITHREAD_BLOCK_RWLOCK);
+            break;
+        }
+    }
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * rwlock_rdunlock(rwlock_t l)
+ *      Release l, taken for reading. The last reader out wakes up the
+ *      threads waiting for it.
+ */
+void rwlock_rdunlock(rwlock_t l) {
+    interrupt_level_t old_interrupt_level;
+    int state;
+
+    while (1) {
+        state = l->state;
+        if ((state & RWLOCK_WAITING) && (state & RWLOCK_READERS) == 1) break;
+        if (compare_and_swap(&l->state, state, state - 1) == state) return;
+    }
+
+    // Readers may still come in, with interrupts disabled, until this
+    // one disables them too.
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    while (1) {
+        state = l->state;
+        if ((state & RWLOCK_READERS) == 1) {
+            if (compare_and_swap(&l->state, state, RWLOCK_WAITING) == state) {
+                rwlock_wake(l);
+                break;
+            }
+        } else if (compare_and_swap(&l->state, state, state - 1) == state) {
+            break;
+        }
+    }
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * rwlock_wrlock(rwlock_t l)
+ *      Take l for writing, blocking while anybody holds it.
+ */
+void rwlock_wrlock(rwlock_t l) {
+    interrupt_level_t old_interrupt_level;
+    int state;
+
+    if (compare_and_swap(&l->state, 0, RWLOCK_WRITER) == 0) return;
+
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    while (1) {
+        state = l->state;
+        if ((state & ~RWLOCK_WAITING) == 0) {
+            if (compare_and_swap(&l->state, state, state | RWLOCK_WRITER) == state) break;
+        } else if (compare_and_swap(&l->state, state, state | RWLOCK_WAITING) == state) {
+            // Woken up holding the lock.
+            iqueue_append(&l->writers_q, &minithread_self()->queue_link);
+            minithread_block(MINITHREAD_BLOCK_RWLOCK);
+            break;
+        }
+    }
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * rwlock_wrunlock(rwlock_t l)
+ *      Release l, taken for writing, waking up the threads waiting for it.
+ */
+void rwlock_wrunlock(rwlock_t l) {
+    interrupt_level_t old_interrupt_level;
+
+    if (compare_and_swap(&l->state, RWLOCK_WRITER, 0) == RWLOCK_WRITER) return;
+
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    rwlock_wake(l);
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+
+/*
+ * Sequence locks. The sequence number is odd while a writer is at work.
+ * Writers exclude each other, and interrupt handlers, by disabling
+ * interrupts, which they restore from the lock when done.
+ */
+typedef struct seqlock {
+    volatile unsigned int sequence;
+    interrupt_level_t writer_level;
+} seqlock;
+
+/*
+ * seqlock_t seqlock_create()
+ *      Allocate a new sequence lock.
+ */
+seqlock_t seqlock_create() {
+    seqlock_t s = (seqlock *)malloc(sizeof(seqlock));
+
+    if (s == NULL) return NULL;
+    s->sequence = 0;
+
+    return s;
+}
+
+/*
+ * seqlock_destroy(seqlock_t s)
+ *      Deallocate a sequence lock.
+ */
+void seqlock_destroy(seqlock_t s) {
+    free(s);
+}
+
+/*
+ * unsigned int seqlock_read_begin(seqlock_t s)
+ *      Wait for the writer at work, if any, and return the sequence number.
+ */
+unsigned int seqlock_read_begin(seqlock_t s) {
+    unsigned int seq;
+
+    while ((seq = s->sequence) & 1)
+        ;
+    __sync_synchronize();
+
+    return seq;
+}
+
+/*
+ * int seqlock_read_retry(seqlock_t s, unsigned int seq)
+ *      Whether the sequence number moved on from seq.
+ */
+int seqlock_read_retry(seqlock_t s, unsigned int seq) {
+    __sync_synchronize();
+
+    return s->sequence != seq;
+}
+
+/*
+ * seqlock_write_lock(seqlock_t s)
+ *      Disable interrupts and make the sequence number odd.
+ */
+void seqlock_write_lock(seqlock_t s) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    s->writer_level = old_interrupt_level;
+    s->sequence++;
+    __sync_synchronize();
+}
+
+/*
+ * seqlock_write_unlock(seqlock_t s)
+ *      Make the sequence number even again, and restore interrupts.
+ */
+void seqlock_write_unlock(seqlock_t s) {
+    __sync_synchronize();
+    s->sequence++;
+
+    set_interrupt_level(s->writer_level);
+}
+
+
+/*
+ * Barriers and latches. Their waiting threads are queued on them, and
+ * released all at once by minithread_start_all, which empties the queue:
+ * a barrier is ready for its next round as soon as the last thread of a
+ * round arrives.
+ */
+typedef struct barrier {
+    int parties;
+    int arrived;
+    iqueue waiting_q;
+} barrier;
+
+typedef struct latch {
+    int count;
+    iqueue waiting_q;
+} latch;
+
+/*
+ * barrier_t barrier_create(int parties)
+ *      Allocate a new barrier for parties threads.
+ */
+barrier_t barrier_create(int parties) {
+    barrier_t b;
+
+    if (parties < 1) return NULL;
+
+    b = (barrier *)malloc(sizeof(barrier));
+    if (b == NULL) return NULL;
+    b->parties = parties;
+    b->arrived = 0;
+    iqueue_init(&b->waiting_q);
+
+    return b;
+}
+
+/*
+ * barrier_destroy(barrier_t b)
+ *      Deallocate a barrier.
+ */
+void barrier_destroy(barrier_t b) {
+    free(b);
+}
+
+/*
+ * int barrier_wait(barrier_t b)
+ *      Wait for the others, or release them all if the caller is the last
+ *      one of the round.
+ */
+int barrier_wait(barrier_t b) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    if (++b->arrived < b->parties) {
+        iqueue_append(&b->waiting_q, &minithread_self()->queue_link);
+        minithread_block(MINITHREAD_BLOCK_BARRIER);
+        set_interrupt_level(old_interrupt_level);
+        return 0;
+    }
+
+    b->arrived = 0;
+    minithread_start_all(&b->waiting_q);
+
+    set_interrupt_level(old_interrupt_level);
+    return 1;
+}
+
+/*
+ * latch_t latch_create(int count)
+ *      Allocate a new latch, open if count is 0.
+ */
+latch_t latch_create(int count) {
+    latch_t l;
+
+    if (count < 0) return NULL;
+
+    l = (latch *)malloc(sizeof(latch));
+    if (l == NULL) return NULL;
+    l->count = count;
+    iqueue_init(&l->waiting_q);
+
+    return l;
+}
+
+/*
+ * latch_destroy(latch_t l)
+ *      Deallocate a latch.
+ */
+void latch_destroy(latch_t l) {
+    free(l);
+}
+
+/*
+ * latch_count_down(latch_t l)
+ *      Decrement the count of l, releasing the waiting threads when it
+ *      gets to 0.
+ */
+void latch_count_down(latch_t l) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    if (l->count > 0 && --l->count == 0)
+        minithread_start_all(&l->waiting_q);
+
+    set_interrupt_level(old_interrupt_level);
+}
+
+/*
+ * int latch_count(latch_t l)
+ *      The count of l.
+ */
+int latch_count(latch_t l) {
+    return l->count;
+}
+
+/*
+ * latch_wait(latch_t l)
+ *      Wait for the count of l to get to 0.
+ */
+void latch_wait(latch_t l) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    if (l->count > 0) {
+        iqueue_append(&l->waiting_q, &minithread_self()->queue_link);
+        minithread_block(MINITHREAD_BLOCK_LATCH);
     }
 
     set_interrupt_level(old_interrupt_level);
 }
+
+
+/*
+ * Wait sets. An entry links a wait set to a semaphore it watches, and is
+ * on the watchers of the semaphore, on the entries of the wait set, and
+ * on its ready queue while the semaphore may be ready: a V that leaves
+ * the count positive queues the entries of the semaphore that are not,
+ * and wakes up the threads waiting on their wait sets. waitset_wait only
+ * looks at the ready queue, so its cost does not grow with the number of
+ * entries. Level-triggered entries it reports go to the back of the queue
+ * and are checked again next time; edge-triggered ones leave it until
+ * the next V.
+ */
+typedef struct waitset {
+    iqueue entries;
+    iqueue ready_q;
+    iqueue waiting_q;   // threads in waitset_wait
+} waitset;
+
+typedef struct waitset_entry {
+    iqueue_link ws_link;    // on the wait set's entries
+    iqueue_link ready_link; // on the wait set's ready_q
+    iqueue_link sem_link;   // on the semaphore's watchers
+    waitset_t ws;
+    semaphore_t sem;
+    int mode;
+    void *data;
+} waitset_entry;
+
+typedef struct waitset_timed_wait {
+    minithread_t thread;
+    waitset_t ws;
+    int timed_out;
+} waitset_timed_wait;
+
+#define entry_of(link, member) iqueue_entry(link, waitset_entry, member)
+
+// Queue e as ready, and wake up the threads waiting for it. Must be
+// called with interrupts disabled.
+static void waitset_ready(waitset_entry *e) {
+    if (!iqueue_linked(&e->ready_link))
+        iqueue_append(&e->ws->ready_q, &e->ready_link);
+    minithread_start_all(&e->ws->waiting_q);
+}
+
+static void waitset_notify(semaphore_t sem) {
+    iqueue_link_t link;
+
+    for (link = iqueue_first(&sem->watchers); link != NULL;
+         link = iqueue_next(&sem->watchers, link))
+        waitset_ready(entry_of(link, sem_link));
+}
+
+// Take e off all its queues and free it. Must be called with interrupts
+// disabled.
+static void waitset_entry_free(waitset_entry *e) {
+    iqueue_delete(&e->ws->entries, &e->ws_link);
+    iqueue_delete(&e->sem->watchers, &e->sem_link);
+    if (iqueue_linked(&e->ready_link))
+        iqueue_delete(&e->ws->ready_q, &e->ready_link);
+    free(e);
+}
+
+// Free the entries watching sem, which is being destroyed.
+static void waitset_detach(semaphore_t sem) {
+    while (iqueue_length(&sem->watchers) > 0)
+        waitset_entry_free(entry_of(iqueue_first(&sem->watchers), sem_link));
+}
+
+// The entry of ws watching sem, or NULL.
+static waitset_entry *waitset_find(waitset_t ws, semaphore_t sem) {
+    iqueue_link_t link;
+
+    for (link = iqueue_first(&sem->watchers); link != NULL;
+         link = iqueue_next(&sem->watchers, link)) {
+        if (entry_of(link, sem_link)->ws == ws) return entry_of(link, sem_link);
+    }
+    return NULL;
+}
+
+/*
+ * waitset_t waitset_create()
+ *      Allocate a new, empty wait set.
+ */
+waitset_t waitset_create() {
+    waitset_t ws = (waitset *)malloc(sizeof(waitset));
+
+    if (ws == NULL) return NULL;
+    iqueue_init(&ws->entries);
+    iqueue_init(&ws->ready_q);
+    iqueue_init(&ws->waiting_q);
+
+    return ws;
+}
+
+/*
+ * waitset_destroy(waitset_t ws)
+ *      Stop watching everything, and deallocate the wait set.
+ */
+void waitset_destroy(waitset_t ws) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+    while (iqueue_length(&ws->entries) > 0)
+        waitset_entry_free(entry_of(iqueue_first(&ws->entries), ws_link));
+
+    set_interrupt_level(old_interrupt_level);
+    free(ws);
+}
+
+/*
+ * int waitset_add(waitset_t ws, semaphore_t sem, int mode, void *data)
+ *      Start watching sem, ready at once if its count is positive.
+ */
+int waitset_add(waitset_t ws, semaphore_t sem, int mode, void *data) {
+    interrupt_level_t old_interrupt_level;
+    waitset_entry *e = (waitset_entry *)malloc(sizeof(waitset_entry));
+
+    if (e == NULL) return -1;
+
+    old_interrupt_level = set_interrupt_level(DISABLED);
+
+    if (waitset_find(ws, sem) != NULL) {
+        set_interrupt_level(old_interrupt_level);
+        free(e);
+        return -1;
+    }
+
+    e->ws = ws;
+    e->sem = sem;
+    e->mode = mode;
+    e->data = data;
+    iqueue_link_init(&e->ws_link);
+    iqueue_link_init(&e->ready_link);
+    iqueue_link_init(&e->sem_link);
+    iqueue_append(&ws->entries, &e->ws_link);
+    iqueue_append(&sem->watchers, &e->sem_link);
+    if (sem->count > 0) waitset_ready(e);
+
+    set_interrupt_level(old_interrupt_level);
+    return 0;
+}
+
+/*
+ * int waitset_remove(waitset_t ws, semaphore_t sem)
+ *      Stop watching sem.
+ */
+int waitset_remove(waitset_t ws, semaphore_t sem) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+    waitset_entry *e = waitset_find(ws, sem);
+
+    if (e != NULL) waitset_entry_free(e);
+
+    set_interrupt_level(old_interrupt_level);
+    return e != NULL ? 0 : -1;
+}
+
+// Report up to max ready entries of ws into ready, and return how many.
+// Must be called with interrupts disabled.
+static int waitset_collect(waitset_t ws, void **ready, int max) {
+    int left = iqueue_length(&ws->ready_q);
+    int n = 0;
+    iqueue_link_t link;
+    waitset_entry *e;
+
+    while (n < max && left-- > 0) {
+        iqueue_dequeue(&ws->ready_q, &link);
+        e = entry_of(link, ready_link);
+
+        if (e->mode == WAITSET_LEVEL) {
+            // Off the queue until the next V if it was drained.
+            if (e->sem->count <= 0) continue;
+            iqueue_append(&ws->ready_q, &e->ready_link);
+        }
+        ready[n++] = e->data;
+    }
+
+    return n;
+}
+
+// Alarm handler ending a timed waitset_wait, unless something became
+// ready first and woke the thread up already.
+static void waitset_timeout(void *arg) {
+    waitset_timed_wait *wait = (waitset_timed_wait *)arg;
+
+    wait->timed_out = 1;
+    if (wait->thread->state == WAITING) {
+        iqueue_delete(&wait->ws->waiting_q, &wait->thread->queue_link);
+        minithread_start(wait->thread);
+    }
+}
+
+/*
+ * int waitset_wait(waitset_t ws, void **ready, int max, int timeout)
+ *      Wait for entries of ws to be ready, for timeout milliseconds at
+ *      most unless it is negative, and report up to max of them.
+ */
+int waitset_wait(waitset_t ws, void **ready, int max, int timeout) {
+    interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+    minithread_t self = minithread_self();
+    waitset_timed_wait wait;
+    int n;
+
+    wait.thread = self;
+    wait.ws = ws;
+    wait.timed_out = 0;
+    if (timeout > 0)
+        register_alarm_embedded(&self->sleep_alarm, timeout, waitset_timeout, &wait);
+
+    // Another thread waiting on ws may take what woke this one up.
+    while ((n = waitset_collect(ws, ready, max)) == 0 && timeout != 0 && !wait.timed_out) {
+        iqueue_append(&ws->waiting_q, &self->queue_link);
+        minithread_block(MINITHREAD_BLOCK_WAITSET);
+    }
+
+    // The record on the stack goes away with this call.
+    if (timeout > 0) deregister_alarm(&self->sleep_alarm);
+
+    set_interrupt_level(old_interrupt_level);
+    return n;
+}
@@ -8,6 +8,13 @@
 
 
 typedef struct semaphore *semaphore_t;
+typedef struct mutex *mutex_t;
+typedef struct cond *cond_t;
+typedef struct rwlock *rwlock_t;
+typedef struct seqlock *seqlock_t;
+typedef struct barrier *barrier_t;
+typedef struct latch *latch_t;
+typedef struct waitset *waitset_t;
 
 
 /*
@@ -22,7 +29,7 @@ extern semaphore_t semaphore_create();
 
 /*
  * semaphore_destroy(semaphore_t sem);
- *  Deallocate a semaphore.
+ *  Deallocate a semaphore. The wait sets watching it stop doing so.
  */
 extern void semaphore_destroy(semaphore_t sem);
 
@@ -33,6 +40,26 @@ extern void semaphore_destroy(semaphore_t sem);
  */
 extern void semaphore_initialize(semaphore_t sem, int cnt);
 
+/*
+ * semaphore_initialize_mutex(semaphore_t sem)
+ *  initialize sem with a count of 1 for use as a lock: the thread
+ *  whose P succeeds owns it until the next V. Threads blocking in P
+ *  lend their priority to the owner meanwhile, and V wakes up the
+ *  waiter with the highest priority.
+ */
+extern void semaphore_initialize_mutex(semaphore_t sem);
+
+/*
+ * semaphore_set_handoff(semaphore_t sem, int handoff)
+ *  With handoff on, a thread whose V wakes up a waiter switches to it
+ *  at once, handing it the rest of its time slice, instead of leaving it
+ *  to wait its turn on the ready queue: a thread passing work back and
+ *  forth with another one gets it done without a scheduling round per
+ *  exchange. V's from interrupt handlers, and ones that would let a
+ *  thread of lower priority run, just wake the waiter up. Off by default.
+ */
+extern void semaphore_set_handoff(semaphore_t sem, int handoff);
+
 
 /*
  * semaphore_P(semaphore_t sem)
@@ -40,6 +67,15 @@ extern void semaphore_initialize(semaphore_t sem, int cnt);
  */
 extern void semaphore_P(semaphore_t sem);
 
+/*
+ * int semaphore_P_timeout(semaphore_t sem, int timeout)
+ *  P on the semaphore, but give up if it does not succeed within timeout
+ *  milliseconds, or at once if timeout is 0 or less. Returns 0 if the P
+ *  succeeded, 1 if it timed out, in which case the count is left as it
+ *  was. Arming the timeout does not allocate.
+ */
+extern int semaphore_P_timeout(semaphore_t sem, int timeout);
+
 /*
  * semaphore_V(semaphore_t sem)
  *  V on the sempahore.
@@ -47,4 +83,278 @@ extern void semaphore_P(semaphore_t sem);
 extern void semaphore_V(semaphore_t sem);
 
 
+/*
+ * Mutexes. Locking a free mutex and unlocking one nobody waits for take
+ * a single atomic operation, without disabling interrupts; only threads
+ * that have to wait, and those waking them up, go through the scheduler.
+ * Unlike semaphore_initialize_mutex, a mutex does not lend the priority
+ * of its waiters to its owner.
+ */
+
+/*
+ * mutex_t mutex_create()
+ *  Allocate a new, unlocked mutex. Returns NULL on failure.
+ */
+extern mutex_t mutex_create();
+
+/*
+ * mutex_destroy(mutex_t m)
+ *  Deallocate a mutex that is not locked.
+ */
+extern void mutex_destroy(mutex_t m);
+
+/*
+ * mutex_lock(mutex_t m)
+ *  Lock m, waiting until it is unlocked if another thread holds it.
+ */
+extern void mutex_lock(mutex_t m);
+
+/*
+ * int mutex_trylock(mutex_t m)
+ *  Lock m if it is unlocked. Returns 0 (success) or -1 if it is held.
+ */
+extern int mutex_trylock(mutex_t m);
+
+/*
+ * mutex_unlock(mutex_t m)
+ *  Unlock m, which the caller holds, waking up a thread waiting for it.
+ */
+extern void mutex_unlock(mutex_t m);
+
+
+/*
+ * Condition variables.
+ */
+
+/*
+ * cond_t cond_create()
+ *  Allocate a new condition variable. Returns NULL on failure.
+ */
+extern cond_t cond_create();
+
+/*
+ * cond_destroy(cond_t c)
+ *  Deallocate a condition variable no thread is waiting on.
+ */
+extern void cond_destroy(cond_t c);
+
+/*
+ * cond_wait(cond_t c, mutex_t m)
+ *  Unlock m, which the caller holds, and wait on c, atomically: a signal
+ *  sent after the caller unlocked m wakes it up. m is locked again before
+ *  it returns. Wake-ups may be spurious, so test the condition in a loop.
+ */
+extern void cond_wait(cond_t c, mutex_t m);
+
+/*
+ * cond_signal(cond_t c)
+ *  Wake up a thread waiting on c, if there is one.
+ */
+extern void cond_signal(cond_t c);
+
+/*
+ * cond_broadcast(cond_t c)
+ *  Wake up all the threads waiting on c.
+ */
+extern void cond_broadcast(cond_t c);
+
+
+/*
+ * Reader-writer locks, for data that is read much more often than it is
+ * written: any number of readers hold the lock at once, or one writer.
+ * As with mutexes, taking or releasing the lock when nobody has to wait
+ * is a single atomic operation. Readers and writers are threads, never
+ * interrupt handlers.
+ */
+
+/*
+ * rwlock_t rwlock_create(int prefer_writers)
+ *  Allocate a new, free reader-writer lock. By default, readers get the
+ *  lock whenever no writer holds it, which may keep writers waiting as
+ *  long as readers keep coming. With prefer_writers, a waiting writer
+ *  holds back new readers, and goes before the waiting readers when the
+ *  lock is released. Returns NULL on failure.
+ */
+extern rwlock_t rwlock_create(int prefer_writers);
+
+/*
+ * rwlock_destroy(rwlock_t l)
+ *  Deallocate a reader-writer lock nobody holds.
+ */
+extern void rwlock_destroy(rwlock_t l);
+
+/*
+ * rwlock_rdlock(rwlock_t l)
+ *  Take l shared, for reading.
+ *
+ * rwlock_rdunlock(rwlock_t l)
+ *  Release l, taken for reading by the caller.
+ */
+extern void rwlock_rdlock(rwlock_t l);
+extern void rwlock_rdunlock(rwlock_t l);
+
+/*
+ * rwlock_wrlock(rwlock_t l)
+ *  Take l exclusive, for writing.
+ *
+ * rwlock_wrunlock(rwlock_t l)
+ *  Release l, taken for writing by the caller.
+ */
+extern void rwlock_wrlock(rwlock_t l);
+extern void rwlock_wrunlock(rwlock_t l);
+
+
+/*
+ * Sequence locks, for records of a few words that are read very often:
+ * readers take no lock at all, but read the record again if a writer
+ * changed it meanwhile.
+ *
+ *  do {
+ *      seq = seqlock_read_begin(lock);
+ *      copy = record;
+ *  } while (seqlock_read_retry(lock, seq));
+ *
+ * Readers must not follow pointers they read, which may be freed under
+ * them. Writers disable interrupts, so interrupt handlers may read, and
+ * must be short.
+ */
+
+/*
+ * seqlock_t seqlock_create()
+ *  Allocate a new sequence lock. Returns NULL on failure.
+ *
+ * seqlock_destroy(seqlock_t s)
+ *  Deallocate a sequence lock.
+ */
+extern seqlock_t seqlock_create();
+extern void seqlock_destroy(seqlock_t s);
+
+/*
+ * unsigned int seqlock_read_begin(seqlock_t s)
+ *  Start reading, and return the sequence number to check the read with.
+ *
+ * int seqlock_read_retry(seqlock_t s, unsigned int seq)
+ *  Whether a writer changed the record since seqlock_read_begin returned
+ *  seq, in which case what was read must be read again.
+ */
+extern unsigned int seqlock_read_begin(seqlock_t s);
+extern int seqlock_read_retry(seqlock_t s, unsigned int seq);
+
+/*
+ * seqlock_write_lock(seqlock_t s)
+ *  Start writing, excluding other writers and interrupts.
+ *
+ * seqlock_write_unlock(seqlock_t s)
+ *  Done writing.
+ */
+extern void seqlock_write_lock(seqlock_t s);
+extern void seqlock_write_unlock(seqlock_t s);
+
+
+/*
+ * Barriers and latches, for work done in phases. A barrier holds back a
+ * fixed number of threads until they all get to it, then lets them all go
+ * on together, and does the same for the next round. A latch holds back
+ * the threads waiting on it until its count is counted down to 0, by
+ * threads or interrupt handlers, and then stays open. Either releases all
+ * the threads it held back at once, in one critical section.
+ */
+
+/*
+ * barrier_t barrier_create(int parties)
+ *  Allocate a new barrier for rounds of parties threads (at least 1).
+ *  Returns NULL on failure.
+ *
+ * barrier_destroy(barrier_t b)
+ *  Deallocate a barrier no thread is waiting on.
+ */
+extern barrier_t barrier_create(int parties);
+extern void barrier_destroy(barrier_t b);
+
+/*
+ * int barrier_wait(barrier_t b)
+ *  Wait until all the parties of the round got to b. Returns 1 in the
+ *  last one to get there, e.g. to do the work between two phases, and 0
+ *  in the others.
+ */
+extern int barrier_wait(barrier_t b);
+
+/*
+ * latch_t latch_create(int count)
+ *  Allocate a new latch, open once it is counted down count times.
+ *  Returns NULL on failure.
+ *
+ * latch_destroy(latch_t l)
+ *  Deallocate a latch no thread is waiting on.
+ */
+extern latch_t latch_create(int count);
+extern void latch_destroy(latch_t l);
+
+/*
+ * latch_count_down(latch_t l)
+ *  Count l down by one, unless it is open already, releasing the threads
+ *  waiting on it if that opens it. May be called from interrupt handlers.
+ *
+ * int latch_count(latch_t l)
+ *  How many more times l has to be counted down.
+ */
+extern void latch_count_down(latch_t l);
+extern int latch_count(latch_t l);
+
+/*
+ * latch_wait(latch_t l)
+ *  Wait for l to open.
+ */
+extern void latch_wait(latch_t l);
+
+
+/*
+ * Wait sets, for a thread serving many semaphores at once, or the ports
+ * and sockets built on them (see miniport_watch and minisocket_watch). A
+ * semaphore is ready when a P on it would not block. A thread waits on a
+ * wait set until some of the semaphores it watches are ready, then P's
+ * them, or receives from the ports and sockets, without blocking.
+ *
+ * Every semaphore is watched in one of two modes. A level-triggered one
+ * is reported by every wait as long as it is ready. An edge-triggered
+ * one is reported once per V, so the thread has to take everything there
+ * is before it waits again. The cost of a wait depends on the number of
+ * semaphores that became ready, not on how many are watched.
+ */
+#define WAITSET_LEVEL 0
+#define WAITSET_EDGE 1
+
+/*
+ * waitset_t waitset_create()
+ *  Allocate a new, empty wait set. Returns NULL on failure.
+ *
+ * waitset_destroy(waitset_t ws)
+ *  Deallocate a wait set no thread is waiting on.
+ */
+extern waitset_t waitset_create();
+extern void waitset_destroy(waitset_t ws);
+
+/*
+ * int waitset_add(waitset_t ws, semaphore_t sem, int mode, void *data)
+ *  Watch sem, in mode WAITSET_LEVEL or WAITSET_EDGE, reporting it as data.
+ *  A semaphore that is ready already is reported by the next wait. Returns
+ *  0 (success) or -1 if ws watches sem already or memory ran out.
+ *
+ * int waitset_remove(waitset_t ws, semaphore_t sem)
+ *  Stop watching sem. Destroying sem does this for every wait set watching
+ *  it. Returns 0 (success) or -1 if ws does not watch it.
+ */
+extern int waitset_add(waitset_t ws, semaphore_t sem, int mode, void *data);
+extern int waitset_remove(waitset_t ws, semaphore_t sem);
+
+/*
+ * int waitset_wait(waitset_t ws, void **ready, int max, int timeout)
+ *  Wait until some of the semaphores ws watches are ready, and store the
+ *  data of up to max of them in ready. Gives up after timeout milliseconds,
+ *  or never if timeout is negative, and only polls if it is 0. Returns how
+ *  many were stored, 0 if it gave up.
+ */
+extern int waitset_wait(waitset_t ws, void **ready, int max, int timeout);
+
+
 #endif /*__SYNCH_H__*/